@@ -1,2 +1,2 @@
-g++ src/main.cpp
-a.exe
+g++ src/main.cpp -lws2_32
+a.exe
\ No newline at end of file
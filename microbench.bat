@@ -0,0 +1,2 @@
+g++ -O2 -std=c++17 src/microbench.cpp -o microbench.exe
+microbench.exe
\ No newline at end of file
@@ -0,0 +1,2 @@
+g++ -O2 -std=c++17 src/refcheck.cpp -o refcheck.exe
+refcheck.exe
\ No newline at end of file
@@ -0,0 +1,2 @@
+g++ -O2 -std=c++17 src/scenebench.cpp -o scenebench.exe
+scenebench.exe --baseline bench_baseline.json
\ No newline at end of file
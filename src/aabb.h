@@ -59,6 +59,11 @@ class aabb {
         return true;
     }
 
+    double surface_area() const {
+        auto dx = x.size(), dy = y.size(), dz = z.size();
+        return 2 * (dx*dy + dy*dz + dz*dx);
+    }
+
     int longest_axis() const {
         // Returns the index of the longest axis of the bounding box.
 
@@ -0,0 +1,129 @@
+#pragma once
+
+#include "rtweekend.h"
+#include "aabb.h"
+
+class affine {
+  public:
+    // An affine map p -> M p + t, stored as the 3x4 matrix [M | t], row major. Points get the
+    // translation, vectors don't, and normals are mapped with the inverse transpose of M.
+
+    double m[3][4] = { {1,0,0,0}, {0,1,0,0}, {0,0,1,0} };
+
+    affine() {}
+
+    static affine translation(const vec3& offset) {
+        affine a;
+        for (int r = 0; r < 3; r++)
+            a.m[r][3] = offset[r];
+        return a;
+    }
+
+    static affine scaling(const vec3& factors) {
+        affine a;
+        for (int r = 0; r < 3; r++)
+            a.m[r][r] = factors[r];
+        return a;
+    }
+
+    static affine rotation(const vec3& axis, double degrees) {
+        // Counterclockwise rotation around `axis` when looking down it (Rodrigues' formula).
+        auto k = unit_vector(axis);
+        auto radians = degrees_to_radians(degrees);
+        auto c = std::cos(radians), s = std::sin(radians), t = 1 - c;
+
+        affine a;
+        a.m[0][0] = t*k.x()*k.x() + c;        a.m[0][1] = t*k.x()*k.y() - s*k.z();  a.m[0][2] = t*k.x()*k.z() + s*k.y();
+        a.m[1][0] = t*k.x()*k.y() + s*k.z();  a.m[1][1] = t*k.y()*k.y() + c;        a.m[1][2] = t*k.y()*k.z() - s*k.x();
+        a.m[2][0] = t*k.x()*k.z() - s*k.y();  a.m[2][1] = t*k.y()*k.z() + s*k.x();  a.m[2][2] = t*k.z()*k.z() + c;
+        return a;
+    }
+
+    affine operator*(const affine& b) const {
+        // The map that applies b first, then this one.
+        affine a;
+        for (int r = 0; r < 3; r++) {
+            for (int c = 0; c < 4; c++) {
+                a.m[r][c] = m[r][0]*b.m[0][c] + m[r][1]*b.m[1][c] + m[r][2]*b.m[2][c];
+            }
+            a.m[r][3] += m[r][3];
+        }
+        return a;
+    }
+
+    affine inverse() const {
+        // Inverts M by its adjugate and maps the translation back with it. A singular M (a
+        // scale of zero) has no inverse; it returns the identity.
+        auto det = m[0][0]*(m[1][1]*m[2][2] - m[1][2]*m[2][1])
+                 - m[0][1]*(m[1][0]*m[2][2] - m[1][2]*m[2][0])
+                 + m[0][2]*(m[1][0]*m[2][1] - m[1][1]*m[2][0]);
+        if (std::fabs(det) < 1e-300)
+            return affine();
+
+        auto inv_det = 1 / det;
+        affine a;
+        a.m[0][0] =  (m[1][1]*m[2][2] - m[1][2]*m[2][1]) * inv_det;
+        a.m[0][1] = -(m[0][1]*m[2][2] - m[0][2]*m[2][1]) * inv_det;
+        a.m[0][2] =  (m[0][1]*m[1][2] - m[0][2]*m[1][1]) * inv_det;
+        a.m[1][0] = -(m[1][0]*m[2][2] - m[1][2]*m[2][0]) * inv_det;
+        a.m[1][1] =  (m[0][0]*m[2][2] - m[0][2]*m[2][0]) * inv_det;
+        a.m[1][2] = -(m[0][0]*m[1][2] - m[0][2]*m[1][0]) * inv_det;
+        a.m[2][0] =  (m[1][0]*m[2][1] - m[1][1]*m[2][0]) * inv_det;
+        a.m[2][1] = -(m[0][0]*m[2][1] - m[0][1]*m[2][0]) * inv_det;
+        a.m[2][2] =  (m[0][0]*m[1][1] - m[0][1]*m[1][0]) * inv_det;
+
+        for (int r = 0; r < 3; r++)
+            a.m[r][3] = -(a.m[r][0]*m[0][3] + a.m[r][1]*m[1][3] + a.m[r][2]*m[2][3]);
+        return a;
+    }
+
+    bool is_rigid() const {
+        // Whether M is a rotation (or reflection): its columns are orthonormal, so it maps
+        // lengths and angles unchanged.
+        for (int a = 0; a < 3; a++) {
+            for (int b = a; b < 3; b++) {
+                auto d = m[0][a]*m[0][b] + m[1][a]*m[1][b] + m[2][a]*m[2][b];
+                if (std::fabs(d - (a == b ? 1 : 0)) > 1e-9)
+                    return false;
+            }
+        }
+        return true;
+    }
+
+    point3 point(const point3& p) const {
+        return point3(m[0][0]*p.x() + m[0][1]*p.y() + m[0][2]*p.z() + m[0][3],
+                      m[1][0]*p.x() + m[1][1]*p.y() + m[1][2]*p.z() + m[1][3],
+                      m[2][0]*p.x() + m[2][1]*p.y() + m[2][2]*p.z() + m[2][3]);
+    }
+
+    vec3 vector(const vec3& v) const {
+        return vec3(m[0][0]*v.x() + m[0][1]*v.y() + m[0][2]*v.z(),
+                    m[1][0]*v.x() + m[1][1]*v.y() + m[1][2]*v.z(),
+                    m[2][0]*v.x() + m[2][1]*v.y() + m[2][2]*v.z());
+    }
+
+    vec3 transposed_vector(const vec3& v) const {
+        // Multiplies by the transpose of M. Called on the inverse map, this transforms normals.
+        return vec3(m[0][0]*v.x() + m[1][0]*v.y() + m[2][0]*v.z(),
+                    m[0][1]*v.x() + m[1][1]*v.y() + m[2][1]*v.z(),
+                    m[0][2]*v.x() + m[1][2]*v.y() + m[2][2]*v.z());
+    }
+
+    aabb bounds(const aabb& box) const {
+        // The tightest box around the transformed box (Arvo, "Transforming Axis-Aligned
+        // Bounding Boxes", Graphics Gems, 1990): per output axis, each input axis adds
+        // whichever of its ends gives the smaller and the larger result.
+        interval axes[3];
+        for (int r = 0; r < 3; r++) {
+            double low = m[r][3], high = m[r][3];
+            for (int c = 0; c < 3; c++) {
+                auto a = m[r][c] * box.axis_interval(c).min;
+                auto b = m[r][c] * box.axis_interval(c).max;
+                low  += std::fmin(a, b);
+                high += std::fmax(a, b);
+            }
+            axes[r] = interval(low, high);
+        }
+        return aabb(axes[0], axes[1], axes[2]);
+    }
+};
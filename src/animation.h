@@ -0,0 +1,116 @@
+#pragma once
+
+#include "rtweekend.h"
+
+#include <algorithm>
+#include <cctype>
+#include <functional>
+#include <string>
+#include <utility>
+#include <vector>
+
+template <typename T>
+class keyframes {
+  public:
+    // A value that changes over time: set at a few key times, linearly interpolated in between,
+    // and held at the first and last key outside of them.
+
+    void add(double time, const T& value) {
+        auto at = std::upper_bound(keys.begin(), keys.end(), time,
+                                   [](double t, const std::pair<double, T>& key) { return t < key.first; });
+        keys.insert(at, std::make_pair(time, value));
+    }
+
+    bool empty() const { return keys.empty(); }
+
+    T at(double time) const {
+        if (time <= keys.front().first) return keys.front().second;
+        if (time >= keys.back().first)  return keys.back().second;
+
+        auto next = std::upper_bound(keys.begin(), keys.end(), time,
+                                     [](double t, const std::pair<double, T>& key) { return t < key.first; });
+        auto prev = next - 1;
+        auto s = (time - prev->first) / (next->first - prev->first);
+        return (1 - s) * prev->second + s * next->second;
+    }
+
+  private:
+    std::vector<std::pair<double, T>> keys;
+};
+
+class animation {
+  public:
+    // What changes over an animated sequence. The camera's lookfrom and lookat have their own
+    // tracks; everything else is a track that moves an object of the scene through one of its
+    // setters (sphere::set_center, quad::set_frame, translate::set_offset, rotate_y::set_angle,
+    // transform::set_transform).
+    // camera::render() renders frames > 1 frames of it, refitting the scene in between.
+
+    int    frames = 0;                                 // Frames to render (0 or 1 renders a still)
+    double frame_rate = 24;                            // Frames per second; key times are seconds
+    std::string output_pattern = "frame_%04d.png";     // Frame file names: %d or %0Nd is the frame
+                                                       // number, %% a percent sign
+
+    keyframes<point3> lookfrom;  // Camera position over time (empty = the camera's own)
+    keyframes<point3> lookat;    // Camera target over time (empty = the camera's own)
+
+    template <typename T, typename Setter>
+    void animate(const keyframes<T>& keys, Setter set) {
+        // Adds a track that passes the value of `keys` at each frame's time to set().
+        tracks.push_back([keys, set](double time) { set(keys.at(time)); });
+    }
+
+    bool animated() const {
+        // Whether anything is keyframed, whether or not frames are rendered.
+        return !tracks.empty() || !lookfrom.empty() || !lookat.empty();
+    }
+
+    void apply(double time) const {
+        // Moves every animated object to where it is at `time`.
+        for (const auto& track : tracks)
+            track(time);
+    }
+
+    double frame_time(int frame) const { return frame / frame_rate; }
+
+    std::string frame_filename(int frame) const {
+        std::string name;
+        format_frame(output_pattern, frame, name);
+        return name;
+    }
+
+    static bool format_frame(const std::string& pattern, int frame, std::string& name) {
+        // Puts the frame number into the pattern's single %d or %0Nd (N zero padded digits),
+        // turning %% into %. Returns false if the pattern has any other % sequence, or not
+        // exactly one frame number, since every frame needs a file of its own.
+        name.clear();
+        int numbers = 0;
+        for (size_t k = 0; k < pattern.size(); k++) {
+            if (pattern[k] != '%') {
+                name += pattern[k];
+                continue;
+            }
+            if (++k < pattern.size() && pattern[k] == '%') {
+                name += '%';
+                continue;
+            }
+
+            int padding = 0;
+            if (k < pattern.size() && pattern[k] == '0')
+                while (++k < pattern.size() && std::isdigit((unsigned char)pattern[k]))
+                    padding = std::min(10 * padding + (pattern[k] - '0'), 64);
+            if (k >= pattern.size() || pattern[k] != 'd')
+                return false;
+
+            auto number = std::to_string(frame);
+            if (int(number.size()) < padding)
+                number.insert(0, padding - number.size(), '0');
+            name += number;
+            numbers++;
+        }
+        return numbers == 1;
+    }
+
+  private:
+    std::vector<std::function<void(double)>> tracks;
+};
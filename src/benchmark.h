@@ -0,0 +1,138 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "render_stats.h"
+
+inline double json_number(const std::string& text, const std::string& key, double fallback = 0) {
+    // The number after the first "key": in `text`. Enough for the flat JSON files the renderer
+    // and the benchmarks write; not a JSON parser.
+    auto at = text.find("\"" + key + "\":");
+    if (at == std::string::npos)
+        return fallback;
+    return std::strtod(text.c_str() + at + key.size() + 3, nullptr);
+}
+
+inline int run_command(std::string command) {
+    // std::system, adding the pair of quotes that cmd.exe strips from a command starting with one.
+#ifdef _WIN32
+    command = "\"" + command + "\"";
+#endif
+    return std::system(command.c_str());
+}
+
+struct bench_result {
+    std::string name;
+    uint64_t ops = 0;        // Operations per repetition
+    double mean   = 0;       // Nanoseconds per operation, mean over the repetitions
+    double stddev = 0;       // Standard deviation of the repetitions' ns per operation
+    double best   = 0;       // Fastest repetition, ns per operation
+    bool   per_ray = false;  // Whether an operation is one ray, so rays/s means something
+};
+
+class bench_runner {
+  public:
+    // Runs microbenchmarks the same way every time: each kernel is first sized so that one
+    // repetition takes about target_seconds, then run `warmup` times untimed (caches, branch
+    // predictors, CPU clocks) and `repetitions` times timed. The spread of the repetitions
+    // tells whether a difference between two runs is real.
+
+    int    warmup = 3;
+    int    repetitions = 15;
+    double target_seconds = 0.02;
+    std::string filter;   // Only run kernels whose name contains this
+    std::vector<bench_result> results;
+
+    template <typename Kernel>
+    void run(const std::string& name, bool per_ray, Kernel kernel) {
+        // kernel(n) performs n operations and returns a number that depends on their results,
+        // so the compiler can't drop the work.
+        if (!filter.empty() && name.find(filter) == std::string::npos)
+            return;
+
+        uint64_t n = 1;
+        for (;;) {
+            double seconds = time(kernel, n);
+            if (seconds >= target_seconds / 8 || n >= (uint64_t(1) << 32)) {
+                n = std::max<uint64_t>(1, uint64_t(n * target_seconds / std::max(seconds, 1e-9)));
+                break;
+            }
+            n *= 8;
+        }
+
+        for (int w = 0; w < warmup; w++)
+            time(kernel, n);
+
+        std::vector<double> ns(repetitions);
+        for (auto& sample : ns)
+            sample = time(kernel, n) * 1e9 / n;
+
+        bench_result result;
+        result.name = name;
+        result.ops = n;
+        result.per_ray = per_ray;
+        for (auto sample : ns) result.mean += sample;
+        result.mean /= repetitions;
+        for (auto sample : ns) result.stddev += (sample - result.mean) * (sample - result.mean);
+        result.stddev = std::sqrt(result.stddev / std::max(1, repetitions - 1));
+        result.best = *std::min_element(ns.begin(), ns.end());
+
+        print(result);
+        results.push_back(result);
+    }
+
+    static void print_header() {
+        std::printf("%-32s %12s %8s %12s %12s\n", "kernel", "ns/op", "+-%", "best ns/op", "Mrays/s");
+    }
+
+    static void print(const bench_result& r) {
+        std::printf("%-32s %12.2f %7.1f%% %12.2f ", r.name.c_str(), r.mean,
+                    r.mean > 0 ? 100 * r.stddev / r.mean : 0, r.best);
+        if (r.per_ray)
+            std::printf("%12.2f\n", 1e3 / r.mean);
+        else
+            std::printf("%12s\n", "-");
+        std::fflush(stdout);
+    }
+
+    bool write_json(const std::string& filename) const {
+        std::ofstream out(filename);
+        out << "{\n  \"warmup\": " << warmup << ",\n  \"repetitions\": " << repetitions
+            << ",\n  \"kernels\": [";
+        for (size_t i = 0; i < results.size(); i++) {
+            const auto& r = results[i];
+            out << (i ? ",\n" : "\n") << "    { \"name\": " << json_string(r.name)
+                << ", \"ops\": " << r.ops << ", \"ns_per_op\": " << r.mean
+                << ", \"stddev\": " << r.stddev << ", \"best\": " << r.best;
+            if (r.per_ray)
+                out << ", \"rays_per_second\": " << 1e9 / r.mean;
+            out << " }";
+        }
+        out << "\n  ]\n}\n";
+
+        if (!out) {
+            std::cerr << "ERROR: Could not write '" << filename << "'.\n";
+            return false;
+        }
+        return true;
+    }
+
+  private:
+    inline static volatile double sink = 0;
+
+    template <typename Kernel>
+    static double time(Kernel& kernel, uint64_t n) {
+        auto start = std::chrono::steady_clock::now();
+        sink = sink + double(kernel(n));
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+};
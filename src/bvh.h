@@ -5,6 +5,8 @@
 #include "hittable_list.h"
 
 #include <algorithm>
+#include <cmath>
+#include <thread>
 
 class bvh_node : public hittable {
   public:
@@ -13,9 +15,25 @@ class bvh_node : public hittable {
         // implicit copy of the hittable list, which we will modify. The lifetime of the copied
         // list only extends until this constructor exits. That's OK, because we only need to
         // persist the resulting bounding volume hierarchy.
+        // The root also keeps the primitives themselves, so update() can rebuild the tree.
+        primitives = list.objects;
+        built_cost = sah_cost();
     }
 
-    bvh_node(std::vector<std::shared_ptr<hittable>>& objects, size_t start, size_t end) {
+    bvh_node(std::shared_ptr<hittable> left, std::shared_ptr<hittable> right, const aabb& bbox,
+             int depth, size_t primitive_count, double built_cost,
+             std::vector<std::shared_ptr<hittable>> primitives = {})
+      : left(left), right(right), bbox(bbox), depth(depth), primitive_count(primitive_count),
+        built_cost(built_cost), primitives(primitives)
+    {
+        // A node exactly as it was built before, as read back from a scene cache. Nothing is
+        // sorted or measured again. Only a root passes its primitives (see update()).
+    }
+
+    bvh_node(std::vector<std::shared_ptr<hittable>>& objects, size_t start, size_t end,
+             int depth = 0)
+      : depth(depth), primitive_count(end - start)
+    {
         // Build the bounding box of the span of source objects.
         bbox = aabb::empty;
         for (size_t object_index=start; object_index < end; object_index++)
@@ -38,12 +56,13 @@ class bvh_node : public hittable {
             std::sort(std::begin(objects) + start, std::begin(objects) + end, comparator);
 
             auto mid = start + object_span/2;
-            left = std::make_shared<bvh_node>(objects, start, mid);
-            right = std::make_shared<bvh_node>(objects, mid, end);
+            left = std::make_shared<bvh_node>(objects, start, mid, depth + 1);
+            right = std::make_shared<bvh_node>(objects, mid, end, depth + 1);
         }
     }
 
     bool hit(const ray& r, interval ray_t, hit_record& rec, const vec3& camPos) const override {
+        RTW_COUNT(counter::bvh_nodes);
         if (!bbox.hit(r, ray_t))
             return false;
 
@@ -53,12 +72,122 @@ class bvh_node : public hittable {
         return hit_left || hit_right;
     }
 
+    bool occluded(const ray& r, interval ray_t) const override {
+        RTW_COUNT(counter::bvh_nodes);
+        if (!bbox.hit(r, ray_t))
+            return false;
+
+        // A single object leaf holds the same object on both sides.
+        return left->occluded(r, ray_t) || (right != left && right->occluded(r, ray_t));
+    }
+
     aabb bounding_box() const override { return bbox; }
 
+    bool update(double rebuild_threshold = 1.5) {
+        // Brings the tree up to date after primitives have moved (sphere::set_center,
+        // quad::set_frame, translate::set_offset, ...). The bounds are refit in one linear pass
+        // that keeps the topology. Refitting loosens the tree as objects drift away from the
+        // neighbours they were grouped with, so if that leaves its SAH cost more than
+        // rebuild_threshold times the cost right after the last build, the tree is rebuilt
+        // from scratch. Returns true if it was rebuilt. Only the root holds the primitives a
+        // rebuild needs; on other nodes this just refits. refit() calls this on the root, so
+        // animated scenes get it from world.refit().
+        refit_bounds();
+        if (primitives.empty() || sah_cost() <= rebuild_threshold * built_cost)
+            return false;
+
+        RTW_COUNT(counter::bvh_rebuilds);
+        trace_span span("bvh rebuild", "scene");
+        auto objects = primitives;
+        bvh_node rebuilt(objects, 0, objects.size(), depth);
+        left  = rebuilt.left;
+        right = rebuilt.right;
+        bbox  = rebuilt.bbox;
+        built_cost = sah_cost();
+        return true;
+    }
+
+    void refit() override {
+        // The root checks whether the refit tree needs a rebuild, see update().
+        if (primitives.empty())
+            refit_bounds();
+        else
+            update();
+    }
+
+    double sah_cost() const {
+        // Surface area heuristic: the expected number of box and primitive tests for a ray
+        // that passes through this node's box. A child is entered with probability equal to
+        // its share of this box's surface area, and each primitive costs one test.
+        auto area = bbox.surface_area();
+        if (area <= 0)
+            return 1;
+
+        double cost = 1 + left->bounding_box().surface_area() / area * child_cost(left);
+        if (right != left)
+            cost += right->bounding_box().surface_area() / area * child_cost(right);
+        return cost;
+    }
+
+    void collect_lights(std::vector<std::shared_ptr<hittable>>& lights) const override {
+        // A single object leaf holds the same object on both sides.
+        collect_child_lights(left, lights);
+        if (right != left)
+            collect_child_lights(right, lights);
+    }
+
+    std::shared_ptr<hittable> get_left() const { return left; }
+    std::shared_ptr<hittable> get_right() const { return right; }
+    int get_depth() const { return depth; }
+    size_t get_primitive_count() const { return primitive_count; }
+    double get_built_cost() const { return built_cost; }
+    const std::vector<std::shared_ptr<hittable>>& get_primitives() const { return primitives; }
+
   private:
     std::shared_ptr<hittable> left;
     std::shared_ptr<hittable> right;
     aabb bbox;
+    int    depth = 0;               // Distance from the root
+    size_t primitive_count = 0;     // Primitives below this node
+    double built_cost = 0;          // SAH cost after the last build (root only)
+    std::vector<std::shared_ptr<hittable>> primitives;  // Everything in the tree (root only)
+
+    void refit_bounds() {
+        // Children first, then this box. The top levels of large trees refit their two halves
+        // on separate threads. A primitive shared between subtrees would be refit from both.
+        if (right == left) {
+            left->refit();
+        } else if (depth < parallel_depth() && primitive_count >= 2048) {
+            std::thread worker([this] { left->refit(); });
+            right->refit();
+            worker.join();
+        } else {
+            left->refit();
+            right->refit();
+        }
+
+        bbox = aabb(left->bounding_box(), right->bounding_box());
+    }
+
+    static int parallel_depth() {
+        // Levels whose subtrees are refit concurrently, enough for one subtree per thread.
+        static const int levels = int(std::ceil(std::log2(std::max(1u, std::thread::hardware_concurrency()))));
+        return levels;
+    }
+
+    static double child_cost(const std::shared_ptr<hittable>& child) {
+        auto node = dynamic_cast<const bvh_node*>(child.get());
+        return node ? node->sah_cost() : 1;
+    }
+
+    static void collect_child_lights(
+        const std::shared_ptr<hittable>& child, std::vector<std::shared_ptr<hittable>>& lights
+    ) {
+        if (child->is_emissive())
+            lights.push_back(child);
+        else
+            child->collect_lights(lights);
+    }
 
     static bool box_compare(
         const std::shared_ptr<hittable> a, const std::shared_ptr<hittable> b, int axis_index
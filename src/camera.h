@@ -1,7 +1,25 @@
 #pragma once
 
+#include "animation.h"
+#include "cost_map.h"
+#include "denoiser.h"
+#include "distributed.h"
+#include "framebuffer.h"
 #include "hittable.h"
+#include "hittable_list.h"
+#include "image_writer.h"
 #include "material.h"
+#include "memory_usage.h"
+#include "sampler.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <thread>
 
 #ifdef _MSC_VER
     #define STBI_MSC_SECURE_CRT //use only for visual studio
@@ -14,6 +32,11 @@
 #include "../ThirdParty/stb/stb_image_write.h"
 
 
+// What camera::render(world, mode) produces in output_file: the image, the image with outlines
+// drawn over it (the outlines also go next to it as *_outlines.png), or only the normal buffer
+// or the outlines.
+enum class render_mode { image, image_outlines, normals, outlines };
+
 class camera {
   public:
     /* Public Camera Parameters Here */
@@ -34,62 +57,558 @@ class camera {
     double defocus_angle = 0;  // Variation angle of rays through each pixel
     double focus_dist = 10;    // Distance from camera lookfrom point to plane of perfect focus
 
+    bool   sample_lights = true;  // Sample emissive primitives directly at diffuse hits (next event estimation)
+
+    std::string output_file = "image.png";  // Where render() writes the image
+    int    threads = 0;           // Threads rendering each pass (0 = one per hardware thread)
+    bool   denoise = false;       // Denoise the output image; the raw render goes next to it as *_noisy.png
+    cost_metric cost = cost_metric::none;  // Also write a per-pixel cost map as *_cost.png and *_cost.pfm
+
+    sampler_type sampling = sampler_type::sobol;  // Where the random numbers of each camera sample come from
+    int    convergence_spp = 0;   // Plot error against samples per pixel for every sampler up to this count
+                                  // instead of rendering (0 = off), see render_convergence()
+
+    // Progressive rendering. With pass_samples set, render() adds whole-image passes of that
+    // many samples per pixel and stops at whichever budget runs out first.
+    int    pass_samples   = 0;    // Samples per pixel in each progressive pass (0 renders in one pass)
+    int    sample_budget  = 0;    // Total samples per pixel to stop at (0 uses samples_per_pixel)
+    double time_budget    = 0;    // Wall-clock seconds; no pass is started that would overrun it (0 = none)
+    double target_error   = 0;    // Stop once film.relative_error() falls below this (0 = none)
+    double flush_interval = 10;   // Seconds between writes of the in-progress image.png
+
+    // Checkpointing of progressive renders. Checkpoints are written between passes, and also
+    // when the time budget stops a render early, so `resume` can pick it up later.
+    std::string checkpoint_file;       // Where to write checkpoints ("" = no checkpoints)
+    double checkpoint_interval = 60;   // Seconds between checkpoints
+    bool   resume = false;             // Continue from checkpoint_file instead of starting over
+
+    // Distributed rendering, see distributed.h. A coordinator leases tiles to workers and writes
+    // the merged image; workers build the same scene and render only what they are leased.
+    int         coordinator_port = 0;  // Coordinate a distributed render on this port (0 = off)
+    std::string coordinator_address;   // "host:port" of the coordinator to work for ("" = off)
+    int         tile_size = 32;        // Edge length of leased tiles in pixels
+    uint64_t    seed = 0x5eed;         // Seed of the per-tile random sequences
+
     const int CHANNEL_NUM = 3;
 
     /*** NOTICE!! You have to use uint8_t array to pass in stb function  ***/
         // Because the size of color is normally 255, 8bit.
         // If you don't use this one, you will get a weird image.
-    uint8_t* normal_buffer; 
-    uint8_t* pixels;
-    uint8_t* outline_buffer;
+    uint8_t* normal_buffer = nullptr;
+    uint8_t* outline_buffer = nullptr;
+
+    framebuffer film;  // Linear HDR accumulation of every sample rendered so far
+    animation   anim;  // Keyframes; with anim.frames > 1, render() renders an image sequence
+    render_stats stats;  // Counters and phase times of everything rendered so far, see write_stats()
+    cost_map    costs; // Per-pixel cost of the current frame, when `cost` is set
+    image_writer writer;  // Writes images in the background; set its PNG compression and files in flight
 
     ~camera(){
-        delete[] pixels;
+        finish_writes();
         delete[] normal_buffer;
         delete[] outline_buffer;
     }
 
-    void render(const hittable& world, bool enableOutlines = false) {
+    void render(hittable& world, bool enableOutlines = false) {
+        // Renders the scene to output_file, or the animation to anim's frame files. The world
+        // isn't const because animated objects move and the scene is refit between frames.
+        if (anim.frames > 1)
+            render_animation(world, enableOutlines);
+        else
+            render_frame(world, enableOutlines);
+    }
+
+    void render(hittable& world, render_mode mode) {
+        // Renders the scene the way its scene file asks for, see scene_file.h.
+        switch (mode) {
+            case render_mode::image_outlines: render(world, true);          break;
+            case render_mode::normals:        render_buffer(world);         break;
+            case render_mode::outlines:       render_outline_buffer(world); break;
+            default:                          render(world, false);         break;
+        }
+    }
+
+    void render_animation(hittable& world, bool enableOutlines = false) {
+        // Renders every frame of `anim`. The scene, its acceleration structures and its
+        // textures are built once; per frame the tracks move the camera and the animated
+        // objects, and one refit brings the bounding volumes up to date (bvh_node roots
+        // rebuild themselves if the refit degraded them too much, see bvh_node::update; the
+        // frame's log line says so). Images are encoded on background threads, so writing
+        // frame N overlaps the update and render of frame N+1.
+        point3 base_lookfrom = lookfrom;
+        point3 base_lookat   = lookat;
+        std::string base_output = output_file;
+        auto start = std::chrono::steady_clock::now();
+
+        for (int frame = 0; frame < anim.frames; frame++) {
+            double time = anim.frame_time(frame);
+            lookfrom = anim.lookfrom.empty() ? base_lookfrom : anim.lookfrom.at(time);
+            lookat   = anim.lookat.empty()   ? base_lookat   : anim.lookat.at(time);
+
+            auto update_start = std::chrono::steady_clock::now();
+            auto counted_before = thread_counters();
+            {
+                trace_span span("scene update", "scene", "frame", frame);
+                anim.apply(time);
+                world.refit();
+            }
+            double update_time = seconds_since(update_start);
+            stats.seconds[int(phase::update)] += update_time;
+            auto rebuilds = (thread_counters() - counted_before)[counter::bvh_rebuilds];
+            stats.counters[counter::bvh_rebuilds] += rebuilds;
+
+            output_file = anim.frame_filename(frame);
+            std::clog << "Frame " << frame + 1 << "/" << anim.frames << " -> " << output_file
+                      << " (scene update " << update_time << "s"
+                      << (rebuilds > 0 ? ", BVH rebuilt" : "") << ")\n";
+            render_frame(world, enableOutlines);
+        }
+
+        finish_writes();
+        lookfrom = base_lookfrom;
+        lookat   = base_lookat;
+        output_file = base_output;
+        std::clog << "Animation done: " << anim.frames << " frames in " << seconds_since(start) << "s\n";
+    }
+
+    void render_frame(const hittable& world, bool enableOutlines = false) {
+        // Renders one image of the scene as it is now and writes it to output_file.
         initialize();
         
-        pixels = new uint8_t[width * height * CHANNEL_NUM];
+        film.resize(width, height);
+        costs.metric = cost;
+        if (cost != cost_metric::none)
+            costs.resize(width, height);
 
         //render
-        int index = 0;
+        auto counted_before = stats.counters;
+        find_lights(world);
+
+        int budget   = sample_budget > 0 ? sample_budget : samples_per_pixel;
+
+        if (convergence_spp > 0) {
+            render_convergence(world, convergence_spp, 16 * convergence_spp);
+            return;
+        }
+
+        //a worker only renders the tiles the coordinator leases to it
+        if (!coordinator_address.empty()) {
+            render_as_worker(world);
+            return;
+        }
+
+        //outlines are drawn over every flushed image, so they are rendered up front
+        if(enableOutlines)
+            render_outline_buffer(world, true);
+        outlines = enableOutlines;
+
+        if (coordinator_port > 0) {
+            tile_coordinator coordinator;
+            coordinator.port      = coordinator_port;
+            coordinator.tile_size = tile_size;
+            if (coordinator.run(film, budget))
+                write_final_image(world);
+            return;
+        }
+
+        //the sampler is set up for the whole budget, so the passes together form one well
+        //distributed set of samples per pixel
+        auto pixel_sampler = make_sampler(sampling, width, height, budget, seed);
+        thread_sampler() = pixel_sampler.get();
+
+        int per_pass = pass_samples > 0 ? std::min(pass_samples, budget) : budget;
+        bool progressive = per_pass < budget;
+
+        auto start      = std::chrono::steady_clock::now();
+        auto last_flush = start;
+        auto last_checkpoint = start;
+        double last_pass_time = 0;
+        int done = 0;
+
+        if (resume && !checkpoint_file.empty()) {
+            done = read_checkpoint(checkpoint_file);
+            if (done > 0)
+                std::clog << "Resuming at " << done << " spp\n";
+        }
+        int first = done;
  
         std::cout << "rendering image\n";
-        for (int j = 0; j < height; j++) {
-            std::clog << "\rScanlines remaining: " << (height - j) << ' ' << std::flush;
-            for (int i = 0; i < width; i++) {
-                color pixel_color(0,0,0);
-                for (int sample = 0; sample < samples_per_pixel; sample++) {
-                    ray r = get_ray(i, j);
-                    pixel_color += ray_color(r, max_depth, world);
-                }
+        while (done < budget) {
+            if (progressive && time_budget > 0 && seconds_since(start) + last_pass_time > time_budget) {
+                std::clog << "Stopping: the next pass would exceed the time budget\n";
+                if (!checkpoint_file.empty())
+                    write_checkpoint(checkpoint_file, done);
+                break;
+            }
+
+            auto pass_start = std::chrono::steady_clock::now();
+            int n = std::min(per_pass, budget - done);
+            render_pass(world, done, n, progressive);
+            done += n;
+            last_pass_time = seconds_since(pass_start);
+
+            if (!progressive)
+                break;
+
+            double error = film.relative_error();
+            std::clog << "\rPass done: " << done << " spp, " << seconds_since(start) << "s, error "
+                      << error << "          \n";
+
+            // a few passes are needed before rare paths (small lights) show up in the variance
+            if (target_error > 0 && done >= 4 * per_pass && error < target_error) {
+                std::clog << "Stopping: reached the convergence target\n";
+                break;
+            }
+
+            if (flush_interval > 0 && seconds_since(last_flush) >= flush_interval && done < budget) {
+                write_image(output_file);
+                last_flush = std::chrono::steady_clock::now();
+            }
 
-                write_color(pixels, index, pixel_samples_scale * pixel_color);
+            if (!checkpoint_file.empty() && seconds_since(last_checkpoint) >= checkpoint_interval
+                && done < budget) {
+                write_checkpoint(checkpoint_file, done);
+                last_checkpoint = std::chrono::steady_clock::now();
             }
         }
     
+        thread_sampler() = nullptr;
+
         std::clog << "\rImage done...                                             \n";
+        std::clog << "Traversals per sample: "
+                  << double((stats.counters - counted_before).rays())
+                     / (double(width) * height * std::max(done - first, 1)) << '\n';
 
-        if(enableOutlines){
-            render_outline_buffer(world, true);
-            for(int i = 0; i < (width * height * CHANNEL_NUM); i++){
-                if(outline_buffer[i] > 0){
-                    pixels[i] = 0;
+        write_final_image(world);
+    }
+
+    void render_tile(const hittable& world, const image_tile& tile, int samples, framebuffer& out) {
+        // Renders `samples` samples per pixel of one tile into `out`, which is resized to the
+        // tile. The random sequence is seeded from the tile id, so a tile comes out the same no
+        // matter which process renders it or how often it is re-leased.
+        trace_span span("tile", "render", "tile", tile.id);
+        out.resize(tile.width(), tile.height());
+        thread_rng().reseed(seed, tile.id);
+        auto pixel_sampler = make_sampler(sampling, width, height, samples, seed);
+        thread_sampler() = pixel_sampler.get();
+
+        for (int j = tile.y0; j < tile.y1; j++) {
+            for (int i = tile.x0; i < tile.x1; i++) {
+                color pixel_color;
+                double luminance_sq;
+                sample_pixel(world, i, j, 0, samples, pixel_color, luminance_sq);
+                out.add(i - tile.x0, j - tile.y0, pixel_color, luminance_sq, samples);
+            }
+        }
+
+        thread_sampler() = nullptr;
+    }
+
+    void render_convergence(const hittable& world, int max_spp, int reference_spp) {
+        // Measures how fast each sampler converges on this scene. A reference is rendered at
+        // reference_spp with the Sobol sampler, then every sampler renders the image from scratch
+        // at 1, 2, 4, ... max_spp samples per pixel, and the RMSE of each render against the
+        // reference (in linear radiance) is written to convergence.csv and plotted, log-log, in
+        // convergence.svg.
+        initialize();
+        find_lights(world);
+
+        std::cout << "rendering convergence reference at " << reference_spp << " spp\n";
+        render_with(world, sampler_type::sobol, reference_spp);
+        std::vector<float> reference = pixel_means();
+
+        const sampler_type types[] = { sampler_type::independent, sampler_type::stratified,
+                                       sampler_type::sobol, sampler_type::blue_noise };
+        std::vector<int> counts;
+        for (int spp = 1; spp <= max_spp; spp *= 2)
+            counts.push_back(spp);
+
+        std::vector<std::vector<double>> errors(4);
+        for (int t = 0; t < 4; t++) {
+            for (int spp : counts) {
+                render_with(world, types[t], spp);
+                std::vector<float> image = pixel_means();
+
+                double sum = 0;
+                for (size_t k = 0; k < image.size(); k++)
+                    sum += (image[k] - reference[k]) * (image[k] - reference[k]);
+                errors[t].push_back(std::sqrt(sum / image.size()));
+
+                std::clog << sampler_name(types[t]) << " " << spp << " spp: rmse "
+                          << errors[t].back() << '\n';
+            }
+        }
+
+        std::ofstream csv("convergence.csv");
+        csv << "spp";
+        for (auto type : types)
+            csv << ',' << sampler_name(type);
+        csv << '\n';
+        for (size_t k = 0; k < counts.size(); k++) {
+            csv << counts[k];
+            for (int t = 0; t < 4; t++)
+                csv << ',' << errors[t][k];
+            csv << '\n';
+        }
+
+        write_convergence_plot("convergence.svg", counts, errors, types);
+        std::clog << "Wrote convergence.csv and convergence.svg\n";
+    }
+
+    void write_checkpoint(const std::string& filename, int samples_done) const {
+        // Saves everything a resumed render needs to continue exactly where this one is: the
+        // accumulation buffer with its per-pixel sample counts and the samples per pixel done
+        // so far. No random generator state is needed: every pass reseeds each row from the
+        // seed and its first sample, so the resumed passes draw the same numbers anyway. The
+        // file is written next to the old one and then swapped in, so a kill mid-write never
+        // leaves a broken checkpoint behind.
+        auto temp = filename + ".tmp";
+        {
+            std::ofstream out(temp, std::ios::binary);
+
+            out.write(checkpoint_magic, 4);
+            out.write(reinterpret_cast<const char*>(&checkpoint_version), sizeof(checkpoint_version));
+            out.write(reinterpret_cast<const char*>(&samples_done), sizeof(samples_done));
+            film.write(out);
+
+            if (!out) {
+                std::cerr << "ERROR: Could not write checkpoint '" << temp << "'.\n";
+                return;
+            }
+        }
+
+        std::remove(filename.c_str());
+        std::rename(temp.c_str(), filename.c_str());
+        std::clog << "Checkpoint written at " << samples_done << " spp\n";
+    }
+
+    int read_checkpoint(const std::string& filename) {
+        // Restores a checkpoint written by write_checkpoint and returns the samples per pixel it
+        // holds. Returns 0 (and leaves an empty buffer) if there is no usable checkpoint. No
+        // checkpoint yet is the normal first run of a --resume command line; only a file that
+        // is there but can't be used (another version, another image size, cut short) is
+        // worth a warning.
+        std::ifstream in(filename, std::ios::binary);
+        if (!in.is_open()) {
+            std::clog << "No checkpoint '" << filename << "' yet, starting from the beginning\n";
+            return 0;
+        }
+
+        char magic[4] = {};
+        uint32_t version = 0;
+        int samples_done = 0;
+
+        in.read(magic, 4);
+        in.read(reinterpret_cast<char*>(&version), sizeof(version));
+        in.read(reinterpret_cast<char*>(&samples_done), sizeof(samples_done));
+
+        framebuffer restored;
+        if (!in || std::memcmp(magic, checkpoint_magic, 4) != 0 || version != checkpoint_version
+            || !restored.read(in) || restored.width != width || restored.height != height) {
+            std::cerr << "WARNING: Ignoring checkpoint '" << filename << "', starting from the beginning.\n";
+            return 0;
+        }
+
+        film = std::move(restored);
+        return samples_done;
+    }
+
+    void write_image(const std::string& filename) {
+        write_image(filename, film);
+    }
+
+    void write_image(const std::string& filename, const framebuffer& image) {
+        // Resolves an accumulation buffer into 8-bit pixels (or linear floats for a .pfm file),
+        // draws the outlines over it if this render has them, and hands the result to `writer`,
+        // which encodes it in the format of the file name on a background thread while the
+        // caller carries on. Safe to call between passes; finish_writes() waits for the files.
+        image_data data;
+        data.width    = width;
+        data.height   = height;
+        data.channels = CHANNEL_NUM;
+
+        if (format_of(filename) == image_format::pfm) {
+            data.channels = 3;
+            data.floats.resize(size_t(width) * height * 3);
+            image.resolve_linear(data.floats.data());
+            if(outlines){
+                for(int i = 0; i < (width * height * 3); i++){
+                    if(outline_buffer[i] > 0){
+                        data.floats[i] = 0;
+                    }
                 }
-            }    
+            }
+        } else {
+            // tonemapping and quantization run once over the whole accumulation buffer
+            data.bytes.resize(size_t(width) * height * CHANNEL_NUM);
+            image.resolve(data.bytes.data());
+
+            if(outlines){
+                for(int i = 0; i < (width * height * CHANNEL_NUM); i++){
+                    if(outline_buffer[i] > 0){
+                        data.bytes[i] = 0;
+                    }
+                }    
+            }
         }
 
-        // if CHANNEL_NUM is 4, you can use alpha channel in png
-        stbi_write_png("image.png", width, height, CHANNEL_NUM, pixels, width * CHANNEL_NUM); 
+        writer.stats = &stats;
+        writer.submit(filename, std::move(data));
+    }
+
+    void write_pixels(const std::string& filename, const uint8_t* pixels, int channels) {
+        // Hands a copy of width x height 8-bit pixels to `writer`. A PFM gets their first three
+        // channels scaled to 0..1.
+        image_data data;
+        data.width    = width;
+        data.height   = height;
+        data.channels = channels;
+        data.bytes.assign(pixels, pixels + size_t(width) * height * channels);
+        if (format_of(filename) == image_format::pfm) {
+            data.floats.resize(size_t(width) * height * 3);
+            for (size_t p = 0; p < size_t(width) * height; p++)
+                for (int c = 0; c < 3; c++)
+                    data.floats[3*p + c] = data.bytes[p * channels + std::min(c, channels - 1)] / 255.0f;
+        }
+        writer.stats = &stats;
+        writer.submit(filename, std::move(data));
+    }
 
-        delete[] pixels;
+    int render_threads() const {
+        // The number of threads render_pass uses.
+        return std::max(1, std::min(threads > 0 ? threads : int(std::thread::hardware_concurrency()), height));
+    }
+
+    void write_stats(const std::string& filename, const std::string& scene) {
+        // Writes `stats` and the settings of the render as a JSON object, once the last image is
+        // encoded, so renders can be compared across commits.
+        finish_writes();
+        std::ofstream out(filename);
+        out << "{\n"
+            << "  \"scene\": " << json_string(scene) << ",\n"
+            << "  \"output\": " << json_string(output_file) << ",\n"
+            << "  \"width\": " << width << ",\n"
+            << "  \"height\": " << height << ",\n"
+            << "  \"samples_per_pixel\": " << (sample_budget > 0 ? sample_budget : samples_per_pixel) << ",\n"
+            << "  \"max_depth\": " << max_depth << ",\n"
+            << "  \"sampler\": \"" << sampler_name(sampling) << "\",\n"
+            << "  \"threads\": " << render_threads() << ",\n"
+            << "  \"seed\": " << seed << ",\n"
+            << "  \"peak_rss_bytes\": " << peak_rss_bytes() << ",\n";
+        stats.write_json(out);
+        out << "\n}\n";
+
+        if (!out)
+            std::cerr << "ERROR: Could not write stats '" << filename << "'.\n";
+    }
+
+    void finish_writes() {
+        // Waits until every image handed to write_image is on disk.
+        writer.finish();
+    }
+
+    std::string output_beside(const std::string& suffix) const {
+        // output_file with `suffix` added to its stem, for the files written next to it.
+        auto dot = output_file.rfind('.');
+        if (dot == std::string::npos)
+            return output_file + suffix;
+        return output_file.substr(0, dot) + suffix + output_file.substr(dot);
+    }
+
+    void write_final_image(const hittable& world) {
+        // Writes the finished render to output_file, denoised if `denoise` is set, and the
+        // cost map next to it if there is one.
+        auto dot = output_file.rfind('.');
+        auto stem = dot == std::string::npos ? output_file : output_file.substr(0, dot);
+        auto extension = dot == std::string::npos ? std::string() : output_file.substr(dot);
+
+        if (costs.metric != cost_metric::none)
+            write_cost_map(stem + "_cost");
+
+        if (!denoise) {
+            write_image(output_file);
+            return;
+        }
+
+        write_image(stem + "_noisy" + extension);
+
+        std::clog << "Denoising\n";
+        auto start = std::chrono::steady_clock::now();
+        trace_span span("denoise", "output");
+        aov_buffer aovs;
+        render_aovs(world, aovs);
+
+        framebuffer denoised;
+        denoiser filter;
+        filter.threads = render_threads();
+        filter.run(film, aovs, denoised);
+        stats.seconds[int(phase::denoise)] += seconds_since(start);
+        std::clog << "Denoised in " << seconds_since(start) << "s\n";
+
+        write_image(output_file, denoised);
+    }
+
+    void write_cost_map(const std::string& stem) {
+        // Writes `costs` as stem.png in false color and stem.pfm with the raw values.
+        costs.report(tile_size);
+        write_pixels(stem + ".png", costs.colored().data(), 3);
+        costs.write_pfm(stem + ".pfm");
+    }
 
+    void render_aovs(const hittable& world, aov_buffer& aovs, int samples = 4) const {
+        // Fills the denoiser's auxiliary buffers from `samples` camera rays per pixel. Specular
+        // and emissive surfaces get albedo 1; unlit materials use their shaded color, which
+        // makes the denoiser leave them alone. Like render_pass, it reseeds the random
+        // generator for every row (on streams of their own), so the buffers don't depend on
+        // the number of threads.
+        aovs.resize(width, height);
+
+        parallel_rows(height, [&](int begin, int end) {
+            for (int j = begin; j < end; j++) {
+                thread_rng().reseed(seed, (uint64_t(1) << 62) + j);
+                for (int i = 0; i < width; i++) {
+                    color albedo(0,0,0);
+                    vec3 normal(0,0,0);
+                    double depth = 0;
+
+                    for (int sample = 0; sample < samples; sample++) {
+                        ray r = get_ray(i, j);
+                        hit_record rec;
+                        if (!world.hit(r, interval(0.001, infinity), rec, lookfrom)) {
+                            albedo += color(1,1,1);
+                            continue;
+                        }
+
+                        normal += rec.normal;
+                        depth  += rec.t * r.direction().length();
+
+                        color shaded;
+                        scatter_record srec;
+                        if (rec.mat->shade(r, rec, world, shaded))
+                            albedo += shaded;
+                        else if (rec.mat->scatter(r, rec, srec) && !srec.is_specular)
+                            albedo += srec.attenuation;
+                        else
+                            albedo += color(1,1,1);
+                    }
+
+                    auto p = size_t(j) * width + i;
+                    albedo /= samples;
+                    normal = normal.length_squared() > 0 ? unit_vector(normal) : normal;
+                    for (int c = 0; c < 3; c++) {
+                        aovs.albedo[3*p + c] = float(albedo[c]);
+                        aovs.normal[3*p + c] = float(normal[c]);
+                    }
+                    aovs.depth[p] = float(depth / samples);
+                }
+            }
+        }, render_threads());
     }
 
     void render_buffer(const hittable& world) {
+        timed_phase timing(stats, phase::outline);
+        trace_span span("normal pass", "render");
+        auto counted_before = thread_counters();
         initialize();
         /*** NOTICE!! You have to use uint8_t array to pass in stb function  ***/
         // Because the size of color is normally 255, 8bit.
@@ -99,12 +618,14 @@ class camera {
         //render
         int index = 0;
         
+        int samples = sample_budget > 0 ? sample_budget : samples_per_pixel;
+
         std::cout << "rendering normal_buffer\n";
         for (int j = 0; j < height; j++) {
             std::clog << "\rScanlines remaining: " << (height - j) << ' ' << std::flush;
             for (int i = 0; i < width; i++) {
                 color pixel_color(0,0,0);
-                for (int sample = 0; sample < samples_per_pixel; sample++) {
+                for (int sample = 0; sample < samples; sample++) {
                     ray r = get_ray(i, j);
                     pixel_color += ray_normal(r, max_depth, world);
                     //since the normals are going to have negatives, we'll just get the
@@ -113,22 +634,28 @@ class camera {
 
                 pixel_color = color(std::fabs(pixel_color.x()), std::fabs(pixel_color.y()), std::fabs(pixel_color.z()));
 
-                write_color(normal_buffer, index, pixel_samples_scale * pixel_color);
+                write_color(normal_buffer, index, pixel_color / samples);
             }
         }
     
         std::clog << "\rDone.                                                \n";
 
-        // if CHANNEL_NUM is 4, you can use alpha channel in png
-        stbi_write_png("normal_buffer.png", width, height, 3, normal_buffer, width * 3);
+        write_pixels(output_file, normal_buffer, 3);
+        stats.counters += thread_counters() - counted_before;
+        stats.pixel_samples += uint64_t(width) * height * samples;
 
         delete[] normal_buffer;
+        normal_buffer = nullptr;
 
     }
 
     void render_outline_buffer(const hittable& world, bool keepBuffer = false) {
+        timed_phase timing(stats, phase::outline);
+        trace_span span("outline pass", "render");
+        auto counted_before = thread_counters();
         initialize();
         
+        delete[] outline_buffer;
         outline_buffer = new uint8_t[width * height * CHANNEL_NUM];
 
         //render
@@ -200,11 +727,14 @@ class camera {
         std::clog << "\rDone...                                             \n";
 
         // if CHANNEL_NUM is 4, you can use alpha channel in png
-        stbi_write_png("outlines.png", width, height, CHANNEL_NUM, outline_buffer, width * CHANNEL_NUM);
+        write_pixels(keepBuffer ? output_beside("_outlines") : output_file, outline_buffer, CHANNEL_NUM);
+        stats.counters += thread_counters() - counted_before;
+        stats.pixel_samples += uint64_t(width) * height;
         
         if(keepBuffer) return;
         
         delete[] outline_buffer;
+        outline_buffer = nullptr;
     }
 
   private:
@@ -219,6 +749,182 @@ class camera {
     vec3   defocus_disk_u;       // Defocus disk horizontal radius
     vec3   defocus_disk_v;       // Defocus disk vertical radius
 
+    bool   outlines = false;           // Whether write_image draws outline_buffer over the image
+    hittable_list lights;              // Emissive primitives of the scene, for light sampling
+
+    static constexpr char     checkpoint_magic[4] = { 'R', 'T', 'C', 'K' };
+    static constexpr uint32_t checkpoint_version  = 2;
+
+    void render_pass(const hittable& world, int first_sample, int samples, bool progressive) {
+        // Adds samples first_sample .. first_sample + samples - 1 to every pixel of the
+        // accumulation buffer. Rows are handed out one at a time to the render threads, each
+        // drawing from its own copy of the active sampler. The random generator is reseeded
+        // for every row and pass, so the image doesn't depend on the number of threads.
+        // Every row is a span on its thread's lane of the trace.
+        timed_phase timing(stats, phase::render);
+        trace_span span("pass", "render", "first_sample", first_sample);
+        int count = render_threads();
+        std::atomic<int> next_row(0);
+        std::vector<render_counters> thread_counts(count);
+        sampler* active = thread_sampler();
+
+        auto render_rows = [&](int t) {
+            if (t > 0)
+                tracer().name_thread("render " + std::to_string(t));
+            auto own_sampler = active ? active->clone() : nullptr;
+            thread_sampler() = own_sampler.get();
+            auto counted_before = thread_counters();
+
+            for (int j = next_row++; j < height; j = next_row++) {
+                if (!progressive && t == 0)
+                    std::clog << "\rScanlines remaining: " << (height - j) << ' ' << std::flush;
+                thread_rng().reseed(seed, uint64_t(first_sample) * height + j);
+                trace_span row_span("row", "render", "row", j);
+                for (int i = 0; i < width; i++) {
+                    double cost_before = pixel_cost();
+                    color pixel_color;
+                    double luminance_sq;
+                    sample_pixel(world, i, j, first_sample, samples, pixel_color, luminance_sq);
+                    film.add(i, j, pixel_color, luminance_sq, samples);
+                    if (costs.metric != cost_metric::none)
+                        costs.add(i, j, pixel_cost() - cost_before);
+                }
+            }
+
+            thread_counts[t] = thread_counters() - counted_before;
+            thread_sampler() = active;
+        };
+
+        std::vector<std::thread> workers;
+        for (int t = 1; t < count; t++)
+            workers.emplace_back(render_rows, t);
+        render_rows(0);
+        for (auto& worker : workers)
+            worker.join();
+
+        for (const auto& counted : thread_counts)
+            stats.counters += counted;
+        stats.pixel_samples += uint64_t(width) * height * samples;
+    }
+
+    double pixel_cost() const {
+        // The running total that costs.add() takes differences of: the time, or the current
+        // thread's traversal steps. Steps need the counters, so they are 0 with RTW_NO_STATS.
+        switch (costs.metric) {
+            case cost_metric::time:
+                return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+            case cost_metric::steps:
+                return double(cost_map::steps(thread_counters()));
+            default:
+                return 0;
+        }
+    }
+
+    void sample_pixel(const hittable& world, int i, int j, int first_sample, int samples,
+                      color& pixel_color, double& luminance_sq) const {
+        // Traces `samples` camera rays through pixel i, j, starting at sample index first_sample
+        // of the active sampler, returning the sum of their radiance and the sum of their squared
+        // luminance.
+        pixel_color = color(0,0,0);
+        luminance_sq = 0;
+        for (int sample = 0; sample < samples; sample++) {
+            if (thread_sampler())
+                thread_sampler()->start_pixel(i, j, uint32_t(first_sample + sample));
+            ray r = get_ray(i, j);
+            color sample_color = ray_color(r, max_depth, world);
+            pixel_color += sample_color;
+            luminance_sq += luminance(sample_color) * luminance(sample_color);
+        }
+    }
+
+    void render_with(const hittable& world, sampler_type type, int samples) {
+        // Renders the accumulation buffer from scratch with the given sampler.
+        auto pixel_sampler = make_sampler(type, width, height, samples, seed);
+        thread_sampler() = pixel_sampler.get();
+        film.resize(width, height);
+        render_pass(world, 0, samples, true);
+        thread_sampler() = nullptr;
+    }
+
+    std::vector<float> pixel_means() const {
+        // The mean radiance of every pixel, RGB.
+        std::vector<float> values(size_t(width) * height * 3);
+        for (int j = 0; j < height; j++)
+            for (int i = 0; i < width; i++) {
+                color c = film.average(i, j);
+                for (int k = 0; k < 3; k++)
+                    values[(size_t(j) * width + i) * 3 + k] = float(c[k]);
+            }
+        return values;
+    }
+
+    static void write_convergence_plot(const char* filename, const std::vector<int>& counts,
+                                       const std::vector<std::vector<double>>& errors,
+                                       const sampler_type* types) {
+        // A log-log line chart of error against samples per pixel, one line per sampler.
+        const double plot_w = 560, plot_h = 340, left = 60, top = 20;
+        const char* colors[] = { "#888888", "#2a7ab0", "#d9534f", "#3c9a3c" };
+
+        double low = infinity, high = 0;
+        for (const auto& line : errors)
+            for (double e : line)
+                if (e > 0) { low = std::fmin(low, e); high = std::fmax(high, e); }
+        if (!(low < high)) { low = 1e-3; high = 1; }
+        double decade_low = std::floor(std::log10(low)), decade_high = std::ceil(std::log10(high));
+        if (decade_high <= decade_low) decade_high = decade_low + 1;
+        double octaves = std::max(std::log2(double(counts.back())), 1.0);
+
+        auto x_of = [&](int spp) { return left + plot_w * std::log2(double(spp)) / octaves; };
+        auto y_of = [&](double e) {
+            double t = (std::log10(std::fmax(e, low)) - decade_low) / (decade_high - decade_low);
+            return top + plot_h * (1 - t);
+        };
+
+        std::ofstream svg(filename);
+        svg << "<svg xmlns=\"http://www.w3.org/2000/svg\" width=\"" << left + plot_w + 150
+            << "\" height=\"" << top + plot_h + 50 << "\" font-family=\"sans-serif\" font-size=\"12\">\n";
+        svg << "<rect x=\"" << left << "\" y=\"" << top << "\" width=\"" << plot_w << "\" height=\""
+            << plot_h << "\" fill=\"none\" stroke=\"black\"/>\n";
+
+        for (int spp : counts)
+            svg << "<text x=\"" << x_of(spp) << "\" y=\"" << top + plot_h + 16
+                << "\" text-anchor=\"middle\">" << spp << "</text>\n";
+        for (double d = decade_low; d <= decade_high; d++)
+            svg << "<text x=\"" << left - 6 << "\" y=\"" << y_of(std::pow(10.0, d)) + 4
+                << "\" text-anchor=\"end\">1e" << int(d) << "</text>\n";
+        svg << "<text x=\"" << left + plot_w / 2 << "\" y=\"" << top + plot_h + 36
+            << "\" text-anchor=\"middle\">samples per pixel</text>\n";
+        svg << "<text x=\"14\" y=\"" << top + plot_h / 2 << "\" transform=\"rotate(-90 14 "
+            << top + plot_h / 2 << ")\" text-anchor=\"middle\">RMSE</text>\n";
+
+        for (size_t t = 0; t < errors.size(); t++) {
+            svg << "<polyline fill=\"none\" stroke=\"" << colors[t] << "\" stroke-width=\"2\" points=\"";
+            for (size_t k = 0; k < counts.size(); k++)
+                svg << x_of(counts[k]) << ',' << y_of(errors[t][k]) << ' ';
+            svg << "\"/>\n";
+            svg << "<text x=\"" << left + plot_w + 10 << "\" y=\"" << top + 16 + 18 * t
+                << "\" fill=\"" << colors[t] << "\">" << sampler_name(types[t]) << "</text>\n";
+        }
+
+        svg << "</svg>\n";
+    }
+
+    void render_as_worker(const hittable& world) {
+        tile_worker worker;
+        auto colon = coordinator_address.rfind(':');
+        worker.host = coordinator_address.substr(0, colon);
+        if (colon != std::string::npos)
+            worker.port = std::stoi(coordinator_address.substr(colon + 1));
+
+        worker.run(width, height, [&](const image_tile& tile, int samples, framebuffer& out) {
+            render_tile(world, tile, samples, out);
+        });
+    }
+
+    static double seconds_since(std::chrono::steady_clock::time_point start) {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
     void initialize() {
         height = int(width / aspect_ratio);
         height = (height < 1) ? 1 : height;
@@ -258,31 +964,104 @@ class camera {
         defocus_disk_v = v * defocus_radius;
     }
 
-    color ray_color(const ray& r, int depth, const hittable& world) const {
+    color ray_color(const ray& r, int depth, const hittable& world, double scatter_pdf = 0) const {
+        // scatter_pdf is the density with which the previous hit picked r when that hit also
+        // sampled the lights directly, and 0 for camera rays and all other bounces.
         // If we've exceeded the ray bounce limit, no more light is gathered.
-        if (depth <= 0)
+        if (depth <= 0) {
+            RTW_COUNT(counter::depth_limit);
             return color(0,0,0);
+        }
 
         hit_record rec;
+        RTW_COUNT(depth == max_depth ? counter::camera_rays : counter::scatter_rays);
         //if the world hits nothing, return background
-        if (!world.hit(r, interval(0.001, infinity), rec, lookfrom))
+        if (!world.hit(r, interval(0.001, infinity), rec, lookfrom)) {
+            RTW_COUNT(counter::escaped);
             return background;
+        }
+        RTW_COUNT(counter::hits);
 
-        ray scattered;
         color attenuation;
         color color_from_emission = rec.mat->emitted(rec.u, rec.v, rec.p);
 
-        if(rec.mat->rgb(r, rec, attenuation)){
+        //a scattered ray that lands on a light shares that light with the direct light sample
+        //taken at the previous hit, so its emission only gets its MIS weight
+        if (scatter_pdf > 0 && rec.mat->is_emissive())
+            color_from_emission = color_from_emission
+                                * power_heuristic(scatter_pdf, lights.pdf_value(r.origin(), r.direction()));
+
+        if(rec.mat->shade(r, rec, world, attenuation)){
             //depth = 0;
+            RTW_COUNT(counter::shaded);
             return attenuation;
         }
 
-        if (!rec.mat->scatter(r, rec, attenuation, scattered))
+        scatter_record srec;
+        if (!rec.mat->scatter(r, rec, srec)) {
+            RTW_COUNT(counter::absorbed);
             return color_from_emission;
+        }
+
+        if (srec.is_specular || !sample_lights || lights.objects.empty()) {
+            color color_from_scatter = srec.attenuation * ray_color(srec.scattered, depth-1, world);
+
+            return color_from_emission + color_from_scatter; 
+        }
+
+        color color_from_lights  = sample_direct_light(r, rec, world);
+        color color_from_scatter = srec.attenuation * ray_color(srec.scattered, depth-1, world, srec.pdf);
+
+        return color_from_emission + color_from_lights + color_from_scatter;
+    }
+
+    color sample_direct_light(const ray& r_in, const hit_record& rec, const hittable& world) const {
+        // Next event estimation: sends one shadow ray towards a random point on a random light
+        // and returns its contribution, weighted against the chance that the BSDF sampled
+        // scattered ray finds the same light (multiple importance sampling, power heuristic).
+        vec3 to_light = lights.random(rec.p);
+        double light_pdf = lights.pdf_value(rec.p, to_light);
+        if (light_pdf <= 0)
+            return color(0,0,0);
+
+        ray shadow_ray(rec.p, to_light, r_in.time());
+        double bsdf_pdf = rec.mat->scattering_pdf(r_in, rec, shadow_ray);
+        color  bsdf_cos = rec.mat->eval(r_in, rec, shadow_ray);
+        if (bsdf_pdf <= 0)
+            return color(0,0,0);
+
+        //find the sampled point among the lights alone, then ask the scene whether anything
+        //lies in between
+        hit_record light_rec;
+        if (!lights.hit(shadow_ray, interval(0.001, infinity), light_rec, lookfrom))
+            return color(0,0,0);
 
-        color color_from_scatter = attenuation * ray_color(scattered, depth-1, world);
+        RTW_COUNT(counter::shadow_rays);
+        if (world.occluded(shadow_ray, interval(0.001, light_rec.t - 0.001))) {
+            RTW_COUNT(counter::shadow_hits);
+            return color(0,0,0);
+        }
+
+        color emitted = light_rec.mat->emitted(light_rec.u, light_rec.v, light_rec.p);
+
+        return bsdf_cos * emitted * (power_heuristic(light_pdf, bsdf_pdf) / light_pdf);
+    }
 
-        return color_from_emission + color_from_scatter; 
+    static double power_heuristic(double pdf, double other_pdf) {
+        return (pdf * pdf) / (pdf * pdf + other_pdf * other_pdf);
+    }
+
+    void find_lights(const hittable& world) {
+        // Gathers the emissive primitives of the scene for direct light sampling.
+        std::vector<std::shared_ptr<hittable>> found;
+        world.collect_lights(found);
+
+        lights.clear();
+        for (const auto& light : found)
+            lights.add(light);
+
+        if (found.empty() && sample_lights)
+            std::clog << "No emissive primitives found; direct light sampling is off\n";
     }
 
     color ray_normal(const ray& r, int depth, const hittable& world) const {
@@ -291,9 +1070,11 @@ class camera {
             return color(0);
 
         hit_record rec;
+        RTW_COUNT(depth == max_depth ? counter::camera_rays : counter::scatter_rays);
         //if the world hits nothing, return background
         if (!world.hit(r, interval(0.001, infinity), rec, lookfrom))
             return color(0);
+        RTW_COUNT(counter::hits);
 
         color normal;
         ray scattered;
@@ -319,7 +1100,7 @@ class camera {
 
         auto ray_origin = (defocus_angle <= 0) ? center : defocus_disk_sample();
         auto ray_direction = pixel_sample - ray_origin;
-        auto ray_time = random_double();
+        auto ray_time = sample_1d();
 
         return ray(ray_origin, ray_direction, ray_time);
     }
@@ -341,12 +1122,14 @@ class camera {
 
     vec3 sample_square() const {
         // Returns the vector to a random point in the [-.5,-.5]-[+.5,+.5] unit square.
-        return vec3(random_double() - 0.5, random_double() - 0.5, 0);
+        auto s = sample_2d();
+        return vec3(s.x() - 0.5, s.y() - 0.5, 0);
     }
 
     point3 defocus_disk_sample() const {
         // Returns a random point in the camera defocus disk.
-        auto p = random_in_unit_disk();
+        auto s = sample_2d();
+        auto p = random_in_unit_disk(s.x(), s.y());
         return center + (p[0] * defocus_disk_u) + (p[1] * defocus_disk_v);
     }
 };
\ No newline at end of file
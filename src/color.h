@@ -1,5 +1,6 @@
 #pragma once
 
+#include <algorithm>
 #include <cstdint>
 
 #include "interval.h"
@@ -15,6 +16,25 @@ inline double linear_to_gamma(double linear_component)
     return 0;
 }
 
+inline double luminance(const color& c) {
+    // Relative luminance of a linear RGB color (Rec. 709 weights).
+    return 0.2126*c.x() + 0.7152*c.y() + 0.0722*c.z();
+}
+
+inline void false_color(double t, uint8_t* rgb) {
+    // Writes the color of t in [0,1] on a black-purple-red-yellow-white ramp to rgb[0..2], for
+    // heatmaps of scalar values.
+    static const double ramp[][3] = {
+        {   0,   0,   4 }, {  87,  16, 110 }, { 188,  55,  84 }, { 249, 142,   9 }, { 252, 255, 164 },
+    };
+    const int stops = 5;
+    double x = std::fmin(std::fmax(t, 0.0), 1.0) * (stops - 1);
+    int k = std::min(int(x), stops - 2);
+    double f = x - k;
+    for (int c = 0; c < 3; c++)
+        rgb[c] = uint8_t(ramp[k][c] + f * (ramp[k+1][c] - ramp[k][c]) + 0.5);
+}
+
 void write_color(uint8_t* pixels, int& index, const color& pixel_color) {
     auto r = pixel_color.x();
     auto g = pixel_color.y();
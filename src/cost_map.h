@@ -0,0 +1,111 @@
+#pragma once
+
+#include "rtweekend.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// What the cost map of a render measures: nothing, the wall time spent on each pixel, or the
+// traversal steps (BVH nodes visited plus primitives tested) its rays took.
+enum class cost_metric { none, time, steps };
+
+inline const char* cost_metric_name(cost_metric m) {
+    static const char* names[] = { "none", "time", "steps" };
+    return names[int(m)];
+}
+
+class cost_map {
+  public:
+    // Per-pixel cost of a render, summed over every pass. It is written as a false-color PNG
+    // for looking at, and as a single channel PFM with the raw values for tools. Each render
+    // thread only touches the rows it renders, so no locking is needed.
+
+    int width  = 0;
+    int height = 0;
+    cost_metric metric = cost_metric::none;
+    std::vector<float> values;  // Row major, seconds or steps per pixel
+
+    void resize(int w, int h) {
+        width  = w;
+        height = h;
+        values.assign(size_t(w) * h, 0.0f);
+    }
+
+    void add(int i, int j, double cost) { values[size_t(j) * width + i] += float(cost); }
+
+    static uint64_t steps(const render_counters& counted) {
+        // The traversal steps in a count of the hot paths.
+        return counted[counter::bvh_nodes] + counted[counter::sphere_tests]
+             + counted[counter::quad_tests] + counted[counter::triangle_tests];
+    }
+
+    double mean() const {
+        double total = 0;
+        for (auto v : values) total += v;
+        return values.empty() ? 0 : total / values.size();
+    }
+
+    std::vector<uint8_t> colored() const {
+        // RGB pixels in false color over log2 of each pixel's cost relative to the mean, from
+        // 1/8 to 64 times the mean, so maps of different renders read the same way.
+        const double low = -3, high = 6;
+
+        double m = mean();
+        std::vector<uint8_t> pixels(values.size() * 3, 0);
+        for (size_t p = 0; p < values.size(); p++) {
+            if (m <= 0 || values[p] <= 0)
+                continue;
+
+            false_color((std::log2(values[p] / m) - low) / (high - low), &pixels[3*p]);
+        }
+        return pixels;
+    }
+
+    bool write_pfm(const std::string& filename) const {
+        // Grayscale PFM: a text header, then little-endian floats with the bottom row first.
+        FILE* file = std::fopen(filename.c_str(), "wb");
+        if (!file) {
+            std::cerr << "ERROR: Could not write cost map '" << filename << "'.\n";
+            return false;
+        }
+        std::fprintf(file, "Pf\n%d %d\n-1.0\n", width, height);
+        for (int j = height - 1; j >= 0; j--)
+            std::fwrite(&values[size_t(j) * width], sizeof(float), width, file);
+        return std::fclose(file) == 0;
+    }
+
+    void report(int tile_size, int count = 5) const {
+        // Logs the mean and peak cost and the most expensive tiles, relative to the mean tile.
+        double m = mean();
+        if (m <= 0)
+            return;
+        float peak = *std::max_element(values.begin(), values.end());
+        std::clog << "Cost (" << cost_metric_name(metric) << ") per pixel: mean " << m
+                  << ", max " << peak << " (" << peak / m << "x the mean)\n";
+
+        struct tile_cost { int x, y; double cost; };
+        std::vector<tile_cost> tiles;
+        for (int y = 0; y < height; y += tile_size)
+            for (int x = 0; x < width; x += tile_size) {
+                double cost = 0;
+                int pixels = 0;
+                for (int j = y; j < std::min(y + tile_size, height); j++)
+                    for (int i = x; i < std::min(x + tile_size, width); i++, pixels++)
+                        cost += values[size_t(j) * width + i];
+                tiles.push_back({ x, y, cost / pixels });
+            }
+
+        count = std::min(count, int(tiles.size()));
+        std::partial_sort(tiles.begin(), tiles.begin() + count, tiles.end(),
+                          [](const tile_cost& a, const tile_cost& b) { return a.cost > b.cost; });
+        std::clog << "Hottest " << tile_size << "px tiles:";
+        for (int t = 0; t < count; t++)
+            std::clog << " (" << tiles[t].x << "," << tiles[t].y << ") " << tiles[t].cost / m << "x";
+        std::clog << '\n';
+    }
+};
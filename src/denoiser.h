@@ -0,0 +1,179 @@
+#pragma once
+
+#include "framebuffer.h"
+
+#include <algorithm>
+#include <functional>
+#include <thread>
+#include <vector>
+
+class aov_buffer {
+  public:
+    // Auxiliary buffers of the first surface seen through every pixel, averaged over a few
+    // samples: its albedo, its normal and its distance from the camera. They are nearly noise
+    // free at low sample counts and change exactly where the image has edges, which is what
+    // the denoiser needs to know. Pixels that see the background have albedo 1, normal 0 and
+    // distance 0.
+
+    int width  = 0;
+    int height = 0;
+    std::vector<float> albedo;  // RGB, 3 floats per pixel
+    std::vector<float> normal;  // xyz, 3 floats per pixel
+    std::vector<float> depth;   // Distance along the camera ray, 1 float per pixel
+
+    void resize(int w, int h) {
+        width  = w;
+        height = h;
+        albedo.assign(size_t(w) * h * 3, 1.0f);
+        normal.assign(size_t(w) * h * 3, 0.0f);
+        depth.assign(size_t(w) * h, 0.0f);
+    }
+};
+
+inline void parallel_rows(int height, const std::function<void(int, int)>& rows, int threads = 0) {
+    // Calls rows(begin, end) for contiguous bands of [0, height), one band per thread (0 = one
+    // per hardware thread), and waits for all of them.
+    if (threads <= 0)
+        threads = int(std::thread::hardware_concurrency());
+    threads = std::max(1, std::min(threads, height));
+    if (threads == 1) {
+        rows(0, height);
+        return;
+    }
+
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; t++) {
+        int begin = height * t / threads;
+        int end   = height * (t + 1) / threads;
+        workers.emplace_back(rows, begin, end);
+    }
+    for (auto& worker : workers)
+        worker.join();
+}
+
+class denoiser {
+  public:
+    // Edge-avoiding à-trous wavelet filter (Dammertz et al., "Edge-Avoiding À-Trous Wavelet
+    // Transform for fast Global Illumination Filtering", 2010, with the variance-guided
+    // luminance weight of Schied et al.'s SVGF, 2017).
+    //
+    // The image is divided by the albedo first, so the filter only smooths the lighting and
+    // texture detail survives; it is multiplied back in at the end. Each iteration then blurs
+    // with a 5x5 B3-spline kernel whose taps are spread 2^k pixels apart, so five iterations
+    // reach 80 pixels wide at 25 taps each. A tap only counts if it sees a surface with a
+    // similar normal and depth, and a similar luminance measured against the pixel's own
+    // noise estimate, so edges, silhouettes and shadow boundaries stay sharp while noise is
+    // averaged away. The variance estimate is filtered along with the image.
+
+    int    iterations  = 5;
+    double sigma_luminance = 4.0;    // Luminance tolerance, in standard deviations of the noise
+    double sigma_normal    = 128.0;  // Exponent of the normal similarity (larger = stricter)
+    double sigma_depth     = 0.05;   // Relative depth tolerance per pixel of tap distance
+    int    threads = 0;                // Threads to filter with (0 = one per hardware thread)
+
+    void run(const framebuffer& film, const aov_buffer& aovs, framebuffer& out) const {
+        // Denoises the mean of every pixel of `film` into `out`, which is resized to match and
+        // holds one sample per pixel afterwards.
+        int w = film.width, h = film.height;
+        size_t pixel_count = size_t(w) * h;
+
+        std::vector<float> illum(pixel_count * 3), variance(pixel_count);
+        for (size_t p = 0; p < pixel_count; p++) {
+            double n = std::max<uint32_t>(film.samples[p], 1);
+            for (int c = 0; c < 3; c++)
+                illum[3*p + c] = float(film.sum[3*p + c] / n) / std::max(aovs.albedo[3*p + c], 1e-3f);
+
+            // variance of the pixel mean, from the running sums of sample luminance
+            double mean = luminance(color(film.sum[3*p], film.sum[3*p + 1], film.sum[3*p + 2])) / n;
+            double albedo_lum = std::max(luminance(color(aovs.albedo[3*p], aovs.albedo[3*p + 1],
+                                                         aovs.albedo[3*p + 2])), 1e-3);
+            double var = n > 1 ? std::max(film.sum_sq[p] / n - mean*mean, 0.0) / (n - 1) : 1.0;
+            variance[p] = float(var / (albedo_lum * albedo_lum));
+        }
+
+        std::vector<float> next_illum(illum.size()), next_variance(variance.size());
+        for (int k = 0; k < iterations; k++) {
+            int step = 1 << k;
+            parallel_rows(h, [&](int begin, int end) {
+                for (int j = begin; j < end; j++)
+                    filter_row(j, step, w, h, illum, variance, aovs, next_illum, next_variance);
+            }, threads);
+            illum.swap(next_illum);
+            variance.swap(next_variance);
+        }
+
+        out.resize(w, h);
+        for (size_t p = 0; p < pixel_count; p++) {
+            for (int c = 0; c < 3; c++)
+                out.sum[3*p + c] = illum[3*p + c] * std::max(aovs.albedo[3*p + c], 1e-3f);
+            out.samples[p] = 1;
+        }
+    }
+
+  private:
+    static float local_variance(int i, int j, int w, int h, const std::vector<float>& variance) {
+        // The variance around pixel i, j, blurred with a 3x3 Gaussian. A pixel's own estimate
+        // is too noisy at low sample counts: a pixel that happened to miss the rare bright
+        // paths its neighbours found would otherwise reject all of them.
+        static const float kernel[3] = { 0.25f, 0.5f, 0.25f };
+        float sum = 0;
+        for (int dy = -1; dy <= 1; dy++) {
+            int y = std::clamp(j + dy, 0, h - 1);
+            for (int dx = -1; dx <= 1; dx++) {
+                int x = std::clamp(i + dx, 0, w - 1);
+                sum += kernel[dx + 1] * kernel[dy + 1] * variance[size_t(y) * w + x];
+            }
+        }
+        return sum;
+    }
+
+    void filter_row(int j, int step, int w, int h,
+                    const std::vector<float>& illum, const std::vector<float>& variance,
+                    const aov_buffer& aovs,
+                    std::vector<float>& out_illum, std::vector<float>& out_variance) const {
+        // One à-trous iteration over row j. Taps outside the image are clamped to the border.
+        static const float kernel[5] = { 1.0f/16, 1.0f/4, 3.0f/8, 1.0f/4, 1.0f/16 };
+
+        for (int i = 0; i < w; i++) {
+            size_t p = size_t(j) * w + i;
+            float lum_p = float(luminance(color(illum[3*p], illum[3*p + 1], illum[3*p + 2])));
+            float lum_scale = float(1.0 / (sigma_luminance * std::sqrt(local_variance(i, j, w, h, variance)) + 1e-4));
+            float depth_scale = float(1.0 / (sigma_depth * step * std::max(aovs.depth[p], 1e-4f)));
+            const float* n_p = &aovs.normal[3*p];
+
+            float sum[3] = { 0, 0, 0 };
+            float weight_sum = 0, variance_sum = 0;
+
+            for (int dy = -2; dy <= 2; dy++) {
+                int y = std::clamp(j + dy * step, 0, h - 1);
+                for (int dx = -2; dx <= 2; dx++) {
+                    int x = std::clamp(i + dx * step, 0, w - 1);
+                    size_t q = size_t(y) * w + x;
+
+                    const float* n_q = &aovs.normal[3*q];
+                    float n_dot = std::max(n_p[0]*n_q[0] + n_p[1]*n_q[1] + n_p[2]*n_q[2], 0.0f);
+                    // background pixels have no normal; they match each other but no surface
+                    bool both_background = aovs.depth[p] == 0 && aovs.depth[q] == 0;
+                    float w_normal = both_background ? 1.0f : std::pow(n_dot, float(sigma_normal));
+
+                    float w_depth = std::exp(-std::fabs(aovs.depth[p] - aovs.depth[q]) * depth_scale);
+
+                    float lum_q = float(luminance(color(illum[3*q], illum[3*q + 1], illum[3*q + 2])));
+                    float w_lum = std::exp(-std::fabs(lum_p - lum_q) * lum_scale);
+
+                    float weight = kernel[dx + 2] * kernel[dy + 2] * w_normal * w_depth * w_lum;
+                    sum[0] += weight * illum[3*q];
+                    sum[1] += weight * illum[3*q + 1];
+                    sum[2] += weight * illum[3*q + 2];
+                    weight_sum   += weight;
+                    variance_sum += weight * weight * variance[q];
+                }
+            }
+
+            // the center tap always has full weight, so weight_sum > 0
+            for (int c = 0; c < 3; c++)
+                out_illum[3*p + c] = sum[c] / weight_sum;
+            out_variance[p] = variance_sum / (weight_sum * weight_sum);
+        }
+    }
+};
@@ -0,0 +1,444 @@
+#pragma once
+
+// Distributed rendering of a single frame. A coordinator process splits the image into tiles
+// and leases them to worker processes over TCP. Each worker builds the same scene, renders the
+// tiles it is given into a float tile buffer and sends the buffer back, and the coordinator
+// merges it into the frame's framebuffer. Tiles leased to a worker that disconnects or misses
+// its lease deadline are leased again to another worker.
+//
+// Wire format (all fields 32-bit, native byte order, so every machine must share endianness):
+//   worker -> coordinator  HELLO   magic, image width, image height
+//   coordinator -> worker  LEASE   tile id, x0, y0, x1, y1, samples per pixel
+//                          DONE    done_id, followed by five unused fields
+//   worker -> coordinator  RESULT  tile id, then the tile's sum, sum_sq and samples arrays
+
+#include "framebuffer.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+    // before the first Windows header: no min/max macros breaking std::min/std::max, and none
+    // of the rarely used APIs
+    #ifndef NOMINMAX
+        #define NOMINMAX
+    #endif
+    #ifndef WIN32_LEAN_AND_MEAN
+        #define WIN32_LEAN_AND_MEAN
+    #endif
+    #include <winsock2.h>
+    #include <ws2tcpip.h>
+    #pragma comment(lib, "ws2_32.lib")
+
+    using socket_t = SOCKET;
+    const socket_t invalid_socket = INVALID_SOCKET;
+
+    inline void close_socket(socket_t s) { closesocket(s); }
+    inline void set_nonblocking(socket_t s) { u_long on = 1; ioctlsocket(s, FIONBIO, &on); }
+    inline bool would_block() { return WSAGetLastError() == WSAEWOULDBLOCK; }
+
+    inline void init_sockets() {
+        static bool started = false;
+        WSADATA data;
+        if (!started) started = WSAStartup(MAKEWORD(2, 2), &data) == 0;
+    }
+#else
+    #include <cerrno>
+    #include <fcntl.h>
+    #include <netdb.h>
+    #include <netinet/in.h>
+    #include <netinet/tcp.h>
+    #include <signal.h>
+    #include <sys/select.h>
+    #include <sys/socket.h>
+    #include <unistd.h>
+
+    using socket_t = int;
+    const socket_t invalid_socket = -1;
+
+    inline void close_socket(socket_t s) { close(s); }
+    inline void set_nonblocking(socket_t s) { fcntl(s, F_SETFL, fcntl(s, F_GETFL, 0) | O_NONBLOCK); }
+    inline bool would_block() { return errno == EAGAIN || errno == EWOULDBLOCK; }
+
+    inline void init_sockets() {
+        // A worker that dies mid-transfer must not kill the coordinator with SIGPIPE.
+        signal(SIGPIPE, SIG_IGN);
+    }
+#endif
+
+class image_tile {
+  public:
+    uint32_t id;
+    int x0, y0;  // Upper left pixel (inclusive)
+    int x1, y1;  // Lower right pixel (exclusive)
+
+    int width()  const { return x1 - x0; }
+    int height() const { return y1 - y0; }
+
+    size_t payload_size() const {
+        // Bytes of framebuffer data a RESULT message carries for this tile.
+        size_t pixels = size_t(width()) * height();
+        return pixels * (3 * sizeof(float) + sizeof(float) + sizeof(uint32_t));
+    }
+
+    static std::vector<image_tile> split(int image_width, int image_height, int tile_size) {
+        // Covers the image with tiles of at most tile_size x tile_size pixels, row by row.
+        std::vector<image_tile> tiles;
+        for (int y = 0; y < image_height; y += tile_size) {
+            for (int x = 0; x < image_width; x += tile_size) {
+                image_tile t;
+                t.id = uint32_t(tiles.size());
+                t.x0 = x;
+                t.y0 = y;
+                t.x1 = std::min(x + tile_size, image_width);
+                t.y1 = std::min(y + tile_size, image_height);
+                tiles.push_back(t);
+            }
+        }
+        return tiles;
+    }
+};
+
+namespace tile_protocol {
+    const uint32_t magic   = 0x52544431;  // "RTD1"
+    const uint32_t done_id = 0xffffffff;
+
+    inline bool send_all(socket_t s, const char* data, size_t size) {
+        while (size > 0) {
+            auto sent = send(s, data, int(size), 0);
+            if (sent < 0 && would_block()) {
+                std::this_thread::yield();
+                continue;
+            }
+            if (sent <= 0) return false;
+            data += sent;
+            size -= size_t(sent);
+        }
+        return true;
+    }
+
+    inline bool recv_all(socket_t s, char* data, size_t size) {
+        while (size > 0) {
+            auto got = recv(s, data, int(size), 0);
+            if (got <= 0) return false;
+            data += got;
+            size -= size_t(got);
+        }
+        return true;
+    }
+
+    inline void pack_tile(const framebuffer& fb, std::vector<char>& out) {
+        auto append = [&out](const void* data, size_t size) {
+            auto bytes = static_cast<const char*>(data);
+            out.insert(out.end(), bytes, bytes + size);
+        };
+        append(fb.sum.data(),     fb.sum.size()     * sizeof(float));
+        append(fb.sum_sq.data(),  fb.sum_sq.size()  * sizeof(float));
+        append(fb.samples.data(), fb.samples.size() * sizeof(uint32_t));
+    }
+
+    inline void unpack_tile(const char* data, framebuffer& fb) {
+        auto take = [&data](void* dest, size_t size) {
+            std::memcpy(dest, data, size);
+            data += size;
+        };
+        take(fb.sum.data(),     fb.sum.size()     * sizeof(float));
+        take(fb.sum_sq.data(),  fb.sum_sq.size()  * sizeof(float));
+        take(fb.samples.data(), fb.samples.size() * sizeof(uint32_t));
+    }
+}
+
+class tile_coordinator {
+  public:
+    int    port          = 7878;  // TCP port to accept workers on
+    int    tile_size     = 32;    // Tile edge length in pixels
+    double lease_timeout = 300;   // Seconds before a leased tile is presumed lost and leased again
+
+    bool run(framebuffer& film, int samples) {
+        // Leases every tile of `film` to connected workers, `samples` samples per pixel each,
+        // and merges the results in. Returns once all tiles are merged, or false if the port
+        // can't be opened.
+        init_sockets();
+
+        socket_t listener = open_listener();
+        if (listener == invalid_socket) {
+            std::cerr << "ERROR: Could not listen on port " << port << ".\n";
+            return false;
+        }
+
+        tiles = image_tile::split(film.width, film.height, tile_size);
+        pending.assign(tiles.size(), 0);
+        for (size_t t = 0; t < tiles.size(); t++) pending[t] = uint32_t(t);
+        finished.assign(tiles.size(), false);
+        size_t remaining = tiles.size();
+
+        std::clog << "Waiting for workers on port " << port << " (" << tiles.size() << " tiles)\n";
+
+        while (remaining > 0) {
+            fd_set readable;
+            FD_ZERO(&readable);
+            FD_SET(listener, &readable);
+            socket_t highest = listener;
+            for (auto& w : workers) {
+                FD_SET(w.fd, &readable);
+                if (w.fd > highest) highest = w.fd;
+            }
+
+            timeval wait = { 1, 0 };
+            if (select(int(highest + 1), &readable, nullptr, nullptr, &wait) < 0)
+                continue;
+
+            if (FD_ISSET(listener, &readable))
+                accept_worker(listener);
+
+            for (auto& w : workers) {
+                if (w.fd != invalid_socket && FD_ISSET(w.fd, &readable))
+                    remaining -= receive(w, film, samples);
+            }
+
+            // Workers that missed their deadline are treated as dead.
+            auto now = std::chrono::steady_clock::now();
+            for (auto& w : workers) {
+                if (w.fd != invalid_socket && w.tile >= 0
+                    && std::chrono::duration<double>(now - w.leased_at).count() > lease_timeout) {
+                    std::clog << "Lease of tile " << w.tile << " timed out\n";
+                    drop(w);
+                }
+            }
+
+            workers.erase(std::remove_if(workers.begin(), workers.end(),
+                          [](const worker& w) { return w.fd == invalid_socket; }), workers.end());
+
+            // Tiles handed back by dropped workers go to whoever is idle.
+            for (auto& w : workers)
+                if (w.greeted && w.tile < 0) lease_next(w, samples);
+
+            std::clog << "\rTiles remaining: " << remaining << ", workers: " << workers.size()
+                      << "    " << std::flush;
+        }
+
+        std::clog << "\rAll tiles merged.                                  \n";
+
+        for (auto& w : workers) {
+            uint32_t done[6] = { tile_protocol::done_id, 0, 0, 0, 0, 0 };
+            tile_protocol::send_all(w.fd, reinterpret_cast<const char*>(done), sizeof(done));
+            close_socket(w.fd);
+        }
+        workers.clear();
+        close_socket(listener);
+        return true;
+    }
+
+  private:
+    class worker {
+      public:
+        socket_t fd = invalid_socket;
+        bool greeted = false;
+        long tile = -1;   // Tile currently leased to this worker, or -1
+        std::chrono::steady_clock::time_point leased_at;
+        std::vector<char> inbox;
+    };
+
+    std::vector<image_tile> tiles;
+    std::deque<uint32_t>    pending;
+    std::vector<bool>       finished;
+    std::vector<worker>     workers;
+
+    socket_t open_listener() const {
+        socket_t s = socket(AF_INET, SOCK_STREAM, 0);
+        if (s == invalid_socket) return s;
+
+        int on = 1;
+        setsockopt(s, SOL_SOCKET, SO_REUSEADDR, reinterpret_cast<const char*>(&on), sizeof(on));
+
+        sockaddr_in addr = {};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_ANY);
+        addr.sin_port = htons(uint16_t(port));
+
+        if (bind(s, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 || listen(s, 16) != 0) {
+            close_socket(s);
+            return invalid_socket;
+        }
+        return s;
+    }
+
+    void accept_worker(socket_t listener) {
+        worker w;
+        w.fd = accept(listener, nullptr, nullptr);
+        if (w.fd == invalid_socket) return;
+        set_nonblocking(w.fd);
+        workers.push_back(std::move(w));
+    }
+
+    size_t receive(worker& w, framebuffer& film, int samples) {
+        // Reads whatever the worker has sent and handles every complete message. Returns the
+        // number of tiles newly merged.
+        char chunk[65536];
+        while (true) {
+            auto got = recv(w.fd, chunk, sizeof(chunk), 0);
+            if (got > 0) {
+                w.inbox.insert(w.inbox.end(), chunk, chunk + got);
+                continue;
+            }
+            if (got < 0 && would_block()) break;
+
+            drop(w);  // Closed or failed: the worker is gone.
+            return 0;
+        }
+
+        size_t merged = 0;
+        if (!w.greeted && w.inbox.size() >= 3 * sizeof(uint32_t)) {
+            uint32_t hello[3];
+            std::memcpy(hello, w.inbox.data(), sizeof(hello));
+            w.inbox.erase(w.inbox.begin(), w.inbox.begin() + sizeof(hello));
+
+            if (hello[0] != tile_protocol::magic || int(hello[1]) != film.width
+                || int(hello[2]) != film.height) {
+                std::cerr << "\nRejected a worker rendering a different image\n";
+                drop(w);
+                return 0;
+            }
+            w.greeted = true;
+            lease_next(w, samples);
+        }
+
+        while (w.greeted && w.tile >= 0) {
+            const auto& t = tiles[size_t(w.tile)];
+            size_t message_size = sizeof(uint32_t) + t.payload_size();
+            if (w.inbox.size() < message_size) break;
+
+            // Results for tiles that were re-leased and already merged are dropped.
+            if (!finished[t.id]) {
+                framebuffer result(t.width(), t.height());
+                tile_protocol::unpack_tile(w.inbox.data() + sizeof(uint32_t), result);
+                film.merge(result, t.x0, t.y0);
+                finished[t.id] = true;
+                merged++;
+            }
+
+            w.inbox.erase(w.inbox.begin(), w.inbox.begin() + long(message_size));
+            w.tile = -1;
+            lease_next(w, samples);
+        }
+
+        return merged;
+    }
+
+    void lease_next(worker& w, int samples) {
+        while (!pending.empty() && finished[pending.front()])
+            pending.pop_front();
+        if (pending.empty()) return;
+
+        const auto& t = tiles[pending.front()];
+        uint32_t lease[6] = { t.id, uint32_t(t.x0), uint32_t(t.y0), uint32_t(t.x1), uint32_t(t.y1),
+                              uint32_t(samples) };
+        if (!tile_protocol::send_all(w.fd, reinterpret_cast<const char*>(lease), sizeof(lease))) {
+            drop(w);
+            return;
+        }
+
+        pending.pop_front();
+        w.tile = t.id;
+        w.leased_at = std::chrono::steady_clock::now();
+    }
+
+    void drop(worker& w) {
+        // Closes the connection and puts the worker's unfinished tile back in the queue.
+        if (w.tile >= 0 && !finished[size_t(w.tile)])
+            pending.push_front(uint32_t(w.tile));
+        w.tile = -1;
+        close_socket(w.fd);
+        w.fd = invalid_socket;
+    }
+};
+
+class tile_worker {
+  public:
+    std::string host = "127.0.0.1";  // Coordinator address
+    int         port = 7878;         // Coordinator port
+    double      connect_timeout = 30; // Seconds to keep retrying while the coordinator starts
+
+    using tile_renderer = std::function<void(const image_tile&, int samples, framebuffer&)>;
+
+    bool run(int image_width, int image_height, const tile_renderer& render) {
+        // Connects to the coordinator and renders leased tiles until it says the frame is done.
+        init_sockets();
+
+        socket_t s = connect_to_coordinator();
+        if (s == invalid_socket) {
+            std::cerr << "ERROR: Could not connect to coordinator " << host << ':' << port << ".\n";
+            return false;
+        }
+
+        uint32_t hello[3] = { tile_protocol::magic, uint32_t(image_width), uint32_t(image_height) };
+        bool ok = tile_protocol::send_all(s, reinterpret_cast<const char*>(hello), sizeof(hello));
+
+        int rendered = 0;
+        while (ok) {
+            uint32_t lease[6];
+            if (!tile_protocol::recv_all(s, reinterpret_cast<char*>(lease), sizeof(lease))) break;
+            if (lease[0] == tile_protocol::done_id) break;
+
+            image_tile t;
+            t.id = lease[0];
+            t.x0 = int(lease[1]);
+            t.y0 = int(lease[2]);
+            t.x1 = int(lease[3]);
+            t.y1 = int(lease[4]);
+
+            framebuffer result(t.width(), t.height());
+            render(t, int(lease[5]), result);
+
+            std::vector<char> message(sizeof(uint32_t));
+            std::memcpy(message.data(), &t.id, sizeof(uint32_t));
+            tile_protocol::pack_tile(result, message);
+            ok = tile_protocol::send_all(s, message.data(), message.size());
+
+            std::clog << "\rTiles rendered: " << ++rendered << ' ' << std::flush;
+        }
+
+        std::clog << "\nWorker finished.\n";
+        close_socket(s);
+        return true;
+    }
+
+  private:
+    socket_t connect_to_coordinator() const {
+        auto deadline = std::chrono::steady_clock::now()
+                      + std::chrono::milliseconds(long(connect_timeout * 1000));
+
+        while (true) {
+            addrinfo hints = {};
+            hints.ai_family = AF_INET;
+            hints.ai_socktype = SOCK_STREAM;
+            addrinfo* found = nullptr;
+
+            auto service = std::to_string(port);
+            if (getaddrinfo(host.c_str(), service.c_str(), &hints, &found) == 0) {
+                for (auto a = found; a; a = a->ai_next) {
+                    socket_t s = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+                    if (s == invalid_socket) continue;
+                    if (connect(s, a->ai_addr, int(a->ai_addrlen)) == 0) {
+                        int on = 1;
+                        setsockopt(s, IPPROTO_TCP, TCP_NODELAY,
+                                   reinterpret_cast<const char*>(&on), sizeof(on));
+                        freeaddrinfo(found);
+                        return s;
+                    }
+                    close_socket(s);
+                }
+                freeaddrinfo(found);
+            }
+
+            if (std::chrono::steady_clock::now() > deadline) return invalid_socket;
+            std::this_thread::sleep_for(std::chrono::milliseconds(250));
+        }
+    }
+};
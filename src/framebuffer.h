@@ -0,0 +1,147 @@
+#pragma once
+
+#include "rtweekend.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <vector>
+
+class framebuffer {
+  public:
+    // Linear HDR accumulation buffer. Each pixel holds the running sum of its radiance samples
+    // (three floats, RGB) and the number of samples in that sum, so passes can be added
+    // progressively, tiles rendered elsewhere can be merged in, and a render can be resumed.
+    // Nothing is tonemapped until resolve() runs as a separate final pass.
+
+    int width  = 0;
+    int height = 0;
+    std::vector<float>    sum;      // Per-pixel RGB radiance sums, row major, 3 floats per pixel
+    std::vector<float>    sum_sq;   // Per-pixel sums of squared sample luminance, for noise estimates
+    std::vector<uint32_t> samples;  // Per-pixel sample counts
+
+    framebuffer() {}
+
+    framebuffer(int width, int height) { resize(width, height); }
+
+    void resize(int w, int h) {
+        width  = w;
+        height = h;
+        sum.assign(size_t(w) * h * 3, 0.0f);
+        sum_sq.assign(size_t(w) * h, 0.0f);
+        samples.assign(size_t(w) * h, 0);
+    }
+
+    void clear() {
+        std::fill(sum.begin(), sum.end(), 0.0f);
+        std::fill(sum_sq.begin(), sum_sq.end(), 0.0f);
+        std::fill(samples.begin(), samples.end(), 0);
+    }
+
+    void add(int i, int j, const color& pixel_sum, double luminance_sq_sum, uint32_t count) {
+        // Adds the sum of `count` radiance samples, and the sum of their squared luminances, to
+        // the pixel at i, j.
+        auto index = size_t(j) * width + i;
+        sum[3*index + 0] += float(pixel_sum.x());
+        sum[3*index + 1] += float(pixel_sum.y());
+        sum[3*index + 2] += float(pixel_sum.z());
+        sum_sq[index] += float(luminance_sq_sum);
+        samples[index] += count;
+    }
+
+    color average(int i, int j) const {
+        // Returns the mean radiance of the pixel at i, j (black if it has no samples yet).
+        auto index = size_t(j) * width + i;
+        if (samples[index] == 0) return color(0,0,0);
+
+        double scale = 1.0 / samples[index];
+        return scale * color(sum[3*index], sum[3*index + 1], sum[3*index + 2]);
+    }
+
+    void merge(const framebuffer& other, int x0, int y0) {
+        // Adds another (smaller or equally sized) buffer into this one with its upper left
+        // corner at pixel x0, y0. Used to combine separately rendered tiles.
+        for (int j = 0; j < other.height; j++) {
+            for (int i = 0; i < other.width; i++) {
+                auto src = size_t(j) * other.width + i;
+                auto dst = size_t(y0 + j) * width + (x0 + i);
+                sum[3*dst + 0] += other.sum[3*src + 0];
+                sum[3*dst + 1] += other.sum[3*src + 1];
+                sum[3*dst + 2] += other.sum[3*src + 2];
+                sum_sq[dst] += other.sum_sq[src];
+                samples[dst] += other.samples[src];
+            }
+        }
+    }
+
+    void write(std::ostream& out) const {
+        // Writes the dimensions and the raw buffers in native byte order.
+        out.write(reinterpret_cast<const char*>(&width),  sizeof(width));
+        out.write(reinterpret_cast<const char*>(&height), sizeof(height));
+        out.write(reinterpret_cast<const char*>(sum.data()),     sum.size()     * sizeof(float));
+        out.write(reinterpret_cast<const char*>(sum_sq.data()),  sum_sq.size()  * sizeof(float));
+        out.write(reinterpret_cast<const char*>(samples.data()), samples.size() * sizeof(uint32_t));
+    }
+
+    bool read(std::istream& in) {
+        // Reads a buffer written by write(). Returns false if the data is truncated.
+        int w = 0, h = 0;
+        in.read(reinterpret_cast<char*>(&w), sizeof(w));
+        in.read(reinterpret_cast<char*>(&h), sizeof(h));
+        if (!in || w <= 0 || h <= 0) return false;
+
+        resize(w, h);
+        in.read(reinterpret_cast<char*>(sum.data()),     sum.size()     * sizeof(float));
+        in.read(reinterpret_cast<char*>(sum_sq.data()),  sum_sq.size()  * sizeof(float));
+        in.read(reinterpret_cast<char*>(samples.data()), samples.size() * sizeof(uint32_t));
+        return bool(in);
+    }
+
+    double relative_error() const {
+        // Estimates how noisy the image still is: the mean over all pixels of the standard
+        // error of each pixel's luminance, relative to that luminance. A small floor keeps
+        // near-black pixels from dominating.
+        size_t pixel_count = size_t(width) * height;
+        double total = 0;
+
+        for (size_t p = 0; p < pixel_count; p++) {
+            if (samples[p] < 2) continue;
+
+            double n    = samples[p];
+            double mean = luminance(color(sum[3*p], sum[3*p + 1], sum[3*p + 2])) / n;
+            double var  = std::fmax(sum_sq[p] / n - mean*mean, 0.0) / (n - 1);
+            total += std::sqrt(var) / (std::fabs(mean) + 0.01);
+        }
+
+        return pixel_count > 0 ? total / pixel_count : 0;
+    }
+
+    void resolve_linear(float* pixels) const {
+        // The mean radiance of every pixel as linear RGB floats, without tonemapping.
+        size_t pixel_count = size_t(width) * height;
+        for (size_t p = 0; p < pixel_count; p++) {
+            float scale = 1.0f / float(std::max<uint32_t>(samples[p], 1));
+            for (int c = 0; c < 3; c++)
+                pixels[3*p + c] = sum[3*p + c] * scale;
+        }
+    }
+
+    void resolve(uint8_t* pixels) const {
+        // Tonemaps the accumulated radiance into 8-bit gamma 2 RGB. This is the same transform
+        // as write_color, written as a flat loop without data-dependent branches so the compiler
+        // can vectorize it.
+
+        size_t pixel_count = size_t(width) * height;
+        const float*    in     = sum.data();
+        const uint32_t* counts = samples.data();
+
+        for (size_t p = 0; p < pixel_count; p++) {
+            float scale = 1.0f / float(std::max<uint32_t>(counts[p], 1));
+            for (int c = 0; c < 3; c++) {
+                float linear = std::fmax(in[3*p + c] * scale, 0.0f);
+                float gamma  = std::fmin(std::sqrt(linear), 0.999f);
+                pixels[3*p + c] = uint8_t(256.0f * gamma);
+            }
+        }
+    }
+};
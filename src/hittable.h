@@ -3,6 +3,8 @@
 #include "rtweekend.h"
 #include "aabb.h"
 
+#include <vector>
+
 class material;
 
 class hit_record {
@@ -36,8 +38,40 @@ class hittable {
 
     virtual bool hit(const ray& r, interval ray_t, hit_record& rec, const vec3& camPos) const = 0;
 
+    virtual bool occluded(const ray& r, interval ray_t) const {
+        // Returns true if anything intersects the ray inside ray_t. Unlike hit() this can stop
+        // at the first intersection found and fills in no record, which is all shadow and
+        // visibility rays need.
+        hit_record rec;
+        return hit(r, ray_t, rec, r.origin());
+    }
+
     virtual aabb bounding_box() const = 0;
 
+    virtual void refit() {
+        // Recomputes the bounding box from the objects below after some of them have moved,
+        // keeping the structure as it is (see bvh_node::update). Primitives update their own
+        // box when they are moved, so by default there is nothing to do.
+    }
+
+    // Light sampling. Emissive primitives can be sampled directly: random() returns a direction
+    // from `origin` towards a random point on the primitive, and pdf_value() is the solid angle
+    // density of random() producing `direction`.
+
+    virtual bool is_emissive() const { return false; }
+
+    virtual void collect_lights(std::vector<std::shared_ptr<hittable>>& lights) const {
+        // Appends the emissive primitives below this node. Lights under translate/rotate_y/transform are
+        // not collected; they are still found by scattered rays.
+    }
+
+    virtual double pdf_value(const point3& origin, const vec3& direction) const {
+        return 0.0;
+    }
+
+    virtual vec3 random(const point3& origin) const {
+        return vec3(1,0,0);
+    }
 };
 
 class translate : public hittable {
@@ -49,6 +83,14 @@ class translate : public hittable {
         bbox = object->bounding_box() + offset;
     }
 
+    void set_offset(const vec3& new_offset) {
+        offset = new_offset;
+        bbox = object->bounding_box() + offset;
+    }
+
+    std::shared_ptr<hittable> inner() const { return object; }
+    vec3 get_offset() const { return offset; }
+
     bool hit(const ray& r, interval ray_t, hit_record& rec, const vec3& camPos) const override {
         // Move the ray backwards by the offset
         ray offset_r(r.origin() - offset, r.direction(), r.time());
@@ -63,8 +105,18 @@ class translate : public hittable {
         return true;
     }
 
+    bool occluded(const ray& r, interval ray_t) const override {
+        ray offset_r(r.origin() - offset, r.direction(), r.time());
+        return object->occluded(offset_r, ray_t);
+    }
+
     aabb bounding_box() const override { return bbox; }
 
+    void refit() override {
+        object->refit();
+        bbox = object->bounding_box() + offset;
+    }
+
   private:
     std::shared_ptr<hittable> object;
     vec3 offset;
@@ -75,9 +127,68 @@ class rotate_y : public hittable {
   public:
 
   rotate_y(std::shared_ptr<hittable> object, double angle) : object(object) {
+        set_angle(angle);
+    }
+
+    void set_angle(double new_angle) {
+        angle = new_angle;
         auto radians = degrees_to_radians(angle);
         sin_theta = std::sin(radians);
         cos_theta = std::cos(radians);
+        set_bounding_box();
+    }
+
+    std::shared_ptr<hittable> inner() const { return object; }
+    double get_angle() const { return angle; }
+
+    bool hit(const ray& r, interval ray_t, hit_record& rec, const vec3& camPos) const override {
+
+        // Transform the ray from world space to object space.
+
+        ray rotated_r = to_object_space(r);
+
+        // Determine whether an intersection exists in object space (and if so, where).
+
+        if (!object->hit(rotated_r, ray_t, rec, camPos))
+            return false;
+
+        // Transform the intersection from object space back to world space.
+
+        rec.p = point3(
+            (cos_theta * rec.p.x()) + (sin_theta * rec.p.z()),
+            rec.p.y(),
+            (-sin_theta * rec.p.x()) + (cos_theta * rec.p.z())
+        );
+
+        rec.normal = vec3(
+            (cos_theta * rec.normal.x()) + (sin_theta * rec.normal.z()),
+            rec.normal.y(),
+            (-sin_theta * rec.normal.x()) + (cos_theta * rec.normal.z())
+        );
+
+        return true;
+    }
+
+    bool occluded(const ray& r, interval ray_t) const override {
+        return object->occluded(to_object_space(r), ray_t);
+    }
+
+    aabb bounding_box() const override { return bbox; }
+
+    void refit() override {
+        object->refit();
+        set_bounding_box();
+    }
+
+  private:
+    std::shared_ptr<hittable> object;
+    double angle;
+    double sin_theta;
+    double cos_theta;
+    aabb bbox;
+
+    void set_bounding_box() {
+        // The box around the rotated corners of the object's box.
         bbox = object->bounding_box();
 
         point3 min( infinity,  infinity,  infinity);
@@ -106,10 +217,7 @@ class rotate_y : public hittable {
         bbox = aabb(min, max);
     }
 
-    bool hit(const ray& r, interval ray_t, hit_record& rec, const vec3& camPos) const override {
-
-        // Transform the ray from world space to object space.
-
+    ray to_object_space(const ray& r) const {
         auto origin = point3(
             (cos_theta * r.origin().x()) - (sin_theta * r.origin().z()),
             r.origin().y(),
@@ -122,35 +230,6 @@ class rotate_y : public hittable {
             (sin_theta * r.direction().x()) + (cos_theta * r.direction().z())
         );
 
-        ray rotated_r(origin, direction, r.time());
-
-        // Determine whether an intersection exists in object space (and if so, where).
-
-        if (!object->hit(rotated_r, ray_t, rec, camPos))
-            return false;
-
-        // Transform the intersection from object space back to world space.
-
-        rec.p = point3(
-            (cos_theta * rec.p.x()) + (sin_theta * rec.p.z()),
-            rec.p.y(),
-            (-sin_theta * rec.p.x()) + (cos_theta * rec.p.z())
-        );
-
-        rec.normal = vec3(
-            (cos_theta * rec.normal.x()) + (sin_theta * rec.normal.z()),
-            rec.normal.y(),
-            (-sin_theta * rec.normal.x()) + (cos_theta * rec.normal.z())
-        );
-
-        return true;
+        return ray(origin, direction, r.time());
     }
-
-    aabb bounding_box() const override { return bbox; }
-
-  private:
-    std::shared_ptr<hittable> object;
-    double sin_theta;
-    double cos_theta;
-    aabb bbox;
 };
\ No newline at end of file
@@ -3,6 +3,7 @@
 #include "aabb.h"
 #include "hittable.h"
 
+#include <algorithm>
 #include <vector>
 
 class hittable_list : public hittable {
@@ -35,8 +36,52 @@ class hittable_list : public hittable {
         return hit_anything;
     }
 
+    bool occluded(const ray& r, interval ray_t) const override {
+        for (const auto& object : objects) {
+            if (object->occluded(r, ray_t))
+                return true;
+        }
+
+        return false;
+    }
+
     aabb bounding_box() const override { return bbox; }
 
+    void refit() override {
+        bbox = aabb();
+        for (const auto& object : objects) {
+            object->refit();
+            bbox = aabb(bbox, object->bounding_box());
+        }
+    }
+
+    void collect_lights(std::vector<std::shared_ptr<hittable>>& lights) const override {
+        for (const auto& object : objects) {
+            if (object->is_emissive())
+                lights.push_back(object);
+            else
+                object->collect_lights(lights);
+        }
+    }
+
+    double pdf_value(const point3& origin, const vec3& direction) const override {
+        // A list used as a light set picks one of its objects uniformly, so its density is the
+        // average of theirs.
+        auto weight = 1.0 / objects.size();
+        auto sum = 0.0;
+
+        for (const auto& object : objects)
+            sum += weight * object->pdf_value(origin, direction);
+
+        return sum;
+    }
+
+    vec3 random(const point3& origin) const override {
+        auto int_size = int(objects.size());
+        auto index = std::min(int(sample_1d() * int_size), int_size-1);
+        return objects[index]->random(origin);
+    }
+
     private:
     aabb bbox;
 };
\ No newline at end of file
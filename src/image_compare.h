@@ -0,0 +1,178 @@
+#pragma once
+
+#include "rtw_stb_image.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+class rgb_image {
+  public:
+    // An 8-bit RGB image as written by the renderer, for comparing renders with each other.
+    int width  = 0;
+    int height = 0;
+    std::vector<uint8_t> pixels;  // Row major, 3 bytes per pixel
+
+    bool load(const std::string& filename) {
+        int channels;
+        auto data = stbi_load(filename.c_str(), &width, &height, &channels, 3);
+        if (!data)
+            return false;
+        pixels.assign(data, data + size_t(width) * height * 3);
+        stbi_image_free(data);
+        return true;
+    }
+
+    bool same_size(const rgb_image& other) const {
+        return width == other.width && height == other.height;
+    }
+};
+
+inline double rmse(const rgb_image& a, const rgb_image& b) {
+    // Root mean square difference over every channel of two images of the same size, in 8-bit
+    // steps.
+    double sum = 0;
+    for (size_t k = 0; k < a.pixels.size(); k++) {
+        double d = double(a.pixels[k]) - double(b.pixels[k]);
+        sum += d * d;
+    }
+    return a.pixels.empty() ? 0 : std::sqrt(sum / a.pixels.size());
+}
+
+class flip_metric {
+  public:
+    // A perceptual difference in the style of FLIP (Andersson et al., "FLIP: A Difference
+    // Evaluator for Alternating Images", 2020), simplified: both images are filtered to what
+    // the eye resolves at `pixels_per_degree` with plain Gaussians instead of FLIP's contrast
+    // sensitivity functions, color differences are HyAB distances in CIELAB, and differences
+    // in edges and points of the lightness amplify them. Per-pixel errors are in [0,1], and
+    // unlike RMSE they barely react to noise finer than the eye can see. 67 pixels per degree
+    // is a 0.7 m viewing distance from a 24" 4K screen.
+
+    double pixels_per_degree = 67;
+
+    std::vector<float> errors(const rgb_image& reference, const rgb_image& test) const {
+        // The per-pixel error of `test` against `reference`, which must have the same size.
+        int w = reference.width, h = reference.height;
+        plane ref_l, ref_a, ref_b, test_l, test_a, test_b;
+        to_lab(reference, ref_l, ref_a, ref_b);
+        to_lab(test, test_l, test_a, test_b);
+
+        // features of the unfiltered lightness
+        double feature_sigma = 0.5 * 0.082 * pixels_per_degree;
+        plane ref_edges, ref_points, test_edges, test_points;
+        features(ref_l, w, h, feature_sigma, ref_edges, ref_points);
+        features(test_l, w, h, feature_sigma, test_edges, test_points);
+
+        // colors as the eye resolves them: lightness is seen more sharply than hue
+        double lightness_sigma = 0.0125 * pixels_per_degree, chroma_sigma = 0.025 * pixels_per_degree;
+        for (auto* p : { &ref_l, &test_l }) blur(*p, w, h, lightness_sigma);
+        for (auto* p : { &ref_a, &ref_b, &test_a, &test_b }) blur(*p, w, h, chroma_sigma);
+
+        const double qc = 0.7, pc = 0.4, pt = 0.95, qf = 0.5;
+        const double cmax = std::pow(hyab(lab(0,1,0), lab(0,0,1)), qc);
+
+        std::vector<float> error(size_t(w) * h);
+        for (size_t k = 0; k < error.size(); k++) {
+            double d = std::pow(hyab({ ref_l[k], ref_a[k], ref_b[k] }, { test_l[k], test_a[k], test_b[k] }), qc);
+            double color_error = d < pc * cmax ? pt / (pc * cmax) * d
+                                               : pt + (d - pc * cmax) / (cmax - pc * cmax) * (1 - pt);
+            double feature = std::max(std::fabs(ref_edges[k] - test_edges[k]),
+                                      std::fabs(ref_points[k] - test_points[k]));
+            double feature_error = std::pow(std::min(1.0, feature) / std::sqrt(2.0), qf);
+            error[k] = float(std::pow(std::min(1.0, color_error), 1 - feature_error));
+        }
+        return error;
+    }
+
+    double mean_error(const rgb_image& reference, const rgb_image& test) const {
+        auto error = errors(reference, test);
+        double sum = 0;
+        for (auto e : error) sum += e;
+        return error.empty() ? 0 : sum / error.size();
+    }
+
+  private:
+    using plane = std::vector<double>;
+    struct lab_color { double l, a, b; };
+
+    static double linear(uint8_t value) {
+        // sRGB transfer function, inverted
+        double c = value / 255.0;
+        return c <= 0.04045 ? c / 12.92 : std::pow((c + 0.055) / 1.055, 2.4);
+    }
+
+    static lab_color lab(double r, double g, double b) {
+        // Linear sRGB to CIELAB, D65 white
+        double x = (0.4124 * r + 0.3576 * g + 0.1805 * b) / 0.9505;
+        double y =  0.2126 * r + 0.7152 * g + 0.0722 * b;
+        double z = (0.0193 * r + 0.1192 * g + 0.9505 * b) / 1.0890;
+        auto f = [](double t) { return t > 0.008856 ? std::cbrt(t) : 7.787 * t + 16.0 / 116; };
+        return { 116 * f(y) - 16, 500 * (f(x) - f(y)), 200 * (f(y) - f(z)) };
+    }
+
+    static double hyab(const lab_color& p, const lab_color& q) {
+        return std::fabs(p.l - q.l) + std::sqrt((p.a - q.a) * (p.a - q.a) + (p.b - q.b) * (p.b - q.b));
+    }
+
+    static void to_lab(const rgb_image& image, plane& l, plane& a, plane& b) {
+        size_t count = size_t(image.width) * image.height;
+        l.resize(count);
+        a.resize(count);
+        b.resize(count);
+        for (size_t k = 0; k < count; k++) {
+            auto c = lab(linear(image.pixels[3*k]), linear(image.pixels[3*k + 1]), linear(image.pixels[3*k + 2]));
+            l[k] = c.l;
+            a[k] = c.a;
+            b[k] = c.b;
+        }
+    }
+
+    static void blur(plane& values, int w, int h, double sigma) {
+        // Separable Gaussian blur, edges clamped.
+        int radius = int(std::ceil(3 * sigma));
+        std::vector<double> kernel(2 * radius + 1);
+        double total = 0;
+        for (int k = -radius; k <= radius; k++)
+            total += kernel[k + radius] = std::exp(-k * k / (2 * sigma * sigma));
+        for (auto& weight : kernel) weight /= total;
+
+        plane pass(values.size());
+        for (int j = 0; j < h; j++)
+            for (int i = 0; i < w; i++) {
+                double sum = 0;
+                for (int k = -radius; k <= radius; k++)
+                    sum += kernel[k + radius] * values[size_t(j) * w + std::clamp(i + k, 0, w - 1)];
+                pass[size_t(j) * w + i] = sum;
+            }
+        for (int j = 0; j < h; j++)
+            for (int i = 0; i < w; i++) {
+                double sum = 0;
+                for (int k = -radius; k <= radius; k++)
+                    sum += kernel[k + radius] * pass[size_t(std::clamp(j + k, 0, h - 1)) * w + i];
+                values[size_t(j) * w + i] = sum;
+            }
+    }
+
+    static void features(const plane& lightness, int w, int h, double sigma, plane& edges, plane& points) {
+        // Edge (gradient) and point (Laplacian) strength of the lightness at the given scale,
+        // scaled so a full step from black to white gives about 1.
+        plane smooth(lightness.size());
+        for (size_t k = 0; k < smooth.size(); k++) smooth[k] = lightness[k] / 100;
+        blur(smooth, w, h, sigma);
+
+        edges.assign(smooth.size(), 0);
+        points.assign(smooth.size(), 0);
+        auto at = [&](int i, int j) { return smooth[size_t(std::clamp(j, 0, h - 1)) * w + std::clamp(i, 0, w - 1)]; };
+        double edge_scale = std::sqrt(2 * pi) * sigma, point_scale = 2 * pi * sigma * sigma / 4;
+        for (int j = 0; j < h; j++)
+            for (int i = 0; i < w; i++) {
+                double dx = (at(i + 1, j) - at(i - 1, j)) / 2, dy = (at(i, j + 1) - at(i, j - 1)) / 2;
+                double laplacian = at(i + 1, j) + at(i - 1, j) + at(i, j + 1) + at(i, j - 1) - 4 * at(i, j);
+                edges[size_t(j) * w + i]  = std::min(1.0, edge_scale * std::sqrt(dx * dx + dy * dy));
+                points[size_t(j) * w + i] = std::min(1.0, point_scale * std::fabs(laplacian));
+            }
+    }
+};
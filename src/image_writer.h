@@ -0,0 +1,160 @@
+#pragma once
+
+#include "rtweekend.h"
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <deque>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../ThirdParty/stb/stb_image_write.h"
+
+// The formats images can be written in, picked by the file name's extension. PNG is compressed
+// and slow to encode; the others are written as they are, for intermediate frames and tools:
+// PPM (8-bit binary RGB), PFM (linear float RGB, not tonemapped) and raw (the 8-bit pixels with
+// no header, row major from the top).
+enum class image_format { png, ppm, pfm, raw };
+
+inline image_format format_of(const std::string& filename) {
+    auto dot = filename.rfind('.');
+    auto extension = dot == std::string::npos ? std::string() : filename.substr(dot + 1);
+    for (auto& c : extension) c = char(std::tolower(c));
+    if (extension == "ppm") return image_format::ppm;
+    if (extension == "pfm") return image_format::pfm;
+    if (extension == "raw") return image_format::raw;
+    return image_format::png;
+}
+
+struct image_data {
+    // An image ready to be written: 8-bit pixels, or linear floats (RGB) for PFM.
+    int width = 0;
+    int height = 0;
+    int channels = 3;
+    std::vector<uint8_t> bytes;
+    std::vector<float>   floats;
+};
+
+class image_writer {
+  public:
+    // Writes images on background threads while the caller carries on. Up to max_in_flight
+    // files are encoded at once; submit() waits for the oldest when that many are in flight,
+    // and for an earlier write of the same file, so repeated writes of a file land in order.
+
+    int max_in_flight = 2;
+    int png_compression = 8;          // stb's zlib level for PNGs; it treats anything below 5 as 5
+    render_stats* stats = nullptr;    // Gets the time spent writing, if set
+
+    image_writer() {}
+    image_writer(const image_writer&) = delete;
+    image_writer& operator=(const image_writer&) = delete;
+
+    ~image_writer() { finish(); }
+
+    void submit(const std::string& filename, image_data image) {
+        for (auto it = in_flight.begin(); it != in_flight.end(); ++it)
+            if (it->filename == filename) {
+                it->thread.join();
+                in_flight.erase(it);
+                break;
+            }
+        while (int(in_flight.size()) >= std::max(1, max_in_flight)) {
+            in_flight.front().thread.join();
+            in_flight.pop_front();
+        }
+
+        // every running job has a slot, and a slot is only reused once its job is joined, so
+        // each slot's trace lane has one thread at a time
+        int slot = 0;
+        for (bool taken = true; taken; ) {
+            taken = false;
+            for (const auto& j : in_flight)
+                if (j.slot == slot) {
+                    taken = true;
+                    slot++;
+                    break;
+                }
+        }
+
+        if (stbi_write_png_compression_level != png_compression)
+            stbi_write_png_compression_level = png_compression;
+
+        in_flight.push_back({ std::thread([this, filename, slot, image = std::move(image)] {
+            auto start = std::chrono::steady_clock::now();
+            tracer().name_thread("image writer " + std::to_string(slot));
+            {
+                trace_span span(span_name(format_of(filename)), "output");
+                if (!write(filename, image))
+                    std::cerr << "ERROR: Could not write image '" << filename << "'.\n";
+            }
+            if (stats) {
+                std::lock_guard<std::mutex> lock(stats_mutex);
+                stats->seconds[int(phase::encode)]
+                    += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            }
+        }), filename, slot });
+    }
+
+    void finish() {
+        // Waits until every submitted image is on disk.
+        for (auto& j : in_flight)
+            j.thread.join();
+        in_flight.clear();
+    }
+
+    static bool write(const std::string& filename, const image_data& image) {
+        // Writes the image in the format of the file name, on the calling thread.
+        int w = image.width, h = image.height, n = image.channels;
+        auto format = format_of(filename);
+        if (format == image_format::png)
+            return stbi_write_png(filename.c_str(), w, h, n, image.bytes.data(), w * n) != 0;
+
+        FILE* file = std::fopen(filename.c_str(), "wb");
+        if (!file)
+            return false;
+
+        if (format == image_format::ppm) {
+            std::fprintf(file, "P6\n%d %d\n255\n", w, h);
+            if (n == 3) {
+                std::fwrite(image.bytes.data(), 1, image.bytes.size(), file);
+            } else {
+                for (size_t p = 0; p < size_t(w) * h; p++)
+                    std::fwrite(&image.bytes[p * n], 1, 3, file);
+            }
+        } else if (format == image_format::pfm) {
+            // little endian, bottom row first
+            std::fprintf(file, "PF\n%d %d\n-1.0\n", w, h);
+            for (int j = h - 1; j >= 0; j--)
+                std::fwrite(&image.floats[size_t(j) * w * 3], sizeof(float), size_t(w) * 3, file);
+        } else {
+            std::fwrite(image.bytes.data(), 1, image.bytes.size(), file);
+        }
+
+        bool ok = !std::ferror(file);
+        return std::fclose(file) == 0 && ok;
+    }
+
+  private:
+    struct job {
+        std::thread thread;
+        std::string filename;
+        int slot;
+    };
+
+    std::deque<job> in_flight;
+    std::mutex stats_mutex;
+
+    static const char* span_name(image_format format) {
+        switch (format) {
+            case image_format::ppm: return "ppm write";
+            case image_format::pfm: return "pfm write";
+            case image_format::raw: return "raw write";
+            default:                return "png write";
+        }
+    }
+};
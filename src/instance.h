@@ -0,0 +1,39 @@
+#pragma once
+
+#include "transform.h"
+
+class instance : public transform {
+  public:
+    // One placement of a shared object. The object, usually a bvh_node over a mesh or a group
+    // of primitives (the bottom level), is built once in its own coordinates, and any number of
+    // instances place it in the world with an affine transform. A bvh_node over the instances
+    // is then the top level: it sees each instance's tight world space box, and each copy only
+    // costs a transform, its inverse and a box.
+    //
+    // An instance can also replace the materials of the object. Alpha cutouts are tested
+    // during traversal, so they still come from the object's own materials.
+
+    instance(std::shared_ptr<hittable> object, const affine& to_world,
+             std::shared_ptr<material> mat = nullptr)
+      : transform(object, to_world), mat(mat)
+    {}
+
+    bool hit(const ray& r, interval ray_t, hit_record& rec, const vec3& camPos) const override {
+        if (!transform::hit(r, ray_t, rec, camPos))
+            return false;
+
+        if (mat)
+            rec.mat = mat;
+        return true;
+    }
+
+    void refit() override {
+        // The object is shared with other instances, so it is not refit from here.
+        bbox = world_from_object.bounds(object->bounding_box());
+    }
+
+    std::shared_ptr<material> get_material() const { return mat; }
+
+  private:
+    std::shared_ptr<material> mat;
+};
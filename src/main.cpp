@@ -1,557 +1,181 @@
 #include <iostream>
 #include <fstream>
 #include <sstream>
+#include <chrono>
+#include <filesystem>
 
 #include "rtweekend.h"
 
-#include "hittable.h"
-#include "hittable_list.h"
-#include "material.h"
-#include "sphere.h"
-#include "quad.h"
-#include "bvh.h"
-#include "texture.h"
+#include "scene_file.h"
+#include "scene_cache.h"
 
 #include "camera.h"
 
-enum scene {
-        bouncing_spheres,
-        checkered_spheres,
-        textured_sphere,
-        untextures_planes,
-        transparency_test,
-        mix_mat_test,
-        image_transparency_test,
-        simple_light,
-        cornell_box,
-        debug_cornell_box,
-        simple_shadows,
-        painterly,
-        outline_materials
-    };
+int main(int argc, char* argv[]) { 
 
-void bouncingSpheres() {
-   
-    hittable_list world;
-    
-    auto checker = std::make_shared<checker_texture>(0.32, color(.2, .3, .1), color(.9, .9, .9));
-    world.add(std::make_shared<sphere>(point3(0,-1000,0), 1000, std::make_shared<lambertian>(checker)));
+    std::string scene_name = "painterly";
+    std::string cache_file;
+    std::string stats_file;
+    std::string trace_file;
+    std::string render_override;
+    int width_override = 0;
 
-    for (int a = -11; a < 11; a++) {
-        for (int b = -11; b < 11; b++) {
-            auto choose_mat = random_double();
-            point3 center(a + 0.9*random_double(), 0.2, b + 0.9*random_double());
-
-            if ((center - point3(4, 0.2, 0)).length() > 0.9) {
-                std::shared_ptr<material> sphere_material;
-
-                if (choose_mat < 0.8) {
-                    // diffuse
-                    auto albedo = color::random() * color::random();
-                    sphere_material = std::make_shared<lambertian>(albedo);
-                    auto center2 = center + vec3(0, random_double(0,.5), 0);
-                    world.add(std::make_shared<sphere>(center, center2, 0.2, sphere_material));
-                } else if (choose_mat < 0.95) {
-                    // metal
-                    auto albedo = color::random(0.5, 1);
-                    auto fuzz = random_double(0, 0.5);
-                    sphere_material = std::make_shared<metal>(albedo, fuzz);
-                    world.add(std::make_shared<sphere>(center, 0.2, sphere_material));
-                } else {
-                    // glass
-                    sphere_material = std::make_shared<dielectric>(1.5);
-                    world.add(std::make_shared<sphere>(center, 0.2, sphere_material));
-                }
-            }
-        }
-    }
-
-    world = hittable_list(std::make_shared<bvh_node>(world));
-
-    auto material1 = std::make_shared<dielectric>(1.5);
-    world.add(std::make_shared<sphere>(point3(0, 1, 0), 1.0, material1));
-
-    auto material2 = std::make_shared<lambertian>(color(0.4, 0.2, 0.1));
-    world.add(std::make_shared<sphere>(point3(-4, 1, 0), 1.0, material2));
-
-    auto material3 = std::make_shared<metal>(color(0.7, 0.6, 0.5), 0.0);
-    world.add(std::make_shared<sphere>(point3(4, 1, 0), 1.0, material3));
-
-    camera cam;
-
-    cam.aspect_ratio      = 16.0 / 9.0;
-    cam.width             = 400;
-    cam.samples_per_pixel = 100;
-    cam.max_depth         = 50;
-    cam.background        = color(0.70, 0.80, 1.00);
-
-    cam.vfov     = 20;
-    cam.lookfrom = point3(13,2,3);
-    cam.lookat   = point3(0,0,0);
-    cam.vup      = vec3(0,1,0);
-
-    cam.defocus_angle = 0.6;
-    cam.focus_dist    = 10.0;
-
-    cam.render(world);
-}
-
-void checkeredSpheres() {
-    hittable_list world;
-
-    auto checker = std::make_shared<checker_texture>(0.32, color(.2, .3, .1), color(.9, .9, .9));
-
-    world.add(std::make_shared<sphere>(point3(0,-10, 0), 10, std::make_shared<lambertian>(checker)));
-    world.add(std::make_shared<sphere>(point3(0, 10, 0), 10, std::make_shared<lambertian>(checker)));
-
-    camera cam;
-
-    cam.aspect_ratio      = 16.0 / 9.0;
-    cam.width             = 400;
-    cam.samples_per_pixel = 100;
-    cam.max_depth         = 50;
-    cam.background        = color(0.70, 0.80, 1.00);
-
-    cam.vfov     = 20;
-    cam.lookfrom = point3(13,2,3);
-    cam.lookat   = point3(0,0,0);
-    cam.vup      = vec3(0,1,0);
-
-    cam.defocus_angle = 0;
-
-    cam.render(world);
-}
-
-void texturedSphere() {
-    auto sphere_texture = std::make_shared<image_texture>("images/ball3.png");
-    auto sphere_surface = std::make_shared<lambertian>(sphere_texture);
-    auto globe = std::make_shared<sphere>(point3(0,0,0), 2, sphere_surface);
-
-    camera cam;
-
-    cam.aspect_ratio      = 16.0 / 9.0;
-    cam.width             = 400;
-    cam.samples_per_pixel = 100;
-    cam.max_depth         = 50;
-    cam.background        = color(0.70, 0.80, 1.00);
-
-    cam.vfov     = 20;
-    cam.lookfrom = point3(0,0,12);
-    cam.lookat   = point3(0,0,0);
-    cam.vup      = vec3(0,1,0);
-
-    cam.defocus_angle = 0;
-
-    cam.render(hittable_list(globe));
-}
-
-void planes() {
-    hittable_list world;
-
-    // Materials
-    auto left_red     = std::make_shared<lambertian>(color(1.0, 0.2, 0.2));
-    auto back_green   = std::make_shared<lambertian>(color(0.2, 1.0, 0.2));
-    auto right_blue   = std::make_shared<lambertian>(color(0.2, 0.2, 1.0));
-    auto upper_orange = std::make_shared<lambertian>(color(1.0, 0.5, 0.0));
-    auto lower_teal   = std::make_shared<lambertian>(color(0.2, 0.8, 0.8));
-
-    // Quads
-    world.add(std::make_shared<quad>(point3(-3,-2, 5), vec3(0, 0,-4), vec3(0, 4, 0), left_red));
-    world.add(std::make_shared<quad>(point3(-2,-2, 0), vec3(4, 0, 0), vec3(0, 4, 0), back_green));
-    world.add(std::make_shared<quad>(point3( 3,-2, 1), vec3(0, 0, 4), vec3(0, 4, 0), right_blue));
-    world.add(std::make_shared<quad>(point3(-2, 3, 1), vec3(4, 0, 0), vec3(0, 0, 4), upper_orange));
-    world.add(std::make_shared<quad>(point3(-2,-3, 5), vec3(4, 0, 0), vec3(0, 0,-4), lower_teal));
-
-    camera cam;
-
-    cam.aspect_ratio      = 1.0;
-    cam.width             = 400;
-    cam.samples_per_pixel = 100;
-    cam.max_depth         = 50;
-    cam.background        = color(0.70, 0.80, 1.00);
-
-    cam.vfov     = 80;
-    cam.lookfrom = point3(0,0,9);
-    cam.lookat   = point3(0,0,0);
-    cam.vup      = vec3(0,1,0);
-
-    cam.defocus_angle = 0;
-
-    cam.render(world);
-}
-
-void transparency() {
-    hittable_list world;
-
-    auto checkerTex = std::make_shared<checker_texture>(0.32, color(.1), color(0.5));
-    world.add(std::make_shared<sphere>(point3(0,-1000,0), 1000, std::make_shared<lambertian>(checkerTex)));
-    world.add(std::make_shared<sphere>(point3(0,2,0), 2, std::make_shared<transparent>()));
-
-    camera cam;
-
-    cam.aspect_ratio      = 16.0 / 9.0;
-    cam.width             = 400;
-    cam.samples_per_pixel = 100;
-    cam.max_depth         = 50;
-    cam.background        = color(0.70, 0.80, 1.00);
-
-    cam.vfov     = 20;
-    cam.lookfrom = point3(13,2,3);
-    cam.lookat   = point3(0,0,0);
-    cam.vup      = vec3(0,1,0);
-
-    cam.defocus_angle = 0;
-
-    cam.render(world);
-}
-
-void mixMaterial(){
-    hittable_list world;
-
-    auto matA = std::make_shared<lambertian>(color(0, 1, 1));
-    auto matB = std::make_shared<lambertian>(color(1, 0, 1));
-
-    auto mixMat = std::make_shared<mix>(matA, matB, 0.5);
-    
-    auto checkerTex = std::make_shared<checker_texture>(0.32, color(.1), color(0.5));
-    world.add(std::make_shared<sphere>(point3(0,-1000,0), 1000, std::make_shared<lambertian>(checkerTex)));
-    world.add(std::make_shared<sphere>(point3(0,2,0), 2, mixMat));
-
-    camera cam;
-
-    cam.aspect_ratio      = 16.0 / 9.0;
-    cam.width             = 400;
-    cam.samples_per_pixel = 100;
-    cam.max_depth         = 50;
-    cam.background        = color(0.70, 0.80, 1.00);
-
-    cam.vfov     = 20;
-    cam.lookfrom = point3(13,2,3);
-    cam.lookat   = point3(0,0,0);
-    cam.vup      = vec3(0,1,0);
-
-    cam.defocus_angle = 0;
-
-    cam.render(world);
-}
-
-void imageTransparencyMapping(){
-    hittable_list world;
-
-    auto imageTex   = std::make_shared<image_texture>("images/brush.png");
-
-    auto checkerTex = std::make_shared<checker_texture>(0.32, color(.1), color(0.5));
-    auto mixedTex   = std::make_shared<textureMix>(std::make_shared<transparent>(), std::make_shared<lambertian>(color(0.8, 0.7, 1)), imageTex);
-
-    world.add(std::make_shared<sphere>(point3(0,-1000,0), 1000, std::make_shared<lambertian>(checkerTex)));
-    world.add(std::make_shared<sphere>(point3(0,2,0), 2, std::make_shared<lambertian>(color(0, 1, 1))));
-    world.add(std::make_shared<quad>(point3( 3,0, 1), vec3(0, 0, 2), vec3(0, 2, 0), mixedTex));
-
-    camera cam;
-
-    cam.aspect_ratio      = 16.0 / 9.0;
-    cam.width             = 400;
-    cam.samples_per_pixel = 100;
-    cam.max_depth         = 50;
-    cam.background        = color(0.70, 0.80, 1.00);
-
-    cam.vfov     = 20;
-    cam.lookfrom = point3(13,2,3);
-    cam.lookat   = point3(0,0,0);
-    cam.vup      = vec3(0,1,0);
-
-    cam.defocus_angle = 0;
-
-    cam.render(world);
-}
-
-void simpleLight() {
-    hittable_list world;
-
-    world.add(std::make_shared<sphere>(point3(0,-1000,0), 1000, std::make_shared<lambertian>(color(1))));
-    world.add(std::make_shared<sphere>(point3(0,2,0), 2, std::make_shared<lambertian>(color(1))));
-
-    auto difflight = std::make_shared<diffuse_light>(color(4,4,4));
-    world.add(std::make_shared<quad>(point3(3,1,-2), vec3(2,0,0), vec3(0,2,0), difflight));
 
     camera cam;
 
-    cam.aspect_ratio      = 16.0 / 9.0;
-    cam.width             = 400;
-    cam.samples_per_pixel = 100;
-    cam.max_depth         = 50;
-    cam.background        = color(0,0,0);
+    //rendering options, see camera.h
+    for (int a = 1; a < argc; a++) {
+        std::string arg = argv[a];
 
-    cam.vfov     = 20;
-    cam.lookfrom = point3(26,3,6);
-    cam.lookat   = point3(0,2,0);
-    cam.vup      = vec3(0,1,0);
-
-    cam.defocus_angle = 0;
-
-    cam.render(world);
-}
-
-void cornellBox() {
-    hittable_list world;
-
-    auto red   = std::make_shared<lambertian>(color(.65, .05, .05));
-    auto white = std::make_shared<lambertian>(color(.73, .73, .73));
-    auto green = std::make_shared<lambertian>(color(.12, .45, .15));
-    auto light = std::make_shared<diffuse_light>(color(15, 15, 15));
-
-    auto mirror = std::make_shared<metal>(color(1), 0);
-
-    world.add(std::make_shared<quad>(point3(555,0,0), vec3(0,555,0), vec3(0,0,555), green));
-    world.add(std::make_shared<quad>(point3(0,0,0), vec3(0,555,0), vec3(0,0,555), red));
-    world.add(std::make_shared<quad>(point3(343, 554, 332), vec3(-130,0,0), vec3(0,0,-105), light));
-    world.add(std::make_shared<quad>(point3(0,0,0), vec3(555,0,0), vec3(0,0,555), white));
-    world.add(std::make_shared<quad>(point3(555,555,555), vec3(-555,0,0), vec3(0,0,-555), white));
-    world.add(std::make_shared<quad>(point3(0,0,555), vec3(555,0,0), vec3(0,555,0), white));
-
-    world.add(std::make_shared<sphere>(point3(130, 50, 65), 50, white));
-
-    std::shared_ptr<hittable> box1 = box(point3(0,0,0), point3(165,330,165), mirror);
-    box1 = std::make_shared<rotate_y>(box1, 15);
-    box1 = std::make_shared<translate>(box1, vec3(265,0,295));
-    world.add(box1);
-
-    std::shared_ptr<hittable> box2 = box(point3(0,0,0), point3(165,165,165), white);
-    box2 = std::make_shared<rotate_y>(box2, -18);
-    box2 = std::make_shared<translate>(box2, vec3(130,0,65));
-    world.add(box2);
-
-    camera cam;
-
-    cam.aspect_ratio      = 1.0;
-    cam.width             = 300;
-    cam.samples_per_pixel = 200;
-    cam.max_depth         = 50;
-    cam.background        = color(0,0,0);
-
-    cam.vfov     = 40;
-    cam.lookfrom = point3(278, 278, -800);
-    cam.lookat   = point3(278, 278, 0);
-    cam.vup      = vec3(0,1,0);
-
-    cam.defocus_angle = 0;
-
-    //cam.render(world);
-    //cam.render_buffer(world);
-
-    cam.render_outline_buffer(world);
-}
-
-void debug_cornellBox() {
-    hittable_list world;
-
-    auto normals = std::make_shared<normalMat>();
-
-    world.add(std::make_shared<quad>(point3(555,0,0), vec3(0,555,0), vec3(0,0,555), normals));
-    world.add(std::make_shared<quad>(point3(0,0,0), vec3(0,555,0), vec3(0,0,555), normals));
-    world.add(std::make_shared<quad>(point3(343, 554, 332), vec3(-130,0,0), vec3(0,0,-105), normals));
-    world.add(std::make_shared<quad>(point3(0,0,0), vec3(555,0,0), vec3(0,0,555), normals));
-    world.add(std::make_shared<quad>(point3(555,555,555), vec3(-555,0,0), vec3(0,0,-555), normals));
-    world.add(std::make_shared<quad>(point3(0,0,555), vec3(555,0,0), vec3(0,555,0), normals));
-
-    world.add(std::make_shared<sphere>(point3(130, 50, 65), 50, normals));
- 
-    std::shared_ptr<hittable> box1 = box(point3(0,0,0), point3(165,330,165), normals);
-    box1 = std::make_shared<rotate_y>(box1, 15);
-    box1 = std::make_shared<translate>(box1, vec3(265,0,295));
-    world.add(box1);
-
-    std::shared_ptr<hittable> box2 = box(point3(0,0,0), point3(165,165,165), normals);
-    box2 = std::make_shared<rotate_y>(box2, -18);
-    box2 = std::make_shared<translate>(box2, vec3(130,0,65));
-    world.add(box2);
-
-    camera cam;
-
-    cam.aspect_ratio      = 1.0;
-    cam.width             = 300;
-    cam.samples_per_pixel = 200;
-    cam.max_depth         = 50;
-    cam.background        = color(0.1,0.1,0.1);
-
-    cam.vfov     = 40;
-    cam.lookfrom = point3(278, 278, -800);
-    cam.lookat   = point3(278, 278, 0);
-    cam.vup      = vec3(0,1,0);
-
-    cam.defocus_angle = 0;
-
-    cam.render_buffer(world);
-    //cam.render(world);
-}
-
-void simple_shadow_example() {
-    hittable_list world;
-
-    auto red   = std::make_shared<lambertian>(color(.65, .05, .05));
-    auto white = std::make_shared<lambertian>(color(.73, .73, .73));
-    auto green = std::make_shared<lambertian>(color(.12, .45, .15));
-    auto light = std::make_shared<diffuse_light>(color(15, 15, 15));
-
-    auto cel   = std::make_shared<fakeShadows>(color(0, .5, .5), point3(343, 554, 332));
-
-    world.add(std::make_shared<quad>(point3(555,0,0), vec3(0,555,0), vec3(0,0,555), green));
-    world.add(std::make_shared<quad>(point3(0,0,0), vec3(0,555,0), vec3(0,0,555), red));
-    world.add(std::make_shared<quad>(point3(343, 554, 332), vec3(-130,0,0), vec3(0,0,-105), light));
-    world.add(std::make_shared<quad>(point3(0,0,0), vec3(555,0,0), vec3(0,0,555), white));
-    world.add(std::make_shared<quad>(point3(555,555,555), vec3(-555,0,0), vec3(0,0,-555), white));
-    world.add(std::make_shared<quad>(point3(0,0,555), vec3(555,0,0), vec3(0,555,0), white));
-
-    world.add(std::make_shared<sphere>(point3(278, 278, 400), 70, cel)); 
-
-    camera cam;
-
-    cam.aspect_ratio      = 1.0;
-    cam.width             = 300;
-    cam.samples_per_pixel = 200;
-    cam.max_depth         = 50;
-    cam.background        = color(0,0,0);
-
-    cam.vfov     = 40;
-    cam.lookfrom = point3(278, 278, -800);
-    cam.lookat   = point3(278, 278, 0);
-    cam.vup      = vec3(0,1,0);
-
-    cam.defocus_angle = 0;
-
-    cam.render(world);
-    //cam.render_buffer(world);
-
-    //cam.render_outline_buffer(world);
-}
-
-void painterly_scene() {
-    hittable_list world;
-
-    auto red   = std::make_shared<lambertian>(color(.65, .05, .05));
-    auto white = std::make_shared<lambertian>(color(.73, .73, .73));
-    auto green = std::make_shared<lambertian>(color(.12, .45, .15));
-    auto light = std::make_shared<diffuse_light>(color(15, 15, 15));
-    auto mirror = std::make_shared<metal>(color(0.8, 0.85, 0.88), 0.0);
-    auto glass = std::make_shared<dielectric>(1.5); 
-    
-    world.add(std::make_shared<sphere>(point3(278, 278, 400), 70, white));
-
-    camera cam;
-    
-    cam.aspect_ratio      = 1.0;
-    cam.width             = 300;
-    cam.samples_per_pixel = 200;
-    cam.max_depth         = 50;
-    cam.background        = color(0.2,0.2,0.2);
-    
-    cam.vfov     = 40;
-    cam.lookfrom = point3(278, 278, -800);
-    cam.lookat   = point3(278, 278, 0);
-    cam.vup      = vec3(0, 1, 0);
-    
-    cam.defocus_angle = 0;
-    
-    hittable_list finalScene;
-    //populate the scene with quads
-    for(int i = 0; i < 1000; i++){
-        ray r = ray(cam.lookfrom, random_unit_vector());
-        hit_record rec;
-        if(!world.hit(r, interval(0.001, infinity), rec, cam.lookfrom))
-        {
-            i--;
+        if (arg == "--resume") {
+            cam.resume = true;
             continue;
         }
 
-        vec3 u = vec3(-1, 0, 0);
-        vec3 v = vec3(0, 1, 0);
-
-        //vec3 u = vec3(-rec.normal.x(),  rec.normal.y(), rec.normal.z());
-        //vec3 v = cross(rec.normal, u);
-        auto imageTex   = std::make_shared<image_texture>("images/brush.png");
-        auto mixedTex   = std::make_shared<textureMix>(std::make_shared<transparent>(), std::make_shared<unlit>(color(random_double(), random_double(), random_double())), imageTex);
+        if (arg == "--denoise") {
+            cam.denoise = true;
+            continue;
+        }
 
-        auto brushStroke = std::make_shared<quad>(rec.p - (u * 50) - (v * 50), u * 100, v * 100, mixedTex);
-        finalScene.add(brushStroke);
+        if (a + 1 >= argc) {
+            std::cerr << "Missing value for option '" << arg << "'\n";
+            return 1;
+        }
+        std::string value = argv[++a];
+
+        if      (arg == "--scene")               scene_name              = value;
+        else if (arg == "--output")              cam.output_file         = value;
+        else if (arg == "--threads")             cam.threads             = std::stoi(value);
+        else if (arg == "--width")               width_override          = std::stoi(value);
+        else if (arg == "--render")              render_override         = value;
+        else if (arg == "--seed")                cam.seed                = std::stoull(value);
+        else if (arg == "--pass")                cam.pass_samples        = std::stoi(value);
+        else if (arg == "--spp")                 cam.sample_budget       = std::stoi(value);
+        else if (arg == "--time-budget")         cam.time_budget         = std::stod(value);
+        else if (arg == "--target")              cam.target_error        = std::stod(value);
+        else if (arg == "--flush")               cam.flush_interval      = std::stod(value);
+        else if (arg == "--checkpoint")          cam.checkpoint_file     = value;
+        else if (arg == "--checkpoint-interval") cam.checkpoint_interval = std::stod(value);
+        else if (arg == "--coordinator")         cam.coordinator_port    = std::stoi(value);
+        else if (arg == "--worker")              cam.coordinator_address = value;
+        else if (arg == "--tile")                cam.tile_size           = std::stoi(value);
+        else if (arg == "--light-sampling")      cam.sample_lights       = value != "off";
+        else if (arg == "--convergence")         cam.convergence_spp     = std::stoi(value);
+        else if (arg == "--frames")              cam.anim.frames         = std::stoi(value);
+        else if (arg == "--fps")                 cam.anim.frame_rate     = std::stod(value);
+        else if (arg == "--frame-pattern")       cam.anim.output_pattern = value;
+        else if (arg == "--cache")               cache_file              = value;
+        else if (arg == "--stats")               stats_file              = value;
+        else if (arg == "--trace")               trace_file              = value;
+        else if (arg == "--png-compression")     cam.writer.png_compression = std::stoi(value);
+        else if (arg == "--writers")             cam.writer.max_in_flight   = std::stoi(value);
+        else if (arg == "--cost") {
+            if      (value == "time")  cam.cost = cost_metric::time;
+            else if (value == "steps") cam.cost = cost_metric::steps;
+            else {
+                std::cerr << "Unknown cost metric '" << value << "'\n";
+                return 1;
+            }
+        }
+        else if (arg == "--sampler") {
+            if      (value == "independent") cam.sampling = sampler_type::independent;
+            else if (value == "stratified")  cam.sampling = sampler_type::stratified;
+            else if (value == "sobol")       cam.sampling = sampler_type::sobol;
+            else if (value == "bluenoise")   cam.sampling = sampler_type::blue_noise;
+            else {
+                std::cerr << "Unknown sampler '" << value << "'\n";
+                return 1;
+            }
+        }
+        else {
+            std::cerr << "Unknown option '" << arg << "'\n";
+            return 1;
+        }
     }
-    
-    // Cornell box sides
-    finalScene.add(std::make_shared<quad>(point3(555,0,0), vec3(0,0,555), vec3(0,555,0), green));
-    finalScene.add(std::make_shared<quad>(point3(0,0,555), vec3(0,0,-555), vec3(0,555,0), red));
-    finalScene.add(std::make_shared<quad>(point3(0,555,0), vec3(555,0,0), vec3(0,0,555), white));
-    finalScene.add(std::make_shared<quad>(point3(0,0,555), vec3(555,0,0), vec3(0,0,-555), white));
-    finalScene.add(std::make_shared<quad>(point3(555,0,555), vec3(-555,0,0), vec3(0,555,0), white));
-
-    finalScene.add(std::make_shared<quad>(point3(213,554,227), vec3(130,0,0), vec3(0,0,105), light));
 
-    cam.render(finalScene);
-}
-
-void outlines_and_materials(){
-    hittable_list world;
-
-    auto red   = std::make_shared<lambertian>(color(.65, .05, .05));
-    auto white = std::make_shared<lambertian>(color(.73, .73, .73));
-    auto green = std::make_shared<lambertian>(color(.12, .45, .15));
-    auto light = std::make_shared<diffuse_light>(color(15, 15, 15));
-
-    auto mirror = std::make_shared<metal>(color(1), 0);
-
-    world.add(std::make_shared<quad>(point3(555,0,0), vec3(0,555,0), vec3(0,0,555), green));
-    world.add(std::make_shared<quad>(point3(0,0,0), vec3(0,555,0), vec3(0,0,555), red));
-    world.add(std::make_shared<quad>(point3(343, 554, 332), vec3(-130,0,0), vec3(0,0,-105), light));
-    world.add(std::make_shared<quad>(point3(0,0,0), vec3(555,0,0), vec3(0,0,555), white));
-    world.add(std::make_shared<quad>(point3(555,555,555), vec3(-555,0,0), vec3(0,0,-555), white));
-    world.add(std::make_shared<quad>(point3(0,0,555), vec3(555,0,0), vec3(0,555,0), white));
+    std::string first_frame;
+    if (!animation::format_frame(cam.anim.output_pattern, 0, first_frame)) {
+        std::cerr << "ERROR: The frame pattern '" << cam.anim.output_pattern
+                  << "' needs exactly one %d or %0Nd for the frame number (and %% for a percent sign).\n";
+        return 1;
+    }
 
-    world.add(std::make_shared<sphere>(point3(130, 50, 65), 50, white));
+    //--trace records a timeline of every thread's work (see trace.h)
+    if (!trace_file.empty()) {
+        tracer().start();
+        tracer().name_thread("main");
+    }
 
-    std::shared_ptr<hittable> box1 = box(point3(0,0,0), point3(165,330,165), mirror);
-    box1 = std::make_shared<rotate_y>(box1, 15);
-    box1 = std::make_shared<translate>(box1, vec3(265,0,295));
-    world.add(box1);
+    //scenes are files, see scene_file.h; --scene takes a file or the name of one in scenes/
+    auto scene_path = scene_file::find(scene_name);
+    if (scene_path.empty()) {
+        std::cerr << "ERROR: Could not find scene '" << scene_name << "'.\n";
+        return 1;
+    }
 
-    std::shared_ptr<hittable> box2 = box(point3(0,0,0), point3(165,165,165), white);
-    box2 = std::make_shared<rotate_y>(box2, -18);
-    box2 = std::make_shared<translate>(box2, vec3(130,0,65));
-    world.add(box2);
+    //with --cache, a scene cached by an earlier run is mapped in instead of parsed and built, and a
+    //scene that does get built is cached for the next run (see scene_cache.h). The cache is made
+    //for one version of the scene file and of the mesh files it loads. It holds no keyframes, so animations are never cached and
+    //an animated render (--frames) always builds the scene.
+    auto scene_start = std::chrono::steady_clock::now();
+    auto cache_key = scene_path + ":" + scene_cache::file_stamp(scene_path);
+    std::vector<std::string> sources;
+    std::shared_ptr<hittable> world;
+    render_mode mode = render_mode::image;
+
+    if (!cache_file.empty() && cam.anim.frames > 1) {
+        std::clog << "Animated renders don't use the scene cache\n";
+        cache_file.clear();
+    }
 
-    camera cam;
+    if (!cache_file.empty()) {
+        trace_span span("scene cache load", "scene");
+        world = scene_cache::load(cache_file, cache_key, cam, mode);
+        if (world) {
+            auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - scene_start).count();
+            std::clog << "Scene loaded from '" << cache_file << "' in " << seconds << "s\n";
+            cam.stats.seconds[int(phase::scene)] += seconds;
+        }
+    }
 
-    cam.aspect_ratio      = 1.0;
-    cam.width             = 600;
-    cam.samples_per_pixel = 600;
-    cam.max_depth         = 50;
-    cam.background        = color(0,0,0);
+    if (!world) {
+        world = scene_file::load(scene_path, cam, mode, &sources);
+        if (!world)
+            return 1;
 
-    cam.vfov     = 40;
-    cam.lookfrom = point3(278, 278, -800);
-    cam.lookat   = point3(278, 278, 0);
-    cam.vup      = vec3(0,1,0);
+        if (!cache_file.empty()) {
+            if (cam.anim.animated())
+                std::clog << "Animated scenes are not cached\n";
+            else if (scene_cache::save(cache_file, cache_key, *world, cam, mode, sources))
+                std::clog << "Scene cached in '" << cache_file << "'\n";
+        }
+    }
 
-    cam.defocus_angle = 0;
+    //--width and --render override what the scene asks for, so benchmarks can fix them
+    if (width_override > 0)
+        cam.width = width_override;
+    if (!render_override.empty()) {
+        if      (render_override == "image")          mode = render_mode::image;
+        else if (render_override == "image+outlines") mode = render_mode::image_outlines;
+        else if (render_override == "normals")        mode = render_mode::normals;
+        else if (render_override == "outlines")       mode = render_mode::outlines;
+        else {
+            std::cerr << "Unknown render mode '" << render_override << "'\n";
+            return 1;
+        }
+    }
 
-    cam.render(world, true);
-}
+    cam.render(*world, mode);
 
-int main() { 
+    //--stats writes counters and phase times of the render as JSON (see render_stats.h)
+    if (!stats_file.empty())
+        cam.write_stats(stats_file, scene_path);
 
-    switch (painterly) {
-        case bouncing_spheres        : bouncingSpheres();          break;
-        case checkered_spheres       : checkeredSpheres();         break;
-        case textured_sphere         : texturedSphere();           break;
-        case untextures_planes       : planes();                   break;
-        case transparency_test       : transparency();             break;
-        case mix_mat_test            : mixMaterial();              break;
-        case image_transparency_test : imageTransparencyMapping(); break;
-        case simple_light            : simpleLight();              break;
-        case cornell_box             : cornellBox();               break;
-        case debug_cornell_box       : debug_cornellBox();         break;
-        case simple_shadows          : simple_shadow_example();    break;
-        case painterly               : painterly_scene();          break;
-        case outline_materials       : outlines_and_materials();   break;
+    if (!trace_file.empty()) {
+        cam.finish_writes();
+        tracer().write(trace_file);
     }
-    
+
     return 0;
 
-}
\ No newline at end of file
+}
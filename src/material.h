@@ -1,10 +1,19 @@
 #pragma once
 
 #include "hittable.h"
+#include "onb.h"
 #include "texture.h"
 
 #include <algorithm>
 
+class scatter_record {
+  public:
+    color  attenuation;  // Path throughput weight of the sample: BSDF * cosine / pdf
+    ray    scattered;
+    double pdf;          // Solid angle density of `scattered` (0 for specular samples)
+    bool   is_specular;  // True if the direction can't be evaluated by eval() / scattering_pdf()
+};
+
 class material {
     public:
     virtual ~material() = default;
@@ -13,6 +22,20 @@ class material {
       return false;
     }
 
+    virtual bool scatter(const ray& r_in, const hit_record& rec, scatter_record& srec) const {
+      // Samples a scattered direction and reports its density. Materials that only implement
+      // the attenuation/ray form are treated as specular: their sample is followed as is, and
+      // nothing is combined with it.
+      srec.pdf = 0;
+      srec.is_specular = true;
+      return scatter(r_in, rec, srec.attenuation, srec.scattered);
+    }
+
+    virtual color eval(const ray& r_in, const hit_record& rec, const ray& scattered) const {
+      // BSDF times cosine for an arbitrary direction, excluding specular lobes.
+      return color(0,0,0);
+    }
+
     virtual color emitted(double u, double v, const point3& p) const {
         return color(0,0,0);
     }
@@ -24,6 +47,32 @@ class material {
     virtual bool scatter_normal(const ray& r_in, const hit_record& rec, color& normals, ray& scattered) const {
       return false;
     }
+
+    virtual bool is_emissive() const {
+      return false;
+    }
+
+    virtual double scattering_pdf(const ray& r_in, const hit_record& rec, const ray& scattered) const {
+      // Solid angle density with which scatter() picks the `scattered` direction, excluding
+      // specular lobes.
+      return 0;
+    }
+
+    virtual bool shade(const ray& r_in, const hit_record& rec, const hittable& world, color& color) const {
+      // rgb() with access to the scene, for unlit materials that need visibility queries.
+      return rgb(r_in, rec, color);
+    }
+
+    virtual bool alpha_cutout(double u, double v, const point3& p) const {
+      // Returns true if the surface is masked out at this point. Primitives ask this during
+      // traversal, so a masked-out hit is skipped like a miss instead of spawning a new ray.
+      return false;
+    }
+
+    virtual bool has_alpha_cutout() const {
+      // Whether alpha_cutout() can ever return true, so visibility queries can skip the test.
+      return false;
+    }
 };
 
 class lambertian : public material {
@@ -33,17 +82,35 @@ class lambertian : public material {
 
     bool scatter(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered)
     const override {
-        auto scatter_direction = rec.normal + random_unit_vector();
-        
-        // Catch degenerate scatter direction
-        if (scatter_direction.near_zero()) {
-            scatter_direction = rec.normal;
-        }
-        
-        scattered = ray(rec.p, scatter_direction, r_in.time());
-        attenuation = tex->value(rec.u, rec.v, rec.p);
+        scatter_record srec;
+        scatter(r_in, rec, srec);
+        attenuation = srec.attenuation;
+        scattered = srec.scattered;
         return true;
     } 
+
+    bool scatter(const ray& r_in, const hit_record& rec, scatter_record& srec) const override {
+        // Cosine-weighted sampling, so the cosine / pi of the BRDF cancels against the pdf.
+        onb uvw(rec.normal);
+        auto s = sample_2d();
+        auto scatter_direction = uvw.transform(random_cosine_direction(s.x(), s.y()));
+
+        srec.scattered = ray(rec.p, scatter_direction, r_in.time());
+        srec.attenuation = tex->value(rec.u, rec.v, rec.p);
+        srec.pdf = scattering_pdf(r_in, rec, srec.scattered);
+        srec.is_specular = false;
+        return true;
+    }
+
+    color eval(const ray& r_in, const hit_record& rec, const ray& scattered) const override {
+        return tex->value(rec.u, rec.v, rec.p) * scattering_pdf(r_in, rec, scattered);
+    }
+
+    double scattering_pdf(const ray& r_in, const hit_record& rec, const ray& scattered)
+    const override {
+        auto cos_theta = dot(rec.normal, unit_vector(scattered.direction()));
+        return cos_theta < 0 ? 0 : cos_theta/pi;
+    }
     
     bool scatter_normal(const ray& r_in, const hit_record& rec, color& normals, ray& scattered) const override 
     {
@@ -51,6 +118,8 @@ class lambertian : public material {
       return true;
     }
 
+    std::shared_ptr<texture> get_texture() const { return tex; }
+
   private:
     std::shared_ptr<texture> tex;
     color albedo;
@@ -62,13 +131,22 @@ class metal : public material {
 
     bool scatter(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered)
     const override {
+        auto s = sample_2d();
         vec3 reflected = reflect(r_in.direction(), rec.normal);
-        reflected = unit_vector(reflected) + (fuzz * random_unit_vector());
+        reflected = unit_vector(reflected) + (fuzz * random_unit_vector(s.x(), s.y()));
         scattered = ray(rec.p, reflected, r_in.time());
         attenuation = albedo;
         return (dot(scattered.direction(), rec.normal) > 0);
     }
 
+    bool scatter(const ray& r_in, const hit_record& rec, scatter_record& srec) const override {
+        // The fuzzed reflection has no closed-form density, so metal is handled as specular
+        // even when fuzz > 0.
+        srec.pdf = 0;
+        srec.is_specular = true;
+        return scatter(r_in, rec, srec.attenuation, srec.scattered);
+    }
+
 
     bool scatter_normal(const ray& r_in, const hit_record& rec, color& normals, ray& scattered) const override 
     {
@@ -79,6 +157,9 @@ class metal : public material {
         return (dot(scattered.direction(), rec.normal) > 0);
     }
 
+    color get_albedo() const { return albedo; }
+    double get_fuzz() const { return fuzz; }
+
   private:
     color albedo;
     double fuzz;
@@ -101,7 +182,7 @@ class dielectric : public material {
         bool cannot_refract = ri * sin_theta > 1.0;
         vec3 direction;
 
-        if (cannot_refract || reflectance(cos_theta, ri) > random_double())
+        if (cannot_refract || reflectance(cos_theta, ri) > sample_1d())
             direction = reflect(unit_direction, rec.normal);
         else
             direction = refract(unit_direction, rec.normal, ri);
@@ -111,6 +192,15 @@ class dielectric : public material {
         return true;
     }
 
+    bool scatter(const ray& r_in, const hit_record& rec, scatter_record& srec) const override {
+        // Reflection and refraction are both delta lobes.
+        srec.pdf = 0;
+        srec.is_specular = true;
+        return scatter(r_in, rec, srec.attenuation, srec.scattered);
+    }
+
+    double get_refraction_index() const { return refraction_index; }
+
   private:
     // Refractive index in vacuum or air, or the ratio of the material's refractive index over
     // the refractive index of the enclosing media
@@ -133,12 +223,18 @@ class diffuse_light : public material {
         return tex->value(u, v, p);
     }
 
+    bool is_emissive() const override {
+        return true;
+    }
+
     bool scatter_normal(const ray& r_in, const hit_record& rec, color& normals, ray& scattered) const override 
     {
       normals = rec.normal;
       return true;
     }
 
+    std::shared_ptr<texture> get_texture() const { return tex; }
+
   private:
     std::shared_ptr<texture> tex;
 };
@@ -148,13 +244,40 @@ class mix : public material {
   mix(std::shared_ptr<material> a, std::shared_ptr<material> b, double val) : v(std::clamp(val, 0.0, 1.0)), matA(a), matB(b){}
 
   bool scatter(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered) const override { 
-    if(random_double() > v){
+    if(sample_1d() > v){
       return matA->scatter(r_in, rec, attenuation, scattered);
     } else {
       return matB->scatter(r_in, rec, attenuation, scattered);
     }
   }
 
+  bool scatter(const ray& r_in, const hit_record& rec, scatter_record& srec) const override {
+    //sample one of the two materials, then weigh a non-specular direction by the density of the
+    //whole mixture, so both materials' lobes count for it
+    bool sampled = sample_1d() > v ? matA->scatter(r_in, rec, srec) : matB->scatter(r_in, rec, srec);
+    if(!sampled || srec.is_specular)
+      return sampled;
+
+    srec.pdf = scattering_pdf(r_in, rec, srec.scattered);
+    if(srec.pdf <= 0)
+      return false;
+
+    srec.attenuation = eval(r_in, rec, srec.scattered) / srec.pdf;
+    return true;
+  }
+
+  color eval(const ray& r_in, const hit_record& rec, const ray& scattered) const override {
+    return (1 - v) * matA->eval(r_in, rec, scattered) + v * matB->eval(r_in, rec, scattered);
+  }
+
+  double scattering_pdf(const ray& r_in, const hit_record& rec, const ray& scattered) const override {
+    return (1 - v) * matA->scattering_pdf(r_in, rec, scattered) + v * matB->scattering_pdf(r_in, rec, scattered);
+  }
+
+  std::shared_ptr<material> get_material_a() const { return matA; }
+  std::shared_ptr<material> get_material_b() const { return matB; }
+  double get_mix() const { return v; }
+
   private:
   double v;
   std::shared_ptr<material> matA;
@@ -169,13 +292,32 @@ class textureMix : public material {
   textureMix(std::shared_ptr<material> a, std::shared_ptr<material> b, std::shared_ptr<image_texture> texture) : tex(texture), matA(a), matB(b){}
 
   bool scatter(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered) const override { 
-    if(random_double() > tex->alpha(rec.u, rec.v, rec.p)){
+    //if matA is a cutout the alpha test already ran during traversal, so any hit that reaches
+    //here landed on the opaque side of the mask
+    if(matA->alpha_cutout(rec.u, rec.v, rec.p))
+      return matB->scatter(r_in, rec, attenuation, scattered);
+
+    if(sample_1d() > tex->alpha(rec.u, rec.v, rec.p)){
       return matA->scatter(r_in, rec, attenuation, scattered);
     } else {
       return matB->scatter(r_in, rec, attenuation, scattered);
     }
   }
 
+  bool alpha_cutout(double u, double v, const point3& p) const override {
+    //same stochastic choice as scatter, but made before a ray is spawned.
+    //matA's cutout has to be deterministic for the two to agree
+    return matA->alpha_cutout(u, v, p) && random_double() > tex->alpha(u, v, p);
+  }
+
+  bool has_alpha_cutout() const override {
+    return matA->has_alpha_cutout();
+  }
+
+  std::shared_ptr<material> get_material_a() const { return matA; }
+  std::shared_ptr<material> get_material_b() const { return matB; }
+  std::shared_ptr<image_texture> get_texture() const { return tex; }
+
   private:
   std::shared_ptr<material> matA;
   std::shared_ptr<material> matB;
@@ -192,6 +334,15 @@ class transparent : public material {
 
     return true;
   }
+
+  //fully see-through, so primitives can skip it during traversal
+  bool alpha_cutout(double u, double v, const point3& p) const override {
+    return true;
+  }
+
+  bool has_alpha_cutout() const override {
+    return true;
+  }
 };
 
 class unlit : public material {
@@ -211,6 +362,8 @@ class unlit : public material {
     return true;
   }
 
+  color get_albedo() const { return albedo; }
+
   private:
   color albedo;
 };
@@ -229,9 +382,9 @@ class depthMat : public material {
   public:
   depthMat(){}
   bool rgb(const ray& r_in, const hit_record& rec, color& color) const override {
-    //double z = (2.0 * near * far) / (far + near - (z * 2.0 - 1.0) * (far - near));
-    double z = slope * (rec.z - near);
-    //z = (1/z - 1/near)/(1/far - 1/near); //attempt non linear depth later on
+    //double z = (2.0 * near_plane * far_plane) / (far_plane + near_plane - (z * 2.0 - 1.0) * (far_plane - near_plane));
+    double z = slope * (rec.z - near_plane);
+    //z = (1/z - 1/near_plane)/(1/far_plane - 1/near_plane); //attempt non linear depth later on
     //square to make non linear result
     z = std::fabs(z*z);
     color = vec3(z);
@@ -239,9 +392,10 @@ class depthMat : public material {
   }
 
   private:
-  double near = 0.1;
-  double far = 2000;
-  double slope = 1 / (near - far);
+  // not `near` and `far`, which <windows.h> defines as macros
+  double near_plane = 0.1;
+  double far_plane = 2000;
+  double slope = 1 / (near_plane - far_plane);
 
 };
 
@@ -257,6 +411,32 @@ class fakeShadows : public material {
     return true;
   }
 
+  color get_albedo() const { return albedo; }
+  point3 get_light_position() const { return lightPos; }
+
+  private:
+  color albedo;
+  point3 lightPos;
+};
+
+//fakeShadows with the shadow found by a shadow ray towards the light instead of guessed from the
+//view direction, so other objects cast shadows too
+class tracedShadows : public material {
+  public:
+  tracedShadows(const color& albedo, const point3& lightPos) : albedo(albedo), lightPos(lightPos){}
+
+  bool shade(const ray& r_in, const hit_record& rec, const hittable& world, color& color) const override {
+    vec3 to_light = lightPos - rec.p;
+    bool lit = dot(rec.normal, to_light) > 0
+            && !world.occluded(ray(rec.p, to_light, r_in.time()), interval(0.001, 0.999));
+
+    color = lit ? albedo : albedo * 0.5;
+    return true;
+  }
+
+  color get_albedo() const { return albedo; }
+  point3 get_light_position() const { return lightPos; }
+
   private:
   color albedo;
   point3 lightPos;
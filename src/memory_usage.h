@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstdint>
+
+#ifdef _WIN32
+    #ifndef NOMINMAX
+        #define NOMINMAX
+    #endif
+    #ifndef PSAPI_VERSION
+        #define PSAPI_VERSION 2  // GetProcessMemoryInfo from kernel32, no psapi.lib needed
+    #endif
+    #include <windows.h>
+    #include <psapi.h>
+#else
+    #include <sys/resource.h>
+#endif
+
+inline uint64_t peak_rss_bytes() {
+    // The most physical memory this process has used at any one time so far (0 if unknown).
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+        return 0;
+    return counters.PeakWorkingSetSize;
+#else
+    rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+        return 0;
+    #ifdef __APPLE__
+        return uint64_t(usage.ru_maxrss);          // bytes
+    #else
+        return uint64_t(usage.ru_maxrss) * 1024;   // kilobytes
+    #endif
+#endif
+}
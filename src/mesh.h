@@ -0,0 +1,475 @@
+#pragma once
+
+#include "hittable.h"
+#include "material.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <numeric>
+#include <utility>
+#include <vector>
+
+class triangle_mesh : public hittable {
+  public:
+    // An indexed triangle mesh. The vertices are shared between triangles and stored once, in
+    // flat float buffers; a triangle is three indices into them. The mesh has its own BVH over
+    // its triangles, in one array of 32 byte nodes, so a million triangle model needs no
+    // object per triangle and costs about 12 bytes per vertex for positions, 12 per triangle
+    // for indices and ~32 per triangle for the tree.
+    //
+    // Fill the buffers (see mesh_loader.h), then call build(). To place the mesh in the world,
+    // wrap it in a transform or instance it. It is never sampled as a light.
+
+    std::vector<float>    positions;  // xyz, 3 floats per vertex
+    std::vector<float>    normals;    // xyz, 3 floats per vertex, or empty for flat shading
+    std::vector<float>    uvs;        // uv, 2 floats per vertex, or empty
+    std::vector<uint32_t> indices;    // 3 vertex indices per triangle
+
+    triangle_mesh(std::shared_ptr<material> mat) : mat(mat) {}
+
+    size_t vertex_count()   const { return positions.size() / 3; }
+    size_t triangle_count() const { return indices.size() / 3; }
+
+    size_t memory_bytes() const {
+        return positions.size() * sizeof(float) + normals.size() * sizeof(float)
+             + uvs.size() * sizeof(float) + indices.size() * sizeof(uint32_t)
+             + nodes.size() * sizeof(node);
+    }
+
+    void build() {
+        // Builds the BVH with binned SAH splits (Wald, "On fast Construction of SAH-based
+        // Bounding Volume Hierarchies", 2007). Reorders the triangles so every leaf holds a
+        // contiguous run of them.
+        trace_span span("mesh bvh build", "scene", "triangles", int64_t(triangle_count()));
+        auto count = triangle_count();
+        nodes.clear();
+        if (count == 0) {
+            bbox = aabb::empty;
+            return;
+        }
+
+        std::vector<float> bounds(count * 6), centroids(count * 3);
+        for (size_t tri = 0; tri < count; tri++) {
+            float* b = &bounds[tri * 6];
+            for (int a = 0; a < 3; a++) {
+                b[a] = b[a + 3] = vertex(indices[3*tri], a);
+                for (int k = 1; k < 3; k++) {
+                    auto x = vertex(indices[3*tri + k], a);
+                    b[a]     = std::min(b[a], x);
+                    b[a + 3] = std::max(b[a + 3], x);
+                }
+                centroids[3*tri + a] = 0.5f * (b[a] + b[a + 3]);
+            }
+        }
+
+        std::vector<uint32_t> order(count);
+        std::iota(order.begin(), order.end(), 0);
+        nodes.reserve(2 * count / leaf_size + 1);
+        nodes.emplace_back();
+        build_node(0, 0, order, 0, uint32_t(count), bounds, centroids);
+
+        std::vector<uint32_t> sorted(indices.size());
+        for (size_t i = 0; i < count; i++)
+            std::copy_n(&indices[3 * size_t(order[i])], 3, &sorted[3*i]);
+        indices.swap(sorted);
+        nodes.shrink_to_fit();
+
+        const node& root = nodes[0];
+        bbox = aabb(point3(root.min[0], root.min[1], root.min[2]),
+                    point3(root.max[0], root.max[1], root.max[2]));
+    }
+
+    bool hit(const ray& r, interval ray_t, hit_record& rec, const vec3& camPos) const override {
+        triangle_hit h;
+        if (!traverse<false>(r, ray_t, h))
+            return false;
+
+        const uint32_t* tri = &indices[3 * size_t(h.triangle)];
+        auto p0 = vertex(tri[0]), p1 = vertex(tri[1]), p2 = vertex(tri[2]);
+        auto b0 = 1 - h.b1 - h.b2;
+
+        rec.t = h.t;
+        rec.p = r.at(h.t);
+        rec.u = h.u;
+        rec.v = h.v;
+        rec.mat = mat;
+        rec.set_face_normal(r, unit_vector(cross(p1 - p0, p2 - p0)));
+        if (!normals.empty()) {
+            // The interpolated shading normal, turned to the side of the geometric normal that
+            // faces the ray. Files don't always wind their triangles the way their normals point.
+            auto n = unit_vector(b0*normal(tri[0]) + h.b1*normal(tri[1]) + h.b2*normal(tri[2]));
+            rec.normal = dot(n, rec.normal) < 0 ? -n : n;
+        }
+        rec.set_face_depth(r, camPos);
+        return true;
+    }
+
+    bool occluded(const ray& r, interval ray_t) const override {
+        triangle_hit h;
+        return traverse<true>(r, ray_t, h);
+    }
+
+    aabb bounding_box() const override { return bbox; }
+
+    struct node {
+        float    min[3];
+        float    max[3];
+        uint32_t index;   // Leaf: first triangle. Inner node: the second child (the first follows it)
+        uint32_t count;   // Triangles in a leaf, 0 for inner nodes
+    };
+
+    std::shared_ptr<material> get_material() const { return mat; }
+    const std::vector<node>& get_nodes() const { return nodes; }
+
+    bool set_tree(std::vector<node> tree) {
+        // Uses a tree that build() made earlier for these same buffers, such as one read back
+        // from a scene cache, instead of building it again. The buffers and the tree are
+        // checked first, so traversal can trust them: every index names a vertex, every leaf
+        // names triangles that exist, children come after their parent (so there are no
+        // cycles) and no path is deeper than the traversal stack. Returns false, leaving the
+        // mesh without a tree, if any of that fails.
+        nodes.clear();
+        bbox = aabb::empty;
+
+        auto vertices = vertex_count();
+        if (positions.size() % 3 != 0 || indices.size() % 3 != 0
+            || (!normals.empty() && normals.size() != positions.size())
+            || (!uvs.empty() && uvs.size() != 2 * vertices))
+            return false;
+        for (auto v : indices)
+            if (v >= vertices)
+                return false;
+
+        if (tree.empty())
+            return triangle_count() == 0;
+
+        std::vector<int> depths(tree.size(), 0);
+        for (size_t k = 0; k < tree.size(); k++) {
+            const node& n = tree[k];
+            if (depths[k] >= max_depth)
+                return false;
+            if (n.count > 0) {
+                if (uint64_t(n.index) + n.count > triangle_count())
+                    return false;
+            } else {
+                if (k + 1 >= tree.size() || n.index <= k + 1 || n.index >= tree.size())
+                    return false;
+                depths[k + 1]   = std::max(depths[k + 1], depths[k] + 1);
+                depths[n.index] = std::max(depths[n.index], depths[k] + 1);
+            }
+        }
+
+        nodes = std::move(tree);
+        const node& root = nodes[0];
+        bbox = aabb(point3(root.min[0], root.min[1], root.min[2]),
+                    point3(root.max[0], root.max[1], root.max[2]));
+        return true;
+    }
+
+  private:
+
+    struct triangle_hit {
+        uint32_t triangle;
+        double t, b1, b2;  // Distance and the barycentric weights of the second and third vertex
+        double u, v;
+    };
+
+    struct ray_setup {
+        // Per ray constants of the box and triangle tests.
+        point3 origin;
+        vec3   inv_dir;
+        int    kx, ky, kz;    // Axes of the shear, kz the dominant direction axis
+        double sx, sy, sz;
+    };
+
+    static const uint32_t leaf_size = 4;
+    static const int      bin_count = 16;
+    static const int      max_depth = 64;   // Also the size of the traversal stack
+    static constexpr float inf = std::numeric_limits<float>::infinity();
+
+    std::shared_ptr<material> mat;
+    std::vector<node> nodes;
+    aabb bbox;
+
+    float vertex(uint32_t v, int axis) const { return positions[3 * size_t(v) + axis]; }
+
+    point3 vertex(uint32_t v) const {
+        const float* p = &positions[3 * size_t(v)];
+        return point3(p[0], p[1], p[2]);
+    }
+
+    vec3 normal(uint32_t v) const {
+        const float* n = &normals[3 * size_t(v)];
+        return vec3(n[0], n[1], n[2]);
+    }
+
+    void build_node(uint32_t index, int depth, std::vector<uint32_t>& order, uint32_t begin,
+                    uint32_t end, const std::vector<float>& bounds, const std::vector<float>& centroids) {
+        // Fills nodes[index] with the box of order[begin, end) and splits it, or makes it a leaf.
+        // Past max_depth everything left becomes one leaf, so traversal never overflows its stack.
+        float lo[3] = { inf, inf, inf }, hi[3] = { -inf, -inf, -inf };
+        float clo[3] = { lo[0], lo[1], lo[2] }, chi[3] = { hi[0], hi[1], hi[2] };
+        for (auto i = begin; i < end; i++) {
+            const float* b = &bounds[6 * size_t(order[i])];
+            const float* c = &centroids[3 * size_t(order[i])];
+            for (int a = 0; a < 3; a++) {
+                lo[a]  = std::min(lo[a], b[a]);
+                hi[a]  = std::max(hi[a], b[a + 3]);
+                clo[a] = std::min(clo[a], c[a]);
+                chi[a] = std::max(chi[a], c[a]);
+            }
+        }
+        std::copy_n(lo, 3, nodes[index].min);
+        std::copy_n(hi, 3, nodes[index].max);
+
+        auto count = end - begin;
+        auto mid = count > leaf_size && depth < max_depth - 1
+                 ? split(order, begin, end, clo, chi, lo, hi, bounds, centroids)
+                 : begin;
+        if (mid == begin) {
+            nodes[index].index = begin;
+            nodes[index].count = count;
+            return;
+        }
+
+        auto left = uint32_t(nodes.size());
+        nodes.emplace_back();
+        build_node(left, depth + 1, order, begin, mid, bounds, centroids);
+
+        auto right = uint32_t(nodes.size());
+        nodes.emplace_back();
+        build_node(right, depth + 1, order, mid, end, bounds, centroids);
+
+        nodes[index].index = right;
+        nodes[index].count = 0;
+    }
+
+    static uint32_t split(std::vector<uint32_t>& order, uint32_t begin, uint32_t end,
+                          const float* clo, const float* chi, const float* lo, const float* hi,
+                          const std::vector<float>& bounds, const std::vector<float>& centroids) {
+        // Bins the triangles by centroid along the longest centroid axis and partitions them at
+        // the bin boundary of least SAH cost. Returns the partition point, or begin if a leaf
+        // is cheaper than any split.
+        int axis = 0;
+        for (int a = 1; a < 3; a++)
+            if (chi[a] - clo[a] > chi[axis] - clo[axis]) axis = a;
+
+        auto extent = chi[axis] - clo[axis];
+        if (!(extent > 0))
+            return begin;
+
+        struct bin { float lo[3], hi[3]; uint32_t count; };
+        bin bins[bin_count];
+        for (auto& b : bins) {
+            b.count = 0;
+            for (int a = 0; a < 3; a++) { b.lo[a] = inf; b.hi[a] = -inf; }
+        }
+
+        auto scale = bin_count / extent;
+        auto bin_of = [&](uint32_t tri) {
+            return std::min(bin_count - 1, int((centroids[3 * size_t(tri) + axis] - clo[axis]) * scale));
+        };
+
+        for (auto i = begin; i < end; i++) {
+            auto& b = bins[bin_of(order[i])];
+            const float* box = &bounds[6 * size_t(order[i])];
+            b.count++;
+            for (int a = 0; a < 3; a++) {
+                b.lo[a] = std::min(b.lo[a], box[a]);
+                b.hi[a] = std::max(b.hi[a], box[a + 3]);
+            }
+        }
+
+        // sweep from the right for the area and count of everything above each boundary
+        auto area = [](const float* l, const float* h) {
+            auto dx = h[0] - l[0], dy = h[1] - l[1], dz = h[2] - l[2];
+            return dx*dy + dy*dz + dz*dx;
+        };
+        float right_area[bin_count];
+        uint32_t right_count[bin_count];
+        float rlo[3] = { inf, inf, inf }, rhi[3] = { -inf, -inf, -inf };
+        uint32_t rc = 0;
+        for (int k = bin_count - 1; k > 0; k--) {
+            for (int a = 0; a < 3; a++) {
+                rlo[a] = std::min(rlo[a], bins[k].lo[a]);
+                rhi[a] = std::max(rhi[a], bins[k].hi[a]);
+            }
+            rc += bins[k].count;
+            right_area[k]  = rc ? area(rlo, rhi) : 0;
+            right_count[k] = rc;
+        }
+
+        float llo[3] = { inf, inf, inf }, lhi[3] = { -inf, -inf, -inf };
+        uint32_t lc = 0;
+        float best_cost = inf;
+        int best_split = 0;
+        for (int k = 1; k < bin_count; k++) {
+            for (int a = 0; a < 3; a++) {
+                llo[a] = std::min(llo[a], bins[k-1].lo[a]);
+                lhi[a] = std::max(lhi[a], bins[k-1].hi[a]);
+            }
+            lc += bins[k-1].count;
+            if (lc == 0 || right_count[k] == 0)
+                continue;
+            auto cost = lc * area(llo, lhi) + right_count[k] * right_area[k];
+            if (cost < best_cost) {
+                best_cost = cost;
+                best_split = k;
+            }
+        }
+
+        // a box test costs about as much as a triangle test
+        auto count = end - begin;
+        auto parent_area = area(lo, hi);
+        if (best_split == 0 || (count <= 4 * leaf_size && best_cost >= (count - 1) * parent_area))
+            return begin;
+
+        auto mid = std::partition(order.begin() + begin, order.begin() + end,
+                                  [&](uint32_t tri) { return bin_of(tri) < best_split; });
+        return uint32_t(mid - order.begin());
+    }
+
+    static ray_setup setup(const ray& r) {
+        ray_setup s;
+        s.origin = r.origin();
+        const vec3& d = r.direction();
+        s.inv_dir = vec3(1 / d.x(), 1 / d.y(), 1 / d.z());
+
+        s.kz = std::fabs(d.x()) > std::fabs(d.y()) ? (std::fabs(d.x()) > std::fabs(d.z()) ? 0 : 2)
+                                                   : (std::fabs(d.y()) > std::fabs(d.z()) ? 1 : 2);
+        s.kx = (s.kz + 1) % 3;
+        s.ky = (s.kx + 1) % 3;
+        if (d[s.kz] < 0)
+            std::swap(s.kx, s.ky);  // keeps the winding, so the sign tests below stay the same
+        s.sx = d[s.kx] / d[s.kz];
+        s.sy = d[s.ky] / d[s.kz];
+        s.sz = 1 / d[s.kz];
+        return s;
+    }
+
+    static bool box_hit(const node& n, const ray_setup& s, const interval& ray_t, double& entry) {
+        double t0 = ray_t.min, t1 = ray_t.max;
+        for (int a = 0; a < 3; a++) {
+            double ta = (n.min[a] - s.origin[a]) * s.inv_dir[a];
+            double tb = (n.max[a] - s.origin[a]) * s.inv_dir[a];
+            t0 = std::max(t0, std::min(ta, tb));
+            t1 = std::min(t1, std::max(ta, tb));
+        }
+        entry = t0;
+        return t0 <= t1;
+    }
+
+    bool intersect(uint32_t tri, const ray_setup& s, const interval& ray_t, triangle_hit& h) const {
+        // Watertight ray/triangle test (Woop, Benthin and Wald, "Watertight Ray/Triangle
+        // Intersection", JCGT 2013). The vertices are moved to the ray origin and sheared so the
+        // ray runs down the z axis; the 2D edge functions U, V, W at the origin then decide the
+        // hit. A ray through a shared edge or vertex sees the same edge function values from
+        // both triangles, so it can't slip through the seam between them. Up to the sign test
+        // this is straight line arithmetic without branches, which the compiler vectorizes.
+        const uint32_t* v = &indices[3 * size_t(tri)];
+        double ax = vertex(v[0], s.kx) - s.origin[s.kx], ay = vertex(v[0], s.ky) - s.origin[s.ky], az = vertex(v[0], s.kz) - s.origin[s.kz];
+        double bx = vertex(v[1], s.kx) - s.origin[s.kx], by = vertex(v[1], s.ky) - s.origin[s.ky], bz = vertex(v[1], s.kz) - s.origin[s.kz];
+        double cx = vertex(v[2], s.kx) - s.origin[s.kx], cy = vertex(v[2], s.ky) - s.origin[s.ky], cz = vertex(v[2], s.kz) - s.origin[s.kz];
+
+        ax -= s.sx * az;  ay -= s.sy * az;
+        bx -= s.sx * bz;  by -= s.sy * bz;
+        cx -= s.sx * cz;  cy -= s.sy * cz;
+
+        double u = cx*by - cy*bx;
+        double w_ = bx*ay - by*ax;
+        double v_ = ax*cy - ay*cx;
+        if ((u < 0 || v_ < 0 || w_ < 0) && (u > 0 || v_ > 0 || w_ > 0))
+            return false;
+
+        double det = u + v_ + w_;
+        if (det == 0)
+            return false;
+
+        double t = (u * az + v_ * bz + w_ * cz) * s.sz / det;
+        if (!ray_t.surrounds(t))
+            return false;
+
+        h.triangle = tri;
+        h.t  = t;
+        h.b1 = v_ / det;
+        h.b2 = w_ / det;
+        return true;
+    }
+
+    void set_uv(triangle_hit& h) const {
+        if (uvs.empty()) {
+            h.u = h.b1;
+            h.v = h.b2;
+            return;
+        }
+        const uint32_t* v = &indices[3 * size_t(h.triangle)];
+        double b0 = 1 - h.b1 - h.b2;
+        h.u = b0 * uvs[2*v[0]]     + h.b1 * uvs[2*v[1]]     + h.b2 * uvs[2*v[2]];
+        h.v = b0 * uvs[2*v[0] + 1] + h.b1 * uvs[2*v[1] + 1] + h.b2 * uvs[2*v[2] + 1];
+    }
+
+    template <bool any_hit>
+    bool traverse(const ray& r, interval ray_t, triangle_hit& closest) const {
+        // Walks the tree front to back with a small stack, shrinking ray_t.max to the closest
+        // hit so far. With any_hit it stops at the first hit instead. Alpha-masked hits are
+        // skipped as if the ray missed.
+        if (nodes.empty())
+            return false;
+
+        auto s = setup(r);
+        double entry;
+        if (!box_hit(nodes[0], s, ray_t, entry))
+            return false;
+
+        bool cutouts = mat->has_alpha_cutout();
+        bool found = false;
+        uint32_t stack[max_depth];
+        int top = 0;
+        uint32_t current = 0;
+
+        for (;;) {
+            const node& n = nodes[current];
+            RTW_COUNT(counter::bvh_nodes);
+            if (n.count > 0) {
+                for (auto tri = n.index; tri < n.index + n.count; tri++) {
+                    triangle_hit h;
+                    RTW_COUNT(counter::triangle_tests);
+                    if (!intersect(tri, s, ray_t, h))
+                        continue;
+                    if (cutouts || !any_hit)
+                        set_uv(h);
+                    if (cutouts && mat->alpha_cutout(h.u, h.v, r.at(h.t)))
+                        continue;
+
+                    closest = h;
+                    found = true;
+                    if (any_hit)
+                        return true;
+                    ray_t.max = h.t;
+                }
+            } else {
+                uint32_t near_child = current + 1, far_child = n.index;
+                double near_entry, far_entry;
+                bool hit_near = box_hit(nodes[near_child], s, ray_t, near_entry);
+                bool hit_far  = box_hit(nodes[far_child],  s, ray_t, far_entry);
+                if (hit_near && hit_far) {
+                    if (far_entry < near_entry)
+                        std::swap(near_child, far_child);
+                    stack[top++] = far_child;
+                    current = near_child;
+                    continue;
+                }
+                if (hit_near || hit_far) {
+                    current = hit_near ? near_child : far_child;
+                    continue;
+                }
+            }
+
+            if (top == 0)
+                break;
+            current = stack[--top];
+        }
+        return found;
+    }
+};
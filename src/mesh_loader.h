@@ -0,0 +1,496 @@
+#pragma once
+
+#include "mesh.h"
+
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Loaders for Wavefront OBJ and Stanford PLY files. Both stream the file through a fixed size
+// buffer and append straight into the mesh's flat buffers, so the only memory they need beyond
+// the mesh itself is the read buffer (and for OBJ files with texture coordinates or normals, a
+// table of the distinct corners seen so far). Polygons are split into triangle fans.
+
+class mesh_reader {
+  public:
+    // Buffered reading of a file, by line for text and by byte for binary data.
+
+    mesh_reader(const std::string& filename)
+      : file(std::fopen(filename.c_str(), "rb")), buffer(buffer_size) {}
+    ~mesh_reader() { if (file) std::fclose(file); }
+
+    mesh_reader(const mesh_reader&) = delete;
+    mesh_reader& operator=(const mesh_reader&) = delete;
+
+    bool is_open() const { return file != nullptr; }
+
+    bool next_line(std::string& line) {
+        // Reads up to the next newline, dropping it and any carriage return before it. Returns
+        // false at the end of the file.
+        line.clear();
+        for (;;) {
+            if (pos == end && !fill())
+                return !line.empty();
+            auto start = buffer.data() + pos;
+            auto newline = static_cast<const char*>(std::memchr(start, '\n', end - pos));
+            if (!newline) {
+                line.append(start, end - pos);
+                pos = end;
+                continue;
+            }
+            line.append(start, newline - start);
+            pos = newline - buffer.data() + 1;
+            if (!line.empty() && line.back() == '\r')
+                line.pop_back();
+            return true;
+        }
+    }
+
+    bool read(void* out, size_t bytes) {
+        auto dest = static_cast<char*>(out);
+        while (bytes > 0) {
+            if (pos == end && !fill())
+                return false;
+            auto n = std::min(bytes, end - pos);
+            std::memcpy(dest, buffer.data() + pos, n);
+            pos += n;
+            dest += n;
+            bytes -= n;
+        }
+        return true;
+    }
+
+  private:
+    static const size_t buffer_size = 1 << 20;
+
+    std::FILE* file;
+    std::vector<char> buffer;
+    size_t pos = 0;
+    size_t end = 0;
+
+    bool fill() {
+        pos = 0;
+        end = file ? std::fread(buffer.data(), 1, buffer_size, file) : 0;
+        return end > 0;
+    }
+};
+
+inline std::string find_mesh_file(const std::string& filename) {
+    // Looks for a model file the way rtw_image looks for images: in the RTW_MODELS directory if
+    // that is set, then as given, then in models/ here and in up to six parent directories.
+    auto exists = [](const std::string& path) {
+        auto f = std::fopen(path.c_str(), "rb");
+        if (f) std::fclose(f);
+        return f != nullptr;
+    };
+
+    auto modeldir = getenv("RTW_MODELS");
+    if (modeldir && exists(std::string(modeldir) + "/" + filename))
+        return std::string(modeldir) + "/" + filename;
+    if (exists(filename))
+        return filename;
+
+    std::string prefix = "models/";
+    for (int level = 0; level <= 6; level++, prefix = "../" + prefix) {
+        if (exists(prefix + filename))
+            return prefix + filename;
+    }
+    return "";
+}
+
+inline std::shared_ptr<triangle_mesh> load_obj(const std::string& filename,
+                                               std::shared_ptr<material> mat) {
+    // Reads the v, vt, vn and f statements of an OBJ file, with negative (relative) indices.
+    // Everything else (groups, materials, smoothing, lines) is ignored and the whole file
+    // becomes one mesh. OBJ indexes positions, texture coordinates and normals separately,
+    // while the mesh shares one index between all three; a corner using a new combination of
+    // them becomes a new vertex.
+    mesh_reader in(filename);
+    if (!in.is_open())
+        return nullptr;
+
+    struct corner {
+        long v, vt, vn;
+        bool operator==(const corner& c) const { return v == c.v && vt == c.vt && vn == c.vn; }
+    };
+    struct corner_hash {
+        size_t operator()(const corner& c) const {
+            return std::hash<long>()(c.v) ^ (std::hash<long>()(c.vt) * 0x9e3779b97f4a7c15ull)
+                 ^ (std::hash<long>()(c.vn) * 0xc2b2ae3d27d4eb4full);
+        }
+    };
+
+    auto mesh = std::make_shared<triangle_mesh>(mat);
+    std::vector<float> obj_positions, obj_uvs, obj_normals;
+    std::unordered_map<corner, uint32_t, corner_hash> corners;   // (v, vt, vn) -> mesh vertex
+    bool split_vertices = false;
+
+    std::string line;
+    std::vector<uint32_t> face;
+    while (in.next_line(line)) {
+        const char* s = line.c_str();
+        while (*s == ' ' || *s == '\t') s++;
+
+        if (s[0] == 'v' && (s[1] == ' ' || s[1] == '\t')) {
+            char* p = const_cast<char*>(s + 1);
+            for (int a = 0; a < 3; a++)
+                obj_positions.push_back(std::strtof(p, &p));
+        } else if (s[0] == 'v' && s[1] == 't') {
+            char* p = const_cast<char*>(s + 2);
+            obj_uvs.push_back(std::strtof(p, &p));
+            obj_uvs.push_back(std::strtof(p, &p));
+        } else if (s[0] == 'v' && s[1] == 'n') {
+            char* p = const_cast<char*>(s + 2);
+            for (int a = 0; a < 3; a++)
+                obj_normals.push_back(std::strtof(p, &p));
+        } else if (s[0] == 'f' && (s[1] == ' ' || s[1] == '\t')) {
+            face.clear();
+            char* p = const_cast<char*>(s + 1);
+            for (;;) {
+                while (*p == ' ' || *p == '\t') p++;
+                if (!*p) break;
+
+                // v, v/vt, v//vn or v/vt/vn, 1-based, or negative to count back from the end
+                long index[3] = { 0, 0, 0 };
+                for (int k = 0; k < 3; k++) {
+                    if (k > 0) {
+                        if (*p != '/') break;
+                        p++;
+                    }
+                    if (*p != '/')
+                        index[k] = std::strtol(p, &p, 10);
+                }
+                while (*p && *p != ' ' && *p != '\t') p++;
+
+                long counts[3] = { long(obj_positions.size() / 3), long(obj_uvs.size() / 2),
+                                   long(obj_normals.size() / 3) };
+                for (int k = 0; k < 3; k++) {
+                    if (index[k] < 0) index[k] += counts[k] + 1;
+                    if (index[k] < 0 || index[k] > counts[k]) {
+                        std::cerr << "ERROR: Bad face index in '" << filename << "'.\n";
+                        return nullptr;
+                    }
+                }
+                if (index[0] == 0) {
+                    std::cerr << "ERROR: Face without a position in '" << filename << "'.\n";
+                    return nullptr;
+                }
+
+                if (!split_vertices && (index[1] || index[2])) {
+                    // The first corner with more than a position. Until here the mesh vertices
+                    // were the OBJ positions; from here on every distinct corner is one.
+                    split_vertices = true;
+                    if (!mesh->indices.empty() || !face.empty()) {
+                        mesh->positions = obj_positions;
+                        for (uint32_t v = 0; v < mesh->vertex_count(); v++)
+                            corners[{ long(v) + 1, 0, 0 }] = v;
+                    }
+                }
+
+                uint32_t vertex;
+                if (!split_vertices) {
+                    vertex = uint32_t(index[0] - 1);
+                } else {
+                    auto found = corners.find({ index[0], index[1], index[2] });
+                    if (found != corners.end()) {
+                        vertex = found->second;
+                    } else {
+                        vertex = uint32_t(mesh->vertex_count());
+                        corners.emplace(corner{ index[0], index[1], index[2] }, vertex);
+                        auto pos = &obj_positions[3 * (index[0] - 1)];
+                        mesh->positions.insert(mesh->positions.end(), pos, pos + 3);
+
+                        if (index[1]) {
+                            auto uv = &obj_uvs[2 * (index[1] - 1)];
+                            mesh->uvs.resize(2 * size_t(vertex));
+                            mesh->uvs.insert(mesh->uvs.end(), uv, uv + 2);
+                        }
+                        if (index[2]) {
+                            auto n = &obj_normals[3 * (index[2] - 1)];
+                            mesh->normals.resize(3 * size_t(vertex));
+                            mesh->normals.insert(mesh->normals.end(), n, n + 3);
+                        }
+                    }
+                }
+                face.push_back(vertex);
+            }
+
+            for (size_t k = 2; k < face.size(); k++) {
+                mesh->indices.push_back(face[0]);
+                mesh->indices.push_back(face[k-1]);
+                mesh->indices.push_back(face[k]);
+            }
+        }
+    }
+
+    if (!split_vertices)
+        mesh->positions.swap(obj_positions);
+
+    // vertices without a texture coordinate or normal get zeros
+    if (!mesh->uvs.empty())     mesh->uvs.resize(2 * mesh->vertex_count());
+    if (!mesh->normals.empty()) mesh->normals.resize(3 * mesh->vertex_count());
+    return mesh;
+}
+
+inline std::shared_ptr<triangle_mesh> load_ply(const std::string& filename,
+                                               std::shared_ptr<material> mat) {
+    // Reads the vertex positions, normals and texture coordinates and the faces of a PLY file,
+    // in ascii, binary_little_endian or binary_big_endian format. Other elements and properties
+    // are skipped.
+    mesh_reader in(filename);
+    if (!in.is_open())
+        return nullptr;
+
+    struct property {
+        std::string name;
+        int size = 0;            // Bytes of the value, or of each list item
+        bool is_float = false;
+        bool is_signed = false;
+        int count_size = 0;      // Bytes of a list's item count; 0 if this isn't a list
+    };
+    struct element {
+        std::string name;
+        size_t count = 0;
+        std::vector<property> properties;
+    };
+
+    auto type_of = [](const std::string& type, property& p) {
+        static const struct { const char* name; int size; bool is_float, is_signed; } types[] = {
+            { "char", 1, false, true },   { "int8", 1, false, true },
+            { "uchar", 1, false, false }, { "uint8", 1, false, false },
+            { "short", 2, false, true },  { "int16", 2, false, true },
+            { "ushort", 2, false, false },{ "uint16", 2, false, false },
+            { "int", 4, false, true },    { "int32", 4, false, true },
+            { "uint", 4, false, false },  { "uint32", 4, false, false },
+            { "float", 4, true, true },   { "float32", 4, true, true },
+            { "double", 8, true, true },  { "float64", 8, true, true },
+        };
+        for (const auto& t : types) {
+            if (type == t.name) {
+                p.size = t.size;
+                p.is_float = t.is_float;
+                p.is_signed = t.is_signed;
+                return true;
+            }
+        }
+        return false;
+    };
+
+    // header
+    std::string line;
+    if (!in.next_line(line) || line != "ply") {
+        std::cerr << "ERROR: '" << filename << "' is not a PLY file.\n";
+        return nullptr;
+    }
+
+    enum { ascii, little_endian, big_endian } format = ascii;
+    std::vector<element> elements;
+    for (;;) {
+        if (!in.next_line(line)) {
+            std::cerr << "ERROR: Truncated PLY header in '" << filename << "'.\n";
+            return nullptr;
+        }
+        std::vector<std::string> words;
+        for (size_t i = 0; i < line.size();) {
+            while (i < line.size() && std::isspace((unsigned char)line[i])) i++;
+            size_t j = i;
+            while (j < line.size() && !std::isspace((unsigned char)line[j])) j++;
+            if (j > i) words.push_back(line.substr(i, j - i));
+            i = j;
+        }
+        if (words.empty() || words[0] == "comment" || words[0] == "obj_info")
+            continue;
+        if (words[0] == "end_header")
+            break;
+
+        bool ok = true;
+        if (words[0] == "format" && words.size() >= 2) {
+            if      (words[1] == "ascii")                format = ascii;
+            else if (words[1] == "binary_little_endian") format = little_endian;
+            else if (words[1] == "binary_big_endian")    format = big_endian;
+            else ok = false;
+        } else if (words[0] == "element" && words.size() == 3) {
+            elements.push_back({ words[1], size_t(std::strtoull(words[2].c_str(), nullptr, 10)), {} });
+        } else if (words[0] == "property" && !elements.empty()) {
+            property p;
+            if (words.size() == 5 && words[1] == "list") {
+                property count;
+                ok = type_of(words[2], count) && type_of(words[3], p) && !count.is_float;
+                p.count_size = count.size;
+                p.name = words[4];
+            } else if (words.size() == 3) {
+                ok = type_of(words[1], p);
+                p.name = words[2];
+            } else {
+                ok = false;
+            }
+            elements.back().properties.push_back(p);
+        } else {
+            ok = false;
+        }
+
+        if (!ok) {
+            std::cerr << "ERROR: Unsupported PLY header line '" << line << "' in '" << filename << "'.\n";
+            return nullptr;
+        }
+    }
+
+    // body
+    auto mesh = std::make_shared<triangle_mesh>(mat);
+    const uint16_t one = 1;
+    const bool host_big_endian = *reinterpret_cast<const unsigned char*>(&one) == 0;
+    std::vector<double> values;      // The current ascii line's numbers
+    size_t next_value = 0;
+    bool failed = false;
+
+    auto read_number = [&](int size, bool is_float, bool is_signed) -> double {
+        if (format == ascii) {
+            if (next_value == values.size()) {
+                failed = true;
+                return 0;
+            }
+            return values[next_value++];
+        }
+
+        unsigned char bytes[8];
+        if (!in.read(bytes, size)) {
+            failed = true;
+            return 0;
+        }
+        if ((format == big_endian) != host_big_endian)
+            std::reverse(bytes, bytes + size);
+
+        switch (size) {
+            case 1: return is_signed ? double(int8_t(bytes[0])) : double(bytes[0]);
+            case 2: { uint16_t x; std::memcpy(&x, bytes, 2); return is_signed ? double(int16_t(x)) : double(x); }
+            case 4:
+                if (is_float) { float f; std::memcpy(&f, bytes, 4); return f; }
+                { uint32_t x; std::memcpy(&x, bytes, 4); return is_signed ? double(int32_t(x)) : double(x); }
+            default: { double d; std::memcpy(&d, bytes, 8); return d; }
+        }
+    };
+
+    auto start_item = [&]() {
+        // ascii PLY has one element item per line
+        if (format != ascii)
+            return;
+        values.clear();
+        next_value = 0;
+        if (!in.next_line(line)) {
+            failed = true;
+            return;
+        }
+        char* p = const_cast<char*>(line.c_str());
+        for (;;) {
+            char* after;
+            double x = std::strtod(p, &after);
+            if (after == p) break;
+            values.push_back(x);
+            p = after;
+        }
+    };
+
+    std::vector<uint32_t> face;
+    for (const auto& e : elements) {
+        bool is_vertex = e.name == "vertex", is_face = e.name == "face";
+
+        // where each property of a vertex goes: 0-2 position, 3-5 normal, 6-7 uv, -1 nowhere
+        std::vector<int> slot(e.properties.size(), -1);
+        bool has_normals = false, has_uvs = false;
+        for (size_t k = 0; is_vertex && k < e.properties.size(); k++) {
+            static const char* names[][4] = {
+                { "x" }, { "y" }, { "z" }, { "nx" }, { "ny" }, { "nz" },
+                { "u", "s", "texture_u", "texture_s" }, { "v", "t", "texture_v", "texture_t" },
+            };
+            for (int s = 0; s < 8; s++)
+                for (auto name : names[s])
+                    if (name && e.properties[k].name == name && !e.properties[k].count_size) slot[k] = s;
+            has_normals |= slot[k] >= 3 && slot[k] <= 5;
+            has_uvs     |= slot[k] >= 6;
+        }
+
+        if (is_vertex) {
+            mesh->positions.reserve(3 * e.count);
+            if (has_normals) mesh->normals.reserve(3 * e.count);
+            if (has_uvs)     mesh->uvs.reserve(2 * e.count);
+        }
+        if (is_face)
+            mesh->indices.reserve(3 * e.count);
+
+        for (size_t item = 0; item < e.count && !failed; item++) {
+            start_item();
+            float vertex[8] = { 0, 0, 0, 0, 0, 0, 0, 0 };
+            for (size_t k = 0; k < e.properties.size(); k++) {
+                const auto& p = e.properties[k];
+                if (!p.count_size) {
+                    auto x = read_number(p.size, p.is_float, p.is_signed);
+                    if (slot[k] >= 0) vertex[slot[k]] = float(x);
+                    continue;
+                }
+
+                auto n = size_t(read_number(p.count_size, false, false));
+                bool is_indices = is_face && (p.name == "vertex_indices" || p.name == "vertex_index");
+                face.clear();
+                for (size_t i = 0; i < n && !failed; i++) {
+                    auto x = read_number(p.size, p.is_float, p.is_signed);
+                    if (is_indices) face.push_back(uint32_t(x));
+                }
+                for (size_t i = 2; is_indices && i < face.size(); i++) {
+                    mesh->indices.push_back(face[0]);
+                    mesh->indices.push_back(face[i-1]);
+                    mesh->indices.push_back(face[i]);
+                }
+            }
+
+            if (is_vertex) {
+                mesh->positions.insert(mesh->positions.end(), vertex, vertex + 3);
+                if (has_normals) mesh->normals.insert(mesh->normals.end(), vertex + 3, vertex + 6);
+                if (has_uvs)     mesh->uvs.insert(mesh->uvs.end(), vertex + 6, vertex + 8);
+            }
+        }
+        if (failed) {
+            std::cerr << "ERROR: Truncated PLY data in '" << filename << "'.\n";
+            return nullptr;
+        }
+    }
+
+    for (auto v : mesh->indices) {
+        if (v >= mesh->vertex_count()) {
+            std::cerr << "ERROR: Bad face index in '" << filename << "'.\n";
+            return nullptr;
+        }
+    }
+    return mesh;
+}
+
+inline std::shared_ptr<triangle_mesh> load_mesh(const std::string& filename,
+                                                std::shared_ptr<material> mat) {
+    // Loads an .obj or .ply file (searched for like images, see find_mesh_file()) into a mesh
+    // with its BVH built. Returns nullptr if it can't be found or read.
+    auto path = find_mesh_file(filename);
+    if (path.empty()) {
+        std::cerr << "ERROR: Could not find mesh file '" << filename << "'.\n";
+        return nullptr;
+    }
+
+    auto extension = path.substr(path.find_last_of('.') + 1);
+    for (auto& c : extension) c = char(std::tolower((unsigned char)c));
+
+    std::shared_ptr<triangle_mesh> mesh;
+    if (extension == "obj")
+        mesh = load_obj(path, mat);
+    else if (extension == "ply")
+        mesh = load_ply(path, mat);
+    else
+        std::cerr << "ERROR: Unknown mesh format '" << filename << "'.\n";
+
+    if (mesh)
+        mesh->build();
+    return mesh;
+}
@@ -0,0 +1,204 @@
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "rtweekend.h"
+
+#include "benchmark.h"
+#include "bvh.h"
+#include "hittable_list.h"
+#include "material.h"
+#include "quad.h"
+#include "sphere.h"
+#include "texture.h"
+
+// Microbenchmarks of the kernels a render spends its time in. Inputs are generated up front
+// from a fixed seed, so only the kernel is timed and every run measures the same work. Build
+// with microbench.bat, or with the same flags as the renderer to measure what it runs.
+
+static std::vector<ray> random_rays(int count, double origin_radius, double target_extent) {
+    // Rays from random points on a sphere around the origin towards random points in a cube
+    // around it, so some hit the object under test and some miss.
+    std::vector<ray> rays;
+    for (int k = 0; k < count; k++) {
+        point3 origin = origin_radius * random_unit_vector();
+        point3 target(random_double(-target_extent, target_extent),
+                      random_double(-target_extent, target_extent),
+                      random_double(-target_extent, target_extent));
+        rays.emplace_back(origin, target - origin);
+    }
+    return rays;
+}
+
+template <typename Hit>
+static void ray_kernel(bench_runner& bench, const std::string& name, const std::vector<ray>& rays, Hit hit) {
+    // Times hit(ray) over the rays in turn.
+    size_t mask = rays.size() - 1;
+    bench.run(name, true, [&](uint64_t n) {
+        uint64_t hits = 0;
+        for (uint64_t k = 0; k < n; k++)
+            hits += hit(rays[k & mask]);
+        return hits;
+    });
+}
+
+int main(int argc, char* argv[]) {
+    bench_runner bench;
+    std::string json_file;
+    std::string image_name = "brush.png";
+
+    for (int a = 1; a + 1 < argc; a += 2) {
+        std::string arg = argv[a];
+        std::string value = argv[a + 1];
+        if      (arg == "--filter")  bench.filter         = value;
+        else if (arg == "--reps")    bench.repetitions    = std::stoi(value);
+        else if (arg == "--warmup")  bench.warmup         = std::stoi(value);
+        else if (arg == "--seconds") bench.target_seconds = std::stod(value);
+        else if (arg == "--json")    json_file            = value;
+        else if (arg == "--image")   image_name           = value;
+        else {
+            std::cerr << "Unknown option '" << arg << "'\n";
+            return 1;
+        }
+    }
+
+    thread_rng().reseed(1);
+    const int count = 4096;  // Inputs per kernel, a power of two
+    const interval everything(0.001, infinity);
+    bench_runner::print_header();
+
+    //primitives and boxes, hit by about half the rays
+    auto gray = std::make_shared<lambertian>(color(0.5, 0.5, 0.5));
+    sphere ball(point3(0,0,0), 1, gray);
+    quad square(point3(-1,-1,0), vec3(2,0,0), vec3(0,2,0), gray);
+    aabb box(point3(-1,-1,-1), point3(1,1,1));
+    auto rays = random_rays(count, 3, 2);
+
+    ray_kernel(bench, "sphere::hit", rays, [&](const ray& r) {
+        hit_record rec;
+        return ball.hit(r, everything, rec, r.origin());
+    });
+    ray_kernel(bench, "sphere::occluded", rays, [&](const ray& r) { return ball.occluded(r, everything); });
+    ray_kernel(bench, "quad::hit", rays, [&](const ray& r) {
+        hit_record rec;
+        return square.hit(r, everything, rec, r.origin());
+    });
+    ray_kernel(bench, "aabb::hit", rays, [&](const ray& r) { return box.hit(r, everything); });
+
+    //a BVH over a cloud of 1000 spheres
+    hittable_list cloud;
+    for (int k = 0; k < 1000; k++) {
+        point3 center(random_double(-10, 10), random_double(-10, 10), random_double(-10, 10));
+        cloud.add(std::make_shared<sphere>(center, random_double(0.2, 0.5), gray));
+    }
+    bvh_node tree(cloud);
+    auto cloud_rays = random_rays(count, 30, 10);
+
+    ray_kernel(bench, "bvh_node::hit (1000 spheres)", cloud_rays, [&](const ray& r) {
+        hit_record rec;
+        return tree.hit(r, everything, rec, r.origin());
+    });
+    ray_kernel(bench, "bvh_node::occluded", cloud_rays, [&](const ray& r) { return tree.occluded(r, everything); });
+
+    //sampling and output
+    bench.run("random_unit_vector", false, [](uint64_t n) {
+        double sum = 0;
+        for (uint64_t k = 0; k < n; k++)
+            sum += random_unit_vector().x();
+        return sum;
+    });
+
+    std::vector<color> colors(count);
+    for (auto& c : colors) c = color(random_double(0, 1.2), random_double(0, 1.2), random_double(0, 1.2));
+    std::vector<uint8_t> pixels(count * 3);
+    bench.run("write_color", false, [&](uint64_t n) {
+        int index = 0;
+        for (uint64_t k = 0; k < n; k++) {
+            if (index >= count * 3) index = 0;
+            write_color(pixels.data(), index, colors[k & (count - 1)]);
+        }
+        return pixels[0];
+    });
+
+    auto image = std::make_shared<image_texture>(image_name.c_str());
+    std::vector<double> uv(2 * count);
+    for (auto& t : uv) t = random_double();
+    bool have_image = rtw_image::cached(image_name.c_str())->height() > 0;
+    if (have_image)
+        bench.run("image_texture::value", false, [&](uint64_t n) {
+            double sum = 0;
+            for (uint64_t k = 0; k < n; k++) {
+                auto i = 2 * (k & (count - 1));
+                sum += image->value(uv[i], uv[i + 1], point3(0,0,0)).x();
+            }
+            return sum;
+        });
+    else
+        std::clog << "Skipping image_texture::value and textureMix: could not load '" << image_name
+                  << "' (set RTW_IMAGES or pass --image)\n";
+
+    //materials, at hits spread over a sphere from both sides
+    std::vector<ray> incoming;
+    std::vector<hit_record> hits;
+    for (const auto& r : random_rays(4 * count, 3, 1.5)) {
+        hit_record rec;
+        if (hits.size() < size_t(count) && ball.hit(r, everything, rec, r.origin())) {
+            incoming.push_back(r);
+            hits.push_back(rec);
+        }
+    }
+    if (hits.size() < size_t(count)) {
+        std::cerr << "ERROR: Too few hits for the material benchmarks\n";
+        return 1;
+    }
+
+    auto metal_mat = std::make_shared<metal>(color(0.8, 0.8, 0.8), 0.3);
+    auto glass = std::make_shared<dielectric>(1.5);
+    std::vector<std::pair<std::string, std::shared_ptr<material>>> scattering = {
+        { "lambertian",    gray },
+        { "metal",         metal_mat },
+        { "dielectric",    glass },
+        { "diffuse_light", std::make_shared<diffuse_light>(color(4, 4, 4)) },
+        { "mix",           std::make_shared<mix>(gray, metal_mat, 0.5) },
+        { "transparent",   std::make_shared<transparent>() },
+    };
+    if (have_image)
+        scattering.push_back({ "textureMix", std::make_shared<textureMix>(gray, glass, image) });
+
+    for (const auto& [name, mat] : scattering)
+        bench.run(name + "::scatter", false, [&, mat = mat](uint64_t n) {
+            double sum = 0;
+            scatter_record srec;
+            for (uint64_t k = 0; k < n; k++) {
+                auto i = k & (count - 1);
+                if (mat->scatter(incoming[i], hits[i], srec))
+                    sum += srec.attenuation.x();
+            }
+            return sum;
+        });
+
+    //unlit materials shade the hit themselves instead of scattering
+    std::vector<std::pair<std::string, std::shared_ptr<material>>> shading = {
+        { "unlit",         std::make_shared<unlit>(color(0.8, 0.2, 0.2)) },
+        { "normalMat",     std::make_shared<normalMat>() },
+        { "depthMat",      std::make_shared<depthMat>() },
+        { "fakeShadows",   std::make_shared<fakeShadows>(color(0.8, 0.2, 0.2)) },
+        { "tracedShadows", std::make_shared<tracedShadows>(color(0.8, 0.2, 0.2), point3(20, 20, 20)) },
+    };
+    for (const auto& [name, mat] : shading)
+        bench.run(name + "::shade", false, [&, mat = mat](uint64_t n) {
+            double sum = 0;
+            color shaded;
+            for (uint64_t k = 0; k < n; k++) {
+                auto i = k & (count - 1);
+                if (mat->shade(incoming[i], hits[i], tree, shaded))
+                    sum += shaded.x();
+            }
+            return sum;
+        });
+
+    if (!json_file.empty() && !bench.write_json(json_file))
+        return 1;
+
+    return 0;
+}
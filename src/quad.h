@@ -6,13 +6,25 @@
 class quad : public hittable {
   public:
     quad(const point3& Q, const vec3& u, const vec3& v, std::shared_ptr<material> mat)
-      : Q(Q), u(u), v(v), mat(mat)
+      : mat(mat)
     {
+        set_frame(Q, u, v);
+    }
+
+    void set_frame(const point3& corner, const vec3& edge_u, const vec3& edge_v) {
+        // Moves the quad to corner Q with edges u and v. Bounding volumes above it need a
+        // refit() afterwards.
+        Q = corner;
+        u = edge_u;
+        v = edge_v;
+
         auto n = cross(u, v);
         normal = unit_vector(n);
         D = dot(normal, Q);
         w = n / dot(n,n);
 
+        area = n.length();
+
         set_bounding_box();
     }
 
@@ -26,6 +38,7 @@ class quad : public hittable {
     aabb bounding_box() const override { return bbox; }
 
     bool hit(const ray& r, interval ray_t, hit_record& rec, const vec3& camPos) const override {
+        RTW_COUNT(counter::quad_tests);
         auto denom = dot(normal, r.direction());
 
         // No hit if the ray is parallel to the plane.
@@ -43,9 +56,19 @@ class quad : public hittable {
         auto alpha = dot(w, cross(planar_hitpt_vector, v));
         auto beta = dot(w, cross(u, planar_hitpt_vector));
 
+        auto prev_u = rec.u;
+        auto prev_v = rec.v;
         if (!is_interior(alpha, beta, rec))
             return false;
 
+        // Alpha-masked texels are skipped here as if the ray missed, leaving the record as it
+        // was so an earlier hit held in it stays intact.
+        if (mat->alpha_cutout(rec.u, rec.v, intersection)) {
+            rec.u = prev_u;
+            rec.v = prev_v;
+            return false;
+        }
+
         // Ray hits the 2D shape; set the rest of the hit record and return true.
         rec.t = t;
         rec.p = intersection;
@@ -56,6 +79,47 @@ class quad : public hittable {
         return true;
     }
 
+    bool occluded(const ray& r, interval ray_t) const override {
+        RTW_COUNT(counter::quad_tests);
+        auto denom = dot(normal, r.direction());
+        if (std::fabs(denom) < 1e-8)
+            return false;
+
+        auto t = (D - dot(normal, r.origin())) / denom;
+        if (!ray_t.contains(t))
+            return false;
+
+        auto intersection = r.at(t);
+        vec3 planar_hitpt_vector = intersection - Q;
+        auto alpha = dot(w, cross(planar_hitpt_vector, v));
+        auto beta = dot(w, cross(u, planar_hitpt_vector));
+
+        hit_record rec;
+        if (!is_interior(alpha, beta, rec))
+            return false;
+
+        return !mat->has_alpha_cutout() || !mat->alpha_cutout(rec.u, rec.v, intersection);
+    }
+
+    bool is_emissive() const override { return mat->is_emissive(); }
+
+    double pdf_value(const point3& origin, const vec3& direction) const override {
+        hit_record rec;
+        if (!this->hit(ray(origin, direction), interval(0.001, infinity), rec, origin))
+            return 0;
+
+        auto distance_squared = rec.t * rec.t * direction.length_squared();
+        auto cosine = std::fabs(dot(direction, rec.normal) / direction.length());
+
+        return distance_squared / (cosine * area);
+    }
+
+    vec3 random(const point3& origin) const override {
+        auto s = sample_2d();
+        auto p = Q + (s.x() * u) + (s.y() * v);
+        return p - origin;
+    }
+
     virtual bool is_interior(double a, double b, hit_record& rec) const {
         interval unit_interval = interval(0, 1);
         // Given the hit point in plane coordinates, return false if it is outside the
@@ -69,6 +133,11 @@ class quad : public hittable {
         return true;
     }
 
+    point3 get_corner() const { return Q; }
+    vec3 get_u() const { return u; }
+    vec3 get_v() const { return v; }
+    std::shared_ptr<material> get_material() const { return mat; }
+
   private:
     point3 Q;
     vec3 u, v;
@@ -77,6 +146,7 @@ class quad : public hittable {
     aabb bbox;
     vec3 normal;
     double D; 
+    double area;
 };
 
 inline std::shared_ptr<hittable_list> box(const point3& a, const point3& b, std::shared_ptr<material> mat)
@@ -0,0 +1,163 @@
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "rtweekend.h"
+
+#include "benchmark.h"
+#include "image_compare.h"
+
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "../ThirdParty/stb/stb_image_write.h"
+
+// Reference image test: renders the canonical scenes listed in references/references.txt with
+// the renderer executable at a fixed width, sample count and seed, and compares each render
+// with references/<scene>.png. A scene fails if its RMSE or mean FLIP-style error is above its
+// tolerance; the render and a false-color map of the error are then left in the work
+// directory. Exits with 1 if any scene failed. --update re-renders the references instead.
+// Build with refcheck.bat.
+
+struct reference_case {
+    std::string scene;
+    int    width = 0;
+    int    spp = 0;
+    double max_rmse = 0;    // In 8-bit steps
+    double max_flip = 0;    // Mean per-pixel error
+};
+
+static bool read_cases(const std::string& filename, std::vector<reference_case>& cases) {
+    std::ifstream in(filename);
+    if (!in) {
+        std::cerr << "ERROR: Could not read '" << filename << "'.\n";
+        return false;
+    }
+    std::string line;
+    for (int number = 1; std::getline(in, line); number++) {
+        line = line.substr(0, line.find('#'));
+        std::istringstream fields(line);
+        reference_case c;
+        if (!(fields >> c.scene))
+            continue;
+        if (!(fields >> c.width >> c.spp >> c.max_rmse >> c.max_flip)) {
+            std::cerr << "ERROR: " << filename << ":" << number << ": expected scene, width, spp, "
+                      << "max rmse and max flip\n";
+            return false;
+        }
+        cases.push_back(c);
+    }
+    return true;
+}
+
+int main(int argc, char* argv[]) {
+#ifdef _WIN32
+    std::string renderer = "a.exe";
+#else
+    std::string renderer = "./a.out";
+#endif
+    std::string reference_dir = "references";
+    std::string work_dir = "refcheck_output";
+    std::string only;
+    uint64_t seed = 0x5eed;
+    bool update = false;
+
+    for (int a = 1; a < argc; a++) {
+        std::string arg = argv[a];
+        if (arg == "--update") {
+            update = true;
+            continue;
+        }
+        if (a + 1 >= argc) {
+            std::cerr << "Missing value for option '" << arg << "'\n";
+            return 1;
+        }
+        std::string value = argv[++a];
+
+        if      (arg == "--renderer")   renderer      = value;
+        else if (arg == "--references") reference_dir = value;
+        else if (arg == "--work-dir")   work_dir      = value;
+        else if (arg == "--scene")      only          = value;
+        else if (arg == "--seed")       seed          = std::stoull(value);
+        else {
+            std::cerr << "Unknown option '" << arg << "'\n";
+            return 1;
+        }
+    }
+
+    std::vector<reference_case> cases;
+    if (!read_cases((std::filesystem::path(reference_dir) / "references.txt").string(), cases))
+        return 1;
+
+    //the renderer runs inside a directory per scene, which keeps the files it writes beside the
+    //image apart, so every path handed to it is absolute
+    auto top = std::filesystem::current_path();
+    renderer = std::filesystem::absolute(renderer).string();
+    flip_metric flip;
+    int failed = 0;
+
+    std::printf("%-26s %16s %16s\n", "scene", "rmse (max)", "flip (max)");
+    for (const auto& c : cases) {
+        if (!only.empty() && c.scene != only)
+            continue;
+
+        auto dir = top / work_dir / c.scene;
+        std::filesystem::create_directories(dir);
+        std::ostringstream command;
+        command << "\"" << renderer << "\" --scene \"" << (top / "scenes" / (c.scene + ".scene")).string()
+                << "\" --width " << c.width << " --spp " << c.spp << " --seed " << seed
+                << " --output image.png > render.log 2>&1";
+        std::filesystem::current_path(dir);
+        int status = run_command(command.str());
+        std::filesystem::current_path(top);
+
+        auto rendered = (dir / "image.png").string();
+        rgb_image test;
+        if (status != 0 || !test.load(rendered)) {
+            std::printf("%-26s FAIL: render failed, see %s\n", c.scene.c_str(), (dir / "render.log").string().c_str());
+            failed++;
+            continue;
+        }
+
+        auto reference_file = top / reference_dir / (c.scene + ".png");
+        if (update) {
+            std::filesystem::copy_file(rendered, reference_file, std::filesystem::copy_options::overwrite_existing);
+            std::printf("%-26s updated\n", c.scene.c_str());
+            continue;
+        }
+
+        rgb_image reference;
+        if (!reference.load(reference_file.string()) || !reference.same_size(test)) {
+            std::printf("%-26s FAIL: no reference of this size, run with --update\n", c.scene.c_str());
+            failed++;
+            continue;
+        }
+
+        double error = rmse(reference, test);
+        auto errors = flip.errors(reference, test);
+        double mean = 0;
+        for (auto e : errors) mean += e;
+        mean /= errors.size();
+
+        bool pass = error <= c.max_rmse && mean <= c.max_flip;
+        std::printf("%-26s %7.3f (%6.3f) %7.4f (%6.4f)  %s\n", c.scene.c_str(), error, c.max_rmse,
+                    mean, c.max_flip, pass ? "ok" : "FAIL");
+        if (pass)
+            continue;
+
+        failed++;
+        std::vector<uint8_t> pixels(errors.size() * 3);
+        for (size_t k = 0; k < errors.size(); k++)
+            false_color(errors[k], &pixels[3*k]);
+        auto diff = (dir / "diff.png").string();
+        stbi_write_png(diff.c_str(), test.width, test.height, 3, pixels.data(), test.width * 3);
+        std::printf("%-26s see %s and %s\n", "", rendered.c_str(), diff.c_str());
+    }
+
+    if (failed > 0) {
+        std::printf("%d scene(s) failed\n", failed);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,143 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+// Statistics of a render: counters of what the hot paths did, and wall time per phase. Every
+// thread counts into its own render_counters, so counting costs one increment of thread local
+// memory and the threads never share a cache line; camera adds the threads' counts up after
+// each pass. Building with RTW_NO_STATS defined compiles the counting out.
+
+enum class counter {
+    // rays traced, by type
+    camera_rays, scatter_rays, shadow_rays,
+    // acceleration structure and primitive tests
+    bvh_nodes, sphere_tests, quad_tests, triangle_tests,
+    // camera and scatter rays that hit something, shadow rays that were blocked
+    hits, shadow_hits,
+    // bvh_node roots rebuilt because a refit left them too slow (see bvh_node::update)
+    bvh_rebuilds,
+    // how paths ended: at the background, at a surface that doesn't scatter (lights), at a
+    // material that shades itself (unlit, the toon materials), or at max_depth
+    escaped, absorbed, shaded, depth_limit,
+    count
+};
+
+inline const char* counter_name(counter s) {
+    static const char* names[] = {
+        "camera_rays", "scatter_rays", "shadow_rays",
+        "bvh_nodes", "sphere_tests", "quad_tests", "triangle_tests",
+        "hits", "shadow_hits",
+        "bvh_rebuilds",
+        "escaped", "absorbed", "shaded", "depth_limit",
+    };
+    return names[int(s)];
+}
+
+struct render_counters {
+    uint64_t values[int(counter::count)] = {};
+
+    uint64_t operator[](counter s) const { return values[int(s)]; }
+    uint64_t& operator[](counter s) { return values[int(s)]; }
+
+    uint64_t rays() const {
+        return (*this)[counter::camera_rays] + (*this)[counter::scatter_rays] + (*this)[counter::shadow_rays];
+    }
+
+    render_counters& operator+=(const render_counters& other) {
+        for (int i = 0; i < int(counter::count); i++) values[i] += other.values[i];
+        return *this;
+    }
+
+    render_counters operator-(const render_counters& other) const {
+        render_counters result;
+        for (int i = 0; i < int(counter::count); i++) result.values[i] = values[i] - other.values[i];
+        return result;
+    }
+};
+
+inline render_counters& thread_counters() {
+    // What the current thread has counted so far.
+    static thread_local render_counters counters;
+    return counters;
+}
+
+#ifdef RTW_NO_STATS
+    #define RTW_COUNT(s) ((void)0)
+#else
+    #define RTW_COUNT(s) (thread_counters()[s]++)
+#endif
+
+inline std::string json_string(const std::string& text) {
+    // `text` as a quoted JSON string.
+    std::string quoted = "\"";
+    for (unsigned char c : text) {
+        if (c == '"' || c == '\\') {
+            quoted += '\\';
+            quoted += char(c);
+        } else if (c < 0x20) {
+            static const char hex[] = "0123456789abcdef";
+            quoted += "\\u00";
+            quoted += hex[c >> 4];
+            quoted += hex[c & 15];
+        } else {
+            quoted += char(c);
+        }
+    }
+    return quoted + '"';
+}
+
+enum class phase { scene, bvh, update, render, outline, denoise, encode, count };
+
+inline const char* phase_name(phase p) {
+    static const char* names[] = { "scene", "bvh", "update", "render", "outline", "denoise", "encode" };
+    return names[int(p)];
+}
+
+struct render_stats {
+    render_counters counters;                 // Summed over every thread and pass
+    double seconds[int(phase::count)] = {};   // Wall time per phase
+    uint64_t pixel_samples = 0;               // Camera samples taken per pixel, summed over the
+                                              // pixels (an outline pixel is one sample)
+
+    void write_json(std::ostream& out) const {
+        // The counters and times as the members of a JSON object, without the braces.
+        out << "  \"seconds\": {";
+        for (int p = 0; p < int(phase::count); p++)
+            out << (p ? ", " : " ") << '"' << phase_name(phase(p)) << "\": " << seconds[p];
+        out << " },\n  \"counters\": {";
+        for (int s = 0; s < int(counter::count); s++)
+            out << (s ? ", " : " ") << '"' << counter_name(counter(s)) << "\": " << counters.values[s];
+        out << " },\n  \"pixel_samples\": " << pixel_samples << ",\n";
+
+        // derived figures
+        auto camera_rays = double(counters[counter::camera_rays]);
+        auto render_seconds = seconds[int(phase::render)] + seconds[int(phase::outline)];
+        out << "  \"mean_path_length\": "
+            << (camera_rays > 0 ? (camera_rays + counters[counter::scatter_rays]) / camera_rays : 0) << ",\n"
+            << "  \"mrays_per_second\": "
+            << (render_seconds > 0 ? counters.rays() / render_seconds * 1e-6 : 0) << ",\n"
+            << "  \"samples_per_second\": "
+            << (render_seconds > 0 ? pixel_samples / render_seconds : 0) << ",\n"
+            << "  \"bvh_nodes_per_ray\": "
+            << (counters.rays() > 0 ? double(counters[counter::bvh_nodes]) / counters.rays() : 0);
+    }
+};
+
+class timed_phase {
+  public:
+    // Adds the wall time from its construction to its destruction to a phase of `stats`.
+    timed_phase(render_stats& stats, phase p)
+      : stats(stats), p(p), start(std::chrono::steady_clock::now()) {}
+
+    ~timed_phase() {
+        stats.seconds[int(p)] += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+  private:
+    render_stats& stats;
+    phase p;
+    std::chrono::steady_clock::time_point start;
+};
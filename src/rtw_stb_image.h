@@ -12,6 +12,10 @@
 
 #include <cstdlib>
 #include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
 
 class rtw_image {
   public:
@@ -47,6 +51,24 @@ class rtw_image {
         STBI_FREE(fdata);
     }
 
+    rtw_image(const rtw_image&) = delete;
+    rtw_image& operator=(const rtw_image&) = delete;
+
+    static std::shared_ptr<const rtw_image> cached(const char* image_filename) {
+        // Returns the image loaded from the given file name, loading it only the first time it
+        // is asked for. Every texture made from the same file shares one copy, and it stays
+        // loaded for the life of the program, so scenes that are built again (or animated)
+        // don't decode their images again.
+        static std::mutex lock;
+        static std::map<std::string, std::shared_ptr<const rtw_image>> images;
+
+        std::lock_guard<std::mutex> guard(lock);
+        auto& image = images[image_filename];
+        if (!image)
+            image = std::make_shared<const rtw_image>(image_filename);
+        return image;
+    }
+
     bool load(const std::string& filename) {
         // Loads the linear (gamma=1) image data from the given file name. Returns true if the
         // load succeeded. The resulting data buffer contains the three [0.0, 1.0]
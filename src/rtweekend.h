@@ -1,6 +1,7 @@
 #pragma once
 
 #include <cmath>
+#include <cstdint>
 #include <cstdlib>
 #include <iostream>
 #include <limits>
@@ -17,9 +18,42 @@ inline double degrees_to_radians(double degrees) {
     return degrees * pi / 180.0;
 }
 
+class rng {
+  public:
+    // PCG32 generator (pcg-random.org). Small, fast, and its whole state is two integers, so a
+    // render can save it and later continue the exact same random sequence.
+    uint64_t state = 0x853c49e6748fea9bULL;
+    uint64_t inc   = 0xda3e39cb94b95bdbULL;
+
+    rng() {}
+    rng(uint64_t seed, uint64_t stream = 0) { reseed(seed, stream); }
+
+    void reseed(uint64_t seed, uint64_t stream = 0) {
+        state = 0;
+        inc = (stream << 1u) | 1u;
+        next();
+        state += seed;
+        next();
+    }
+
+    uint32_t next() {
+        uint64_t old = state;
+        state = old * 6364136223846793005ULL + inc;
+        uint32_t xorshifted = uint32_t(((old >> 18u) ^ old) >> 27u);
+        uint32_t rot = uint32_t(old >> 59u);
+        return (xorshifted >> rot) | (xorshifted << ((-rot) & 31));
+    }
+};
+
+inline rng& thread_rng() {
+    // Each thread draws from its own generator.
+    static thread_local rng generator;
+    return generator;
+}
+
 inline double random_double() {
     // Returns a random real in [0,1).
-    return std::rand() / (RAND_MAX + 1.0);
+    return thread_rng().next() / 4294967296.0;
 }
 
 inline double random_double(double min, double max) {
@@ -37,4 +71,7 @@ inline int random_int(int min, int max) {
 #include "color.h"
 #include "ray.h"
 #include "interval.h"
-#include "vec3.h"
\ No newline at end of file
+#include "vec3.h"
+#include "sampler.h"
+#include "render_stats.h"
+#include "trace.h"
\ No newline at end of file
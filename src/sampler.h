@@ -0,0 +1,344 @@
+#pragma once
+
+#include "rtweekend.h"
+
+#include <algorithm>
+#include <memory>
+
+// Samplers hand out the random numbers of one camera sample, dimension by dimension: the camera
+// takes the pixel offset first, then the time, and every bounce after that takes what it needs
+// for its own choices. A sampler that knows which pixel, which sample and which dimension a
+// number is for can spread the samples of a pixel much more evenly than independent random
+// numbers do, which is where the lower noise at equal samples per pixel comes from.
+
+enum class sampler_type { independent, stratified, sobol, blue_noise };
+
+class sampler {
+  public:
+    virtual ~sampler() = default;
+
+    void start_pixel(int i, int j, uint32_t index) {
+        // Positions the sampler at sample `index` of pixel i, j, starting over at dimension 0.
+        pixel_x = i;
+        pixel_y = j;
+        sample_index = index;
+        dimension = 0;
+    }
+
+    // Returns the next dimension of the current sample, in [0,1).
+    virtual double get_1d() = 0;
+
+    // Returns the next two dimensions of the current sample in x and y, each in [0,1).
+    virtual vec3 get_2d() = 0;
+
+    // Returns a sampler with the same sequence, for another thread to draw from.
+    virtual std::unique_ptr<sampler> clone() const = 0;
+
+  protected:
+    int      pixel_x = 0;
+    int      pixel_y = 0;
+    uint32_t sample_index = 0;
+    uint32_t dimension = 0;
+
+    static uint64_t mix_bits(uint64_t v) {
+        // The splitmix64 finalizer: a cheap hash whose output bits all depend on every input bit.
+        v ^= v >> 31;
+        v *= 0x7fb5d329728ea185ULL;
+        v ^= v >> 27;
+        v *= 0x81dadef4bc2dd44dULL;
+        v ^= v >> 33;
+        return v;
+    }
+
+    uint64_t pixel_hash(uint32_t dim, uint64_t seed) const {
+        // A value unique to this pixel, dimension and seed.
+        return mix_bits(((uint64_t(uint32_t(pixel_x)) << 32) | uint32_t(pixel_y))
+                        ^ mix_bits(seed + dim));
+    }
+
+    static double to_unit(uint32_t bits) {
+        return bits / 4294967296.0;
+    }
+};
+
+class independent_sampler : public sampler {
+  public:
+    // Plain white noise from the thread's random generator, as if there were no sampler.
+
+    double get_1d() override { return random_double(); }
+
+    std::unique_ptr<sampler> clone() const override { return std::make_unique<independent_sampler>(*this); }
+
+    vec3 get_2d() override {
+        auto x = random_double();
+        auto y = random_double();
+        return vec3(x, y, 0);
+    }
+};
+
+class stratified_sampler : public sampler {
+  public:
+    // Jittered stratification. Each dimension of a pixel is split into as many strata as the
+    // pixel will get samples (a near-square grid for 2D requests), and sample k lands in
+    // stratum permute(k). The permutation differs per pixel and dimension, so the dimensions
+    // aren't correlated with each other. Works best when every pixel gets exactly
+    // `samples_per_pixel` samples.
+
+    stratified_sampler(int samples_per_pixel, uint64_t seed)
+      : count(uint32_t(std::max(samples_per_pixel, 1))), seed(seed)
+    {
+        grid_x = uint32_t(std::ceil(std::sqrt(double(count))));
+        grid_y = (count + grid_x - 1) / grid_x;
+    }
+
+    std::unique_ptr<sampler> clone() const override { return std::make_unique<stratified_sampler>(*this); }
+
+    double get_1d() override {
+        auto hash = pixel_hash(dimension++, seed);
+        auto stratum = permute(sample_index % count, count, uint32_t(hash));
+        return (stratum + jitter(hash, 0)) / count;
+    }
+
+    vec3 get_2d() override {
+        // The grid can have a few more cells than there are samples; the permutation spreads
+        // the samples over a random subset of them, which keeps every cell equally likely.
+        auto hash = pixel_hash(dimension, seed);
+        dimension += 2;
+        auto cell = permute(sample_index % count, grid_x * grid_y, uint32_t(hash));
+        auto x = (cell % grid_x + jitter(hash, 0)) / grid_x;
+        auto y = (cell / grid_x + jitter(hash, 1)) / grid_y;
+        return vec3(x, y, 0);
+    }
+
+  private:
+    uint32_t count;
+    uint32_t grid_x, grid_y;
+    uint64_t seed;
+
+    double jitter(uint64_t hash, uint32_t axis) const {
+        return to_unit(uint32_t(mix_bits(hash ^ (uint64_t(sample_index) << 1 | axis)) >> 32));
+    }
+
+    static uint32_t permute(uint32_t i, uint32_t l, uint32_t p) {
+        // Returns element i of a pseudo-random permutation of [0,l) chosen by p, without storing
+        // it (Kensler, "Correlated Multi-Jittered Sampling", 2013).
+        uint32_t w = l - 1;
+        w |= w >> 1;
+        w |= w >> 2;
+        w |= w >> 4;
+        w |= w >> 8;
+        w |= w >> 16;
+        do {
+            i ^= p;             i *= 0xe170893d;
+            i ^= p >> 16;
+            i ^= (i & w) >> 4;
+            i ^= p >> 8;        i *= 0x0929eb3f;
+            i ^= p >> 23;
+            i ^= (i & w) >> 1;  i *= 1 | p >> 27;
+                                i *= 0x6935fa69;
+            i ^= (i & w) >> 11; i *= 0x74dcb303;
+            i ^= (i & w) >> 2;  i *= 0x9e501cc3;
+            i ^= (i & w) >> 2;  i *= 0xc860a3df;
+            i &= w;
+            i ^= i >> 5;
+        } while (i >= l);
+        return (i + p) % l;
+    }
+};
+
+class sobol_sampler : public sampler {
+  public:
+    // Owen-scrambled Sobol points (Burley, "Practical Hash-based Owen Scrambling", 2020). Every
+    // pair of dimensions is the two dimensional Sobol sequence, whose prefixes of any power of
+    // two length are stratified in every elementary interval. The pairs are decorrelated by
+    // shuffling the sample index, and randomized by scrambling the points, both with hashes of
+    // the pixel and dimension, so no tables are needed beyond the first two Sobol dimensions.
+
+    sobol_sampler(uint64_t seed) : seed(seed) {}
+
+    std::unique_ptr<sampler> clone() const override { return std::make_unique<sobol_sampler>(*this); }
+
+    double get_1d() override {
+        auto hash = pixel_hash(dimension++, seed);
+        auto index = owen_scramble(sample_index, uint32_t(hash));
+        return to_unit(owen_scramble(sobol(index, 0), uint32_t(hash >> 32)));
+    }
+
+    vec3 get_2d() override {
+        auto hash = pixel_hash(dimension, seed);
+        dimension += 2;
+        auto index = owen_scramble(sample_index, uint32_t(hash));
+        auto x = owen_scramble(sobol(index, 0), uint32_t(hash >> 32));
+        auto y = owen_scramble(sobol(index, 1), uint32_t(mix_bits(hash)));
+        return vec3(to_unit(x), to_unit(y), 0);
+    }
+
+    static uint32_t sobol(uint32_t index, int dim) {
+        // Dimension 0 and 1 of the Sobol sequence, as 32-bit fractions. Dimension 0 is the van
+        // der Corput sequence; dimension 1 uses the direction numbers of the polynomial x + 1.
+        uint32_t result = 0;
+        uint32_t v = 1u << 31;
+        for (; index; index >>= 1) {
+            if (index & 1)
+                result ^= v;
+            v = dim == 0 ? v >> 1 : v ^ (v >> 1);
+        }
+        return result;
+    }
+
+    static uint32_t owen_scramble(uint32_t x, uint32_t seed) {
+        // Nested uniform scrambling of the bits of x: each bit is flipped depending on all the
+        // bits above it (Laine-Karras hash, applied to the reversed bits).
+        x = reverse_bits(x);
+        x += seed;
+        x ^= x * 0x6c50b47cu;
+        x ^= x * 0xb82f1e52u;
+        x ^= x * 0xc7afe638u;
+        x ^= x * 0x8d22f6e6u;
+        return reverse_bits(x);
+    }
+
+  private:
+    uint64_t seed;
+
+    static uint32_t reverse_bits(uint32_t x) {
+        x = (x << 16) | (x >> 16);
+        x = ((x & 0x00ff00ffu) << 8) | ((x & 0xff00ff00u) >> 8);
+        x = ((x & 0x0f0f0f0fu) << 4) | ((x & 0xf0f0f0f0u) >> 4);
+        x = ((x & 0x33333333u) << 2) | ((x & 0xccccccccu) >> 2);
+        x = ((x & 0x55555555u) << 1) | ((x & 0xaaaaaaaau) >> 1);
+        return x;
+    }
+};
+
+class blue_noise_sampler : public sampler {
+  public:
+    // Sobol points handed out so that the error is blue noise across the screen (Ahmed and
+    // Wonka, "Screen-Space Blue-Noise Diffusion of Monte Carlo Sampling Error via Hierarchical
+    // Ordering of Pixels", 2020). All pixels share one long Sobol sequence: pixel i, j gets the
+    // samples at its Morton index times the sample count, with the base-4 digits of that index
+    // permuted per dimension. Neighbouring pixels then receive well stratified parts of the
+    // sequence, so their errors cancel when the image is viewed from a distance instead of
+    // forming white noise. The sample count is rounded up to a power of two.
+
+    blue_noise_sampler(int width, int height, int samples_per_pixel, uint64_t seed) : seed(seed) {
+        while ((1 << log2_resolution) < std::max(width, height))
+            log2_resolution++;
+        while ((1 << log2_samples) < samples_per_pixel)
+            log2_samples++;
+        base4_digits = log2_resolution + (log2_samples + 1) / 2;
+    }
+
+    std::unique_ptr<sampler> clone() const override { return std::make_unique<blue_noise_sampler>(*this); }
+
+    double get_1d() override {
+        auto index = shuffled_index(dimension);
+        auto hash = uint32_t(mix_bits(seed + dimension++));
+        return to_unit(sobol_sampler::owen_scramble(sobol_sampler::sobol(index, 0), hash));
+    }
+
+    vec3 get_2d() override {
+        auto index = shuffled_index(dimension);
+        auto hash = mix_bits(seed + dimension);
+        dimension += 2;
+        auto x = sobol_sampler::owen_scramble(sobol_sampler::sobol(index, 0), uint32_t(hash));
+        auto y = sobol_sampler::owen_scramble(sobol_sampler::sobol(index, 1), uint32_t(hash >> 32));
+        return vec3(to_unit(x), to_unit(y), 0);
+    }
+
+  private:
+    uint64_t seed;
+    int log2_resolution = 0;
+    int log2_samples = 0;
+    int base4_digits = 0;
+
+    uint32_t shuffled_index(uint32_t dim) const {
+        // Permutes each base-4 digit of the Morton index with one of the 24 permutations of
+        // 0..3, picked by a hash of the digits above it, so that sibling quads of the pixel
+        // hierarchy get different parts of the sequence in every dimension. With an odd power
+        // of two sample count the lowest digit is a single bit, flipped instead of permuted.
+        static const uint8_t permutations[24][4] = {
+            {0, 1, 2, 3}, {0, 1, 3, 2}, {0, 2, 1, 3}, {0, 2, 3, 1}, {0, 3, 2, 1}, {0, 3, 1, 2},
+            {1, 0, 2, 3}, {1, 0, 3, 2}, {1, 2, 0, 3}, {1, 2, 3, 0}, {1, 3, 2, 0}, {1, 3, 0, 2},
+            {2, 1, 0, 3}, {2, 1, 3, 0}, {2, 0, 1, 3}, {2, 0, 3, 1}, {2, 3, 0, 1}, {2, 3, 1, 0},
+            {3, 1, 2, 0}, {3, 1, 0, 2}, {3, 2, 1, 0}, {3, 2, 0, 1}, {3, 0, 2, 1}, {3, 0, 1, 2}
+        };
+
+        uint64_t morton = (morton_2d(uint32_t(pixel_x), uint32_t(pixel_y)) << log2_samples)
+                        | sample_index;
+        bool odd = log2_samples & 1;
+        uint64_t index = 0;
+
+        for (int digit_index = base4_digits - 1; digit_index >= (odd ? 1 : 0); digit_index--) {
+            int shift = 2 * digit_index - (odd ? 1 : 0);
+            int digit = int((morton >> shift) & 3);
+            uint64_t higher = morton >> (shift + 2);
+            int p = int((mix_bits(higher ^ (0x55555555ULL * dim)) >> 24) % 24);
+            index |= uint64_t(permutations[p][digit]) << shift;
+        }
+
+        if (odd) {
+            uint64_t bit = morton & 1;
+            index |= bit ^ (mix_bits((morton >> 1) ^ (0x55555555ULL * dim)) & 1);
+        }
+
+        return uint32_t(index);
+    }
+
+    static uint64_t morton_2d(uint32_t x, uint32_t y) {
+        return (spread_bits(y) << 1) | spread_bits(x);
+    }
+
+    static uint64_t spread_bits(uint64_t v) {
+        // Moves bit k of v to bit 2k.
+        v &= 0xffffffffULL;
+        v = (v | (v << 16)) & 0x0000ffff0000ffffULL;
+        v = (v | (v << 8))  & 0x00ff00ff00ff00ffULL;
+        v = (v | (v << 4))  & 0x0f0f0f0f0f0f0f0fULL;
+        v = (v | (v << 2))  & 0x3333333333333333ULL;
+        v = (v | (v << 1))  & 0x5555555555555555ULL;
+        return v;
+    }
+};
+
+inline std::unique_ptr<sampler> make_sampler(sampler_type type, int width, int height,
+                                             int samples_per_pixel, uint64_t seed) {
+    switch (type) {
+        case sampler_type::stratified: return std::make_unique<stratified_sampler>(samples_per_pixel, seed);
+        case sampler_type::sobol:      return std::make_unique<sobol_sampler>(seed);
+        case sampler_type::blue_noise: return std::make_unique<blue_noise_sampler>(width, height, samples_per_pixel, seed);
+        default:                       return std::make_unique<independent_sampler>();
+    }
+}
+
+inline const char* sampler_name(sampler_type type) {
+    switch (type) {
+        case sampler_type::stratified: return "stratified";
+        case sampler_type::sobol:      return "sobol";
+        case sampler_type::blue_noise: return "bluenoise";
+        default:                       return "independent";
+    }
+}
+
+inline sampler*& thread_sampler() {
+    // The sampler the current thread's camera sample draws from (none outside of render passes).
+    static thread_local sampler* active = nullptr;
+    return active;
+}
+
+inline double sample_1d() {
+    // Returns the next dimension of the current camera sample, or a random real in [0,1) when
+    // no sampler is active.
+    auto s = thread_sampler();
+    return s ? s->get_1d() : random_double();
+}
+
+inline vec3 sample_2d() {
+    // Returns the next two dimensions of the current camera sample in x and y.
+    auto s = thread_sampler();
+    if (s) return s->get_2d();
+
+    auto x = random_double();
+    auto y = random_double();
+    return vec3(x, y, 0);
+}
@@ -0,0 +1,697 @@
+#pragma once
+
+#include "bvh.h"
+#include "camera.h"
+#include "hittable.h"
+#include "hittable_list.h"
+#include "instance.h"
+#include "material.h"
+#include "mesh.h"
+#include "quad.h"
+#include "sphere.h"
+#include "texture.h"
+#include "transform.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#ifdef _WIN32
+    #ifndef NOMINMAX
+        #define NOMINMAX
+    #endif
+    #include <windows.h>
+#else
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
+
+class mapped_file {
+  public:
+    // A whole file mapped read-only into memory. The pages are read in by the OS as they are
+    // touched, so nothing is copied or parsed up front. data() is null if the file couldn't be
+    // opened or mapped.
+
+    mapped_file(const std::string& filename) {
+#ifdef _WIN32
+        file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+                           OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE)
+            return;
+        LARGE_INTEGER file_size;
+        if (!GetFileSizeEx(file, &file_size) || file_size.QuadPart == 0)
+            return;
+        mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (!mapping)
+            return;
+        bytes = static_cast<const char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+        if (bytes)
+            length = size_t(file_size.QuadPart);
+#else
+        int fd = open(filename.c_str(), O_RDONLY);
+        if (fd < 0)
+            return;
+        struct stat info;
+        if (fstat(fd, &info) == 0 && info.st_size > 0) {
+            void* view = mmap(nullptr, size_t(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+            if (view != MAP_FAILED) {
+                bytes  = static_cast<const char*>(view);
+                length = size_t(info.st_size);
+            }
+        }
+        close(fd);
+#endif
+    }
+
+    ~mapped_file() {
+#ifdef _WIN32
+        if (bytes) UnmapViewOfFile(bytes);
+        if (mapping) CloseHandle(mapping);
+        if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+#else
+        if (bytes) munmap(const_cast<char*>(bytes), length);
+#endif
+    }
+
+    mapped_file(const mapped_file&) = delete;
+    mapped_file& operator=(const mapped_file&) = delete;
+
+    const char* data() const { return bytes; }
+    size_t size() const { return length; }
+
+  private:
+    const char* bytes = nullptr;
+    size_t length = 0;
+#ifdef _WIN32
+    HANDLE file = INVALID_HANDLE_VALUE;
+    HANDLE mapping = nullptr;
+#endif
+};
+
+class scene_cache {
+  public:
+    // A built scene saved as a binary file: every texture, material and object, the bounding
+    // volume hierarchies as they were built, and the camera settings the scene chose. Loading
+    // maps the file and creates the objects straight from its fixed size records, children
+    // before parents, so a cached scene needs no scene file or mesh file parsing and no BVH
+    // build (not even the sort). Only image textures are referenced by file name and decoded
+    // again. The cache also remembers how the scene is rendered (its render_mode).
+    //
+    // The file is a header, an array of records and a data section for variable length
+    // arrays (list members, mesh buffers, file names), all in native byte order. A record
+    // refers to others by their index, which is always smaller than its own. The version is
+    // bumped whenever the layout changes, and a file with another version, or made for
+    // another scene key, is treated as a cache miss. So is a file whose sources (the mesh
+    // files the scene was built from) changed since it was written.
+
+    static std::string file_stamp(const std::string& path) {
+        // The modification time and size of a file, which change when it is edited, or "" if
+        // there is no such file.
+        std::error_code error;
+        auto time = std::filesystem::last_write_time(path, error);
+        if (error)
+            return "";
+        auto size = std::filesystem::file_size(path, error);
+        if (error)
+            return "";
+        return std::to_string(time.time_since_epoch().count()) + ":" + std::to_string(size);
+    }
+
+    static bool save(const std::string& filename, const std::string& key, const hittable& world,
+                     const camera& cam, render_mode mode,
+                     const std::vector<std::string>& sources = {}) {
+        // Writes the scene reachable from `world` to filename (through a temporary file, as
+        // checkpoints are), remembering the stamps of the `sources` files. Returns false,
+        // writing nothing, if the scene holds an object, material or texture the format
+        // doesn't know.
+        scene_cache cache;
+        auto root = cache.add_object(&world);
+        if (!cache.ok)
+            return false;
+
+        // a line with the path, then a line with the stamp, for every source
+        std::string stamps;
+        for (const auto& source : sources)
+            stamps += source + "\n" + file_stamp(source) + "\n";
+
+        header h = {};
+        std::memcpy(h.magic, magic, 4);
+        h.version = version;
+        h.root = root;
+        h.flags = uint32_t(mode);
+        h.key = cache.add_array(key.data(), key.size());
+        h.sources = cache.add_array(stamps.data(), stamps.size());
+        h.record_count = cache.records.size();
+        h.records_offset = sizeof(header);
+        h.data_offset = h.records_offset + h.record_count * sizeof(record);
+        h.data_size = cache.data.size();
+
+        double* c = h.camera;
+        *c++ = cam.aspect_ratio;
+        *c++ = cam.vfov;
+        for (int a = 0; a < 3; a++) *c++ = cam.lookfrom[a];
+        for (int a = 0; a < 3; a++) *c++ = cam.lookat[a];
+        for (int a = 0; a < 3; a++) *c++ = cam.vup[a];
+        for (int a = 0; a < 3; a++) *c++ = cam.background[a];
+        *c++ = cam.defocus_angle;
+        *c++ = cam.focus_dist;
+        h.camera_ints[0] = cam.width;
+        h.camera_ints[1] = cam.samples_per_pixel;
+        h.camera_ints[2] = cam.max_depth;
+
+        auto temp = filename + ".tmp";
+        {
+            std::ofstream out(temp, std::ios::binary);
+            out.write(reinterpret_cast<const char*>(&h), sizeof(h));
+            out.write(reinterpret_cast<const char*>(cache.records.data()), cache.records.size() * sizeof(record));
+            out.write(cache.data.data(), cache.data.size());
+            if (!out) {
+                std::cerr << "ERROR: Could not write scene cache '" << temp << "'.\n";
+                return false;
+            }
+        }
+        std::remove(filename.c_str());
+        std::rename(temp.c_str(), filename.c_str());
+        return true;
+    }
+
+    static std::shared_ptr<hittable> load(const std::string& filename, const std::string& key,
+                                          camera& cam, render_mode& mode) {
+        // Restores a scene written by save() for the same key and sets the camera up as the
+        // scene did. Returns nullptr if there is no usable cache.
+        mapped_file file(filename);
+        if (!file.data())
+            return nullptr;
+
+        header h;
+        if (file.size() < sizeof(h))
+            return rejected(filename, "truncated");
+        std::memcpy(&h, file.data(), sizeof(h));
+        if (std::memcmp(h.magic, magic, 4) != 0 || h.version != version)
+            return rejected(filename, "made by another version");
+        if (h.records_offset != sizeof(header)
+            || h.data_offset != h.records_offset + h.record_count * sizeof(record)
+            || h.data_offset + h.data_size != file.size() || h.root >= h.record_count)
+            return rejected(filename, "truncated");
+
+        scene_cache cache;
+        cache.base = file.data() + h.data_offset;
+        cache.base_size = h.data_size;
+        if (cache.string(h.key) != key)
+            return nullptr;
+
+        std::istringstream stamps(cache.string(h.sources));
+        std::string source, stamp;
+        while (std::getline(stamps, source) && std::getline(stamps, stamp))
+            if (file_stamp(source) != stamp) {
+                std::clog << "Scene cache '" << filename << "' is out of date: '" << source << "' changed\n";
+                return nullptr;
+            }
+
+        // the records are 8 byte aligned in the file, and the mapping is page aligned
+        auto records = reinterpret_cast<const record*>(file.data() + h.records_offset);
+        cache.textures.resize(h.record_count);
+        cache.materials.resize(h.record_count);
+        cache.objects.resize(h.record_count);
+        for (uint32_t i = 0; i < h.record_count && cache.ok; i++)
+            cache.restore(i, records[i]);
+
+        if (!cache.ok || !cache.objects[h.root])
+            return rejected(filename, "damaged");
+
+        const double* c = h.camera;
+        cam.aspect_ratio = *c++;
+        cam.vfov = *c++;
+        cam.lookfrom = point3(c[0], c[1], c[2]);   c += 3;
+        cam.lookat   = point3(c[0], c[1], c[2]);   c += 3;
+        cam.vup      = vec3(c[0], c[1], c[2]);     c += 3;
+        cam.background = color(c[0], c[1], c[2]); c += 3;
+        cam.defocus_angle = *c++;
+        cam.focus_dist = *c++;
+        cam.width = h.camera_ints[0];
+        cam.samples_per_pixel = h.camera_ints[1];
+        cam.max_depth = h.camera_ints[2];
+        mode = render_mode(h.flags);
+
+        return cache.objects[h.root];
+    }
+
+  private:
+    static constexpr char     magic[4] = { 'R', 'T', 'S', 'C' };
+    static constexpr uint32_t version  = 4;
+    static constexpr uint32_t none     = ~0u;
+
+    enum record_type : uint32_t {
+        // textures
+        solid_color_type = 1, checker_type, image_type,
+        // materials
+        lambertian_type = 100, metal_type, dielectric_type, diffuse_light_type, mix_type,
+        texture_mix_type, transparent_type, unlit_type, normal_type, depth_type,
+        fake_shadows_type, traced_shadows_type,
+        // objects
+        list_type = 200, bvh_type, sphere_type, quad_type, translate_type, rotate_y_type,
+        transform_type, instance_type, mesh_type,
+    };
+
+    struct array_ref {
+        uint64_t offset;  // Bytes from the start of the data section
+        uint64_t count;   // Elements
+    };
+
+    struct record {
+        uint32_t  type;
+        uint32_t  refs[3];     // Indices of the records this one uses, or none
+        double    values[12];
+        array_ref arrays[5];
+    };
+
+    struct header {
+        char      magic[4];
+        uint32_t  version;
+        uint32_t  root;        // The record of the world
+        uint32_t  flags;       // The scene's render_mode
+        array_ref key;         // What the cache was made for, checked on load
+        array_ref sources;     // Files the scene was built from and their stamps, checked on load
+        uint64_t  record_count;
+        uint64_t  records_offset;
+        uint64_t  data_offset;
+        uint64_t  data_size;
+        double    camera[16];
+        int32_t   camera_ints[4];
+    };
+
+    // writing
+    std::vector<record> records;
+    std::vector<char> data;
+    std::unordered_map<const void*, uint32_t> ids;  // Records already written, by object
+    bool ok = true;
+
+    // reading
+    const char* base = nullptr;
+    size_t base_size = 0;
+    std::vector<std::shared_ptr<texture>>  textures;
+    std::vector<std::shared_ptr<material>> materials;
+    std::vector<std::shared_ptr<hittable>> objects;
+
+    static std::shared_ptr<hittable> rejected(const std::string& filename, const char* why) {
+        std::cerr << "ERROR: Ignoring scene cache '" << filename << "': " << why << ".\n";
+        return nullptr;
+    }
+
+    array_ref add_array(const void* values, size_t count, size_t element_size = 1) {
+        // Appends to the data section, 8 byte aligned so the arrays can be used in place.
+        data.resize((data.size() + 7) & ~size_t(7));
+        array_ref a = { data.size(), count };
+        auto bytes = static_cast<const char*>(values);
+        data.insert(data.end(), bytes, bytes + count * element_size);
+        return a;
+    }
+
+    template <typename T>
+    array_ref add_array(const std::vector<T>& values) {
+        return add_array(values.data(), values.size(), sizeof(T));
+    }
+
+    uint32_t add_record(const void* source, record r) {
+        auto id = uint32_t(records.size());
+        records.push_back(r);
+        ids[source] = id;
+        return id;
+    }
+
+    static record make_record(uint32_t type) {
+        record r = {};
+        r.type = type;
+        r.refs[0] = r.refs[1] = r.refs[2] = none;
+        return r;
+    }
+
+    static void put(double*& v, const vec3& x) {
+        *v++ = x.x(); *v++ = x.y(); *v++ = x.z();
+    }
+
+    static vec3 get(const double* v) { return vec3(v[0], v[1], v[2]); }
+
+    uint32_t unsupported(const char* kind, const void* object, const std::type_info& type) {
+        if (ok)
+            std::cerr << "ERROR: Can't cache the " << kind << " " << type.name() << ".\n";
+        ok = false;
+        return none;
+    }
+
+    uint32_t add_texture(const texture* tex) {
+        if (!tex) return none;
+        if (auto found = ids.find(tex); found != ids.end()) return found->second;
+
+        if (auto t = dynamic_cast<const solid_color*>(tex)) {
+            auto r = make_record(solid_color_type);
+            auto v = r.values;
+            put(v, t->get_albedo());
+            return add_record(tex, r);
+        }
+        if (auto t = dynamic_cast<const checker_texture*>(tex)) {
+            auto r = make_record(checker_type);
+            r.refs[0] = add_texture(t->get_even().get());
+            r.refs[1] = add_texture(t->get_odd().get());
+            r.values[0] = t->get_scale();
+            return add_record(tex, r);
+        }
+        if (auto t = dynamic_cast<const image_texture*>(tex)) {
+            auto r = make_record(image_type);
+            const auto& filename = t->get_filename();
+            r.arrays[0] = add_array(filename.data(), filename.size());
+            return add_record(tex, r);
+        }
+        return unsupported("texture", tex, typeid(*tex));
+    }
+
+    uint32_t add_material(const material* mat) {
+        if (!mat) return none;
+        if (auto found = ids.find(mat); found != ids.end()) return found->second;
+
+        if (auto m = dynamic_cast<const lambertian*>(mat)) {
+            auto r = make_record(lambertian_type);
+            r.refs[0] = add_texture(m->get_texture().get());
+            return add_record(mat, r);
+        }
+        if (auto m = dynamic_cast<const metal*>(mat)) {
+            auto r = make_record(metal_type);
+            auto v = r.values;
+            put(v, m->get_albedo());
+            *v = m->get_fuzz();
+            return add_record(mat, r);
+        }
+        if (auto m = dynamic_cast<const dielectric*>(mat)) {
+            auto r = make_record(dielectric_type);
+            r.values[0] = m->get_refraction_index();
+            return add_record(mat, r);
+        }
+        if (auto m = dynamic_cast<const diffuse_light*>(mat)) {
+            auto r = make_record(diffuse_light_type);
+            r.refs[0] = add_texture(m->get_texture().get());
+            return add_record(mat, r);
+        }
+        if (auto m = dynamic_cast<const mix*>(mat)) {
+            auto r = make_record(mix_type);
+            r.refs[0] = add_material(m->get_material_a().get());
+            r.refs[1] = add_material(m->get_material_b().get());
+            r.values[0] = m->get_mix();
+            return add_record(mat, r);
+        }
+        if (auto m = dynamic_cast<const textureMix*>(mat)) {
+            auto r = make_record(texture_mix_type);
+            r.refs[0] = add_material(m->get_material_a().get());
+            r.refs[1] = add_material(m->get_material_b().get());
+            r.refs[2] = add_texture(m->get_texture().get());
+            return add_record(mat, r);
+        }
+        if (dynamic_cast<const transparent*>(mat))
+            return add_record(mat, make_record(transparent_type));
+        if (auto m = dynamic_cast<const unlit*>(mat)) {
+            auto r = make_record(unlit_type);
+            auto v = r.values;
+            put(v, m->get_albedo());
+            return add_record(mat, r);
+        }
+        if (dynamic_cast<const normalMat*>(mat))
+            return add_record(mat, make_record(normal_type));
+        if (dynamic_cast<const depthMat*>(mat))
+            return add_record(mat, make_record(depth_type));
+        if (auto m = dynamic_cast<const fakeShadows*>(mat)) {
+            auto r = make_record(fake_shadows_type);
+            auto v = r.values;
+            put(v, m->get_albedo());
+            put(v, m->get_light_position());
+            return add_record(mat, r);
+        }
+        if (auto m = dynamic_cast<const tracedShadows*>(mat)) {
+            auto r = make_record(traced_shadows_type);
+            auto v = r.values;
+            put(v, m->get_albedo());
+            put(v, m->get_light_position());
+            return add_record(mat, r);
+        }
+        return unsupported("material", mat, typeid(*mat));
+    }
+
+    uint32_t add_object(const hittable* object) {
+        if (!object) return none;
+        if (auto found = ids.find(object); found != ids.end()) return found->second;
+
+        if (auto o = dynamic_cast<const hittable_list*>(object)) {
+            std::vector<uint32_t> members;
+            for (const auto& member : o->objects)
+                members.push_back(add_object(member.get()));
+            auto r = make_record(list_type);
+            r.arrays[0] = add_array(members);
+            return add_record(object, r);
+        }
+        if (auto o = dynamic_cast<const bvh_node*>(object)) {
+            auto r = make_record(bvh_type);
+            r.refs[0] = add_object(o->get_left().get());
+            r.refs[1] = add_object(o->get_right().get());
+            auto v = r.values;
+            auto bbox = o->bounding_box();
+            put(v, point3(bbox.x.min, bbox.y.min, bbox.z.min));
+            put(v, point3(bbox.x.max, bbox.y.max, bbox.z.max));
+            *v++ = o->get_depth();
+            *v++ = double(o->get_primitive_count());
+            *v++ = o->get_built_cost();
+            std::vector<uint32_t> primitives;
+            for (const auto& primitive : o->get_primitives())
+                primitives.push_back(add_object(primitive.get()));
+            r.arrays[0] = add_array(primitives);
+            return add_record(object, r);
+        }
+        if (auto o = dynamic_cast<const sphere*>(object)) {
+            auto r = make_record(sphere_type);
+            r.refs[0] = add_material(o->get_material().get());
+            auto v = r.values;
+            put(v, o->get_center(0));
+            put(v, o->get_center(1));
+            *v = o->get_radius();
+            return add_record(object, r);
+        }
+        if (auto o = dynamic_cast<const quad*>(object)) {
+            auto r = make_record(quad_type);
+            r.refs[0] = add_material(o->get_material().get());
+            auto v = r.values;
+            put(v, o->get_corner());
+            put(v, o->get_u());
+            put(v, o->get_v());
+            return add_record(object, r);
+        }
+        if (auto o = dynamic_cast<const translate*>(object)) {
+            auto r = make_record(translate_type);
+            r.refs[0] = add_object(o->inner().get());
+            auto v = r.values;
+            put(v, o->get_offset());
+            return add_record(object, r);
+        }
+        if (auto o = dynamic_cast<const rotate_y*>(object)) {
+            auto r = make_record(rotate_y_type);
+            r.refs[0] = add_object(o->inner().get());
+            r.values[0] = o->get_angle();
+            return add_record(object, r);
+        }
+        if (auto o = dynamic_cast<const transform*>(object)) {
+            auto i = dynamic_cast<const instance*>(object);
+            auto r = make_record(i ? instance_type : transform_type);
+            r.refs[0] = add_object(o->inner().get());
+            r.refs[1] = i ? add_material(i->get_material().get()) : none;
+            std::memcpy(r.values, o->get_transform().m, sizeof(r.values));
+            return add_record(object, r);
+        }
+        if (auto o = dynamic_cast<const triangle_mesh*>(object)) {
+            auto r = make_record(mesh_type);
+            r.refs[0] = add_material(o->get_material().get());
+            r.arrays[0] = add_array(o->positions);
+            r.arrays[1] = add_array(o->normals);
+            r.arrays[2] = add_array(o->uvs);
+            r.arrays[3] = add_array(o->indices);
+            r.arrays[4] = add_array(o->get_nodes());
+            return add_record(object, r);
+        }
+        return unsupported("object", object, typeid(*object));
+    }
+
+    // reading
+
+    template <typename T>
+    const T* array(const array_ref& a) {
+        // The array in the mapped data section, or null (and not ok) if it runs past it.
+        if (a.offset > base_size || a.count > (base_size - a.offset) / sizeof(T)) {
+            ok = false;
+            return nullptr;
+        }
+        return reinterpret_cast<const T*>(base + a.offset);
+    }
+
+    template <typename T>
+    void copy_array(const array_ref& a, std::vector<T>& out) {
+        auto values = array<T>(a);
+        if (values)
+            out.assign(values, values + a.count);
+    }
+
+    std::string string(const array_ref& a) {
+        auto chars = array<char>(a);
+        return chars ? std::string(chars, a.count) : std::string();
+    }
+
+    template <typename T>
+    std::shared_ptr<T> ref(const std::vector<std::shared_ptr<T>>& table, uint32_t id, uint32_t self) {
+        // A record referred to from record `self`; references only go backwards.
+        if (id == none) return nullptr;
+        if (id >= self || !table[id]) {
+            ok = false;
+            return nullptr;
+        }
+        return table[id];
+    }
+
+    std::shared_ptr<texture>  tex_ref(uint32_t id, uint32_t self) { return ref(textures, id, self); }
+    std::shared_ptr<material> mat_ref(uint32_t id, uint32_t self) { return ref(materials, id, self); }
+    std::shared_ptr<hittable> obj_ref(uint32_t id, uint32_t self) { return ref(objects, id, self); }
+
+    void restore(uint32_t id, const record& r) {
+        const double* v = r.values;
+        switch (r.type) {
+            case solid_color_type:
+                textures[id] = std::make_shared<solid_color>(get(v));
+                break;
+            case checker_type: {
+                auto even = tex_ref(r.refs[0], id), odd = tex_ref(r.refs[1], id);
+                if (!even || !odd) break;
+                textures[id] = std::make_shared<checker_texture>(v[0], even, odd);
+                break;
+            }
+            case image_type:
+                textures[id] = std::make_shared<image_texture>(string(r.arrays[0]).c_str());
+                break;
+
+            case lambertian_type:
+                if (auto tex = tex_ref(r.refs[0], id)) materials[id] = std::make_shared<lambertian>(tex);
+                break;
+            case metal_type:
+                materials[id] = std::make_shared<metal>(get(v), v[3]);
+                break;
+            case dielectric_type:
+                materials[id] = std::make_shared<dielectric>(v[0]);
+                break;
+            case diffuse_light_type:
+                if (auto tex = tex_ref(r.refs[0], id)) materials[id] = std::make_shared<diffuse_light>(tex);
+                break;
+            case mix_type: {
+                auto a = mat_ref(r.refs[0], id), b = mat_ref(r.refs[1], id);
+                if (a && b) materials[id] = std::make_shared<mix>(a, b, v[0]);
+                break;
+            }
+            case texture_mix_type: {
+                auto a = mat_ref(r.refs[0], id), b = mat_ref(r.refs[1], id);
+                auto tex = std::dynamic_pointer_cast<image_texture>(tex_ref(r.refs[2], id));
+                if (a && b && tex) materials[id] = std::make_shared<textureMix>(a, b, tex);
+                break;
+            }
+            case transparent_type:
+                materials[id] = std::make_shared<transparent>();
+                break;
+            case unlit_type:
+                materials[id] = std::make_shared<unlit>(get(v));
+                break;
+            case normal_type:
+                materials[id] = std::make_shared<normalMat>();
+                break;
+            case depth_type:
+                materials[id] = std::make_shared<depthMat>();
+                break;
+            case fake_shadows_type:
+                materials[id] = std::make_shared<fakeShadows>(get(v), get(v + 3));
+                break;
+            case traced_shadows_type:
+                materials[id] = std::make_shared<tracedShadows>(get(v), get(v + 3));
+                break;
+
+            case list_type: {
+                auto members = array<uint32_t>(r.arrays[0]);
+                if (!members) break;
+                auto list = std::make_shared<hittable_list>();
+                for (uint64_t k = 0; k < r.arrays[0].count; k++)
+                    if (auto member = obj_ref(members[k], id)) list->add(member);
+                objects[id] = list;
+                break;
+            }
+            case bvh_type: {
+                // the node is restored as it was built; nothing is sorted or measured again
+                auto left = obj_ref(r.refs[0], id), right = obj_ref(r.refs[1], id);
+                std::vector<std::shared_ptr<hittable>> primitives;
+                auto members = array<uint32_t>(r.arrays[0]);
+                for (uint64_t k = 0; members && k < r.arrays[0].count; k++)
+                    primitives.push_back(obj_ref(members[k], id));
+                if (left && right)
+                    objects[id] = std::make_shared<bvh_node>(left, right, aabb(get(v), get(v + 3)),
+                                                             int(v[6]), size_t(v[7]), v[8], primitives);
+                break;
+            }
+            case sphere_type:
+                if (auto mat = mat_ref(r.refs[0], id))
+                    objects[id] = std::make_shared<sphere>(get(v), get(v + 3), v[6], mat);
+                break;
+            case quad_type:
+                if (auto mat = mat_ref(r.refs[0], id))
+                    objects[id] = std::make_shared<quad>(get(v), get(v + 3), get(v + 6), mat);
+                break;
+            case translate_type:
+                if (auto object = obj_ref(r.refs[0], id))
+                    objects[id] = std::make_shared<translate>(object, get(v));
+                break;
+            case rotate_y_type:
+                if (auto object = obj_ref(r.refs[0], id))
+                    objects[id] = std::make_shared<rotate_y>(object, v[0]);
+                break;
+            case transform_type:
+            case instance_type: {
+                auto object = obj_ref(r.refs[0], id);
+                if (!object) break;
+                affine to_world;
+                std::memcpy(to_world.m, v, sizeof(to_world.m));
+                if (r.type == transform_type)
+                    objects[id] = std::make_shared<transform>(object, to_world);
+                else
+                    objects[id] = std::make_shared<instance>(object, to_world, mat_ref(r.refs[1], id));
+                break;
+            }
+            case mesh_type: {
+                // the buffers and the tree are copied out of the mapping as they are, and the
+                // mesh checks them before it trusts them
+                auto mat = mat_ref(r.refs[0], id);
+                if (!mat) break;
+                auto mesh = std::make_shared<triangle_mesh>(mat);
+                std::vector<triangle_mesh::node> tree;
+                copy_array(r.arrays[0], mesh->positions);
+                copy_array(r.arrays[1], mesh->normals);
+                copy_array(r.arrays[2], mesh->uvs);
+                copy_array(r.arrays[3], mesh->indices);
+                copy_array(r.arrays[4], tree);
+                if (ok && mesh->set_tree(std::move(tree)))
+                    objects[id] = mesh;
+                break;
+            }
+            default:
+                ok = false;
+        }
+
+        // a record that was understood produced exactly one thing
+        if (!textures[id] && !materials[id] && !objects[id])
+            ok = false;
+    }
+};
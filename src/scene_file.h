@@ -0,0 +1,679 @@
+#pragma once
+
+#include "affine.h"
+#include "animation.h"
+#include "bvh.h"
+#include "camera.h"
+#include "hittable.h"
+#include "hittable_list.h"
+#include "instance.h"
+#include "material.h"
+#include "mesh_loader.h"
+#include "quad.h"
+#include "sphere.h"
+#include "texture.h"
+#include "transform.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+class scene_file {
+  public:
+    // A scene described in a text file, so scenes and their camera settings can change without
+    // a recompile. The scenes/ directory has one file for each of the scenes that used to be
+    // built in main.cpp.
+    //
+    // Every line is one statement: a keyword and its arguments, separated by spaces. Anything
+    // after a # is a comment. Numbers may be written as fractions (16/9), file names may be
+    // quoted, and X Y Z stands for three numbers. Names are defined before they are used.
+    //
+    //   Camera (the camera.h fields of the same name)
+    //     aspect_ratio N, width N, samples_per_pixel N, max_depth N, background R G B,
+    //     vfov N, lookfrom X Y Z, lookat X Y Z, vup X Y Z, defocus_angle N, focus_dist N
+    //     render image | image+outlines | normals | outlines
+    //
+    //   Textures, where COLOR is R G B or the name of a texture
+    //     texture NAME solid R G B
+    //     texture NAME checker SCALE COLOR COLOR
+    //     texture NAME image FILE
+    //
+    //   Materials (the material.h classes)
+    //     material NAME lambertian COLOR            material NAME diffuse_light COLOR
+    //     material NAME metal R G B FUZZ            material NAME dielectric INDEX
+    //     material NAME mix MATERIAL MATERIAL V     material NAME textureMix MATERIAL MATERIAL IMAGE
+    //     material NAME unlit R G B                 material NAME transparent
+    //     material NAME normalMat                   material NAME depthMat
+    //     material NAME fakeShadows R G B X Y Z     material NAME tracedShadows R G B X Y Z
+    //
+    //   Objects
+    //     sphere X Y Z RADIUS MATERIAL
+    //     moving_sphere X Y Z X Y Z RADIUS MATERIAL
+    //     quad X Y Z UX UY UZ VX VY VZ MATERIAL
+    //     box X Y Z X Y Z MATERIAL                  (two opposite corners)
+    //     mesh FILE MATERIAL                        (.obj or .ply, see mesh_loader.h)
+    //     instance OBJECT MATERIAL|- OPERATIONS     (- keeps the object's own materials)
+    //
+    //   Blocks, each closed by a line with just `end`
+    //     bvh                    a bvh_node over the objects in the block
+    //     transform OPERATIONS   a transform of the objects in the block
+    //     object NAME            defines an object for `instance` instead of adding it
+    //
+    //   Operations, composed left to right like the matrices they stand for
+    //     translate X Y Z, rotate AX AY AZ DEGREES, rotate_y DEGREES, scale S, scale X Y Z,
+    //     fit X Y Z HEIGHT (scales the object to HEIGHT tall, standing centred on X Y Z)
+    //
+    //   Animation (see animation.h), key times in seconds
+    //     key TIME lookfrom X Y Z, key TIME lookat X Y Z
+    //     key TIME X Y Z         right after a sphere: its center
+    //     key TIME OPERATIONS    right after a transform line: the same operations, new values
+    //
+    // The file is read in a single pass: each statement creates its texture, material or
+    // object on the spot, and the only lookups are of names. Load times are logged, with the
+    // time spent building BVHs and loading meshes separate from the parsing.
+
+    static std::shared_ptr<hittable> load(const std::string& filename, camera& cam, render_mode& mode,
+                                          std::vector<std::string>* sources = nullptr) {
+        // Builds the scene in filename and sets the camera up for it. Returns nullptr, after
+        // saying what is wrong and where, if the file can't be read or has an error. If
+        // `sources` is given, it gets the paths of the mesh files the scene loaded.
+        auto start = std::chrono::steady_clock::now();
+        trace_span span("scene setup", "scene");
+
+        scene_file file(filename, cam);
+        if (!file.read())
+            return nullptr;
+        file.parse();
+        if (!file.ok)
+            return nullptr;
+
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        std::clog << "Loaded scene '" << filename << "': " << file.statements << " statements, "
+                  << file.object_count << " objects in " << seconds << "s (" << seconds - file.build_seconds
+                  << "s parsing, " << file.build_seconds << "s building BVHs and loading meshes)\n";
+        cam.stats.seconds[int(phase::scene)] += seconds - file.build_seconds;
+        cam.stats.seconds[int(phase::bvh)]   += file.build_seconds;
+
+        mode = file.mode;
+        if (sources)
+            *sources = file.mesh_files;
+        return std::make_shared<hittable_list>(std::move(file.blocks.front().contents));
+    }
+
+    static std::string find(const std::string& name) {
+        // Looks for a scene as given, then as scenes/name or scenes/name.scene here and in up
+        // to six parent directories. Returns "" if there is none.
+        auto exists = [](const std::string& path) {
+            auto f = std::fopen(path.c_str(), "rb");
+            if (f) std::fclose(f);
+            return f != nullptr;
+        };
+
+        if (exists(name))
+            return name;
+
+        std::string prefix = "scenes/";
+        for (int level = 0; level <= 6; level++, prefix = "../" + prefix) {
+            if (exists(prefix + name))
+                return prefix + name;
+            if (exists(prefix + name + ".scene"))
+                return prefix + name + ".scene";
+        }
+        return "";
+    }
+
+  private:
+    enum block_kind { world_block, bvh_block, transform_block, object_block };
+    enum operation { translate_op, rotate_op, rotate_y_op, scale_op, fit_op };
+
+    struct parameters {
+        // The numbers of a list of operations, interpolated one by one by keyframes.
+        std::vector<double> values;
+
+        friend parameters operator*(double t, const parameters& p) {
+            parameters result = p;
+            for (auto& v : result.values) v *= t;
+            return result;
+        }
+
+        friend parameters operator+(const parameters& a, const parameters& b) {
+            parameters result = a;
+            for (size_t i = 0; i < result.values.size(); i++) result.values[i] += b.values[i];
+            return result;
+        }
+    };
+
+    struct block {
+        block(block_kind kind) : kind(kind) {}
+
+        block_kind kind;
+        std::string name;                // Object blocks: the name it defines
+        std::vector<operation> ops;      // Transform blocks: the operations
+        parameters values;               //   and their numbers
+        keyframes<parameters> keys;      //   over time, if animated
+        hittable_list contents;
+    };
+
+    camera& cam;
+    std::string filename;
+    std::string text;
+    const char* cursor = nullptr;    // The next character of the current statement
+    const char* line_end = nullptr;  // The end of the current statement's line
+    int line = 0;
+    bool ok = true;
+
+    size_t statements = 0;
+    size_t object_count = 0;
+    double build_seconds = 0;
+    render_mode mode = render_mode::image;
+    std::vector<std::string> mesh_files;  // Where the meshes were found
+
+    std::unordered_map<std::string, std::shared_ptr<texture>>  textures;
+    std::unordered_map<std::string, std::shared_ptr<material>> materials;
+    std::unordered_map<std::string, std::shared_ptr<hittable>> objects;
+    std::vector<block> blocks;       // The world, then the blocks open around the current line
+
+    // what a key line animates: the sphere, or the open transform block, of the line before it
+    std::shared_ptr<sphere> key_sphere;
+    bool key_transform = false;
+    std::vector<std::pair<std::shared_ptr<sphere>, keyframes<point3>>> sphere_tracks;
+
+    scene_file(const std::string& filename, camera& cam) : cam(cam), filename(filename) {
+        blocks.push_back(block{world_block});
+    }
+
+    bool read() {
+        std::ifstream in(filename, std::ios::binary | std::ios::ate);
+        if (!in) {
+            std::cerr << "ERROR: Could not open scene file '" << filename << "'.\n";
+            return false;
+        }
+        text.resize(size_t(in.tellg()));
+        in.seekg(0);
+        in.read(&text[0], std::streamsize(text.size()));
+        return bool(in);
+    }
+
+    void parse() {
+        const char* next = text.c_str();
+        const char* end = next + text.size();
+        while (ok && next < end) {
+            line++;
+            cursor = next;
+            line_end = static_cast<const char*>(std::memchr(next, '\n', size_t(end - next)));
+            if (!line_end)
+                line_end = end;
+            next = line_end + 1;
+
+            auto keyword = word();
+            if (keyword.empty())
+                continue;
+            statements++;
+            statement(keyword);
+            if (ok && !at_end())
+                fail("unexpected '" + std::string(word()) + "'");
+        }
+        if (!ok)
+            return;
+
+        if (blocks.size() > 1) {
+            fail("missing 'end'");
+            return;
+        }
+
+        for (auto& track : sphere_tracks) {
+            auto object = track.first;
+            cam.anim.animate(track.second, [object](const point3& center) { object->set_center(center); });
+        }
+    }
+
+    void statement(std::string_view keyword) {
+        if (keyword == "key") {
+            key();
+            return;
+        }
+        key_sphere = nullptr;
+        key_transform = false;
+
+        if (keyword == "sphere") {
+            auto center = vector();
+            auto radius = number();
+            auto mat = named(materials, "material");
+            if (!ok) return;
+            key_sphere = std::make_shared<sphere>(center, radius, mat);
+            add(key_sphere);
+        } else if (keyword == "moving_sphere") {
+            auto center1 = vector();
+            auto center2 = vector();
+            auto radius = number();
+            auto mat = named(materials, "material");
+            if (ok) add(std::make_shared<sphere>(center1, center2, radius, mat));
+        } else if (keyword == "quad") {
+            auto Q = vector();
+            auto u = vector();
+            auto v = vector();
+            auto mat = named(materials, "material");
+            if (ok) add(std::make_shared<quad>(Q, u, v, mat));
+        } else if (keyword == "instance") {
+            auto object = named(objects, "object");
+            auto mat = optional_material();
+            std::vector<operation> ops;
+            parameters values;
+            operations(ops, values);
+            if (ok) add(std::make_shared<instance>(object, place(ops, values, object->bounding_box()), mat));
+        } else if (keyword == "box") {
+            auto a = vector();
+            auto b = vector();
+            auto mat = named(materials, "material");
+            if (ok) add(box(a, b, mat));
+        } else if (keyword == "mesh") {
+            auto mesh_file = std::string(word());
+            auto mat = named(materials, "material");
+            if (!ok) return;
+            auto start = std::chrono::steady_clock::now();
+            trace_span span("mesh load", "scene");
+            auto mesh = load_mesh(mesh_file, mat);
+            build_seconds += seconds_since(start);
+            if (!mesh) {
+                fail("could not load mesh '" + mesh_file + "'");
+                return;
+            }
+            mesh_files.push_back(find_mesh_file(mesh_file));
+            add(mesh);
+        } else if (keyword == "material") {
+            define_material();
+        } else if (keyword == "texture") {
+            define_texture();
+        } else if (keyword == "bvh") {
+            blocks.push_back(block{bvh_block});
+        } else if (keyword == "transform") {
+            block b{transform_block};
+            operations(b.ops, b.values);
+            blocks.push_back(std::move(b));
+            key_transform = true;
+        } else if (keyword == "object") {
+            block b{object_block};
+            b.name = std::string(word());
+            blocks.push_back(std::move(b));
+        } else if (keyword == "end") {
+            end_block();
+        } else if (keyword == "aspect_ratio") {
+            cam.aspect_ratio = number();
+        } else if (keyword == "width") {
+            cam.width = integer();
+        } else if (keyword == "samples_per_pixel") {
+            cam.samples_per_pixel = integer();
+        } else if (keyword == "max_depth") {
+            cam.max_depth = integer();
+        } else if (keyword == "background") {
+            cam.background = vector();
+        } else if (keyword == "vfov") {
+            cam.vfov = number();
+        } else if (keyword == "lookfrom") {
+            cam.lookfrom = vector();
+        } else if (keyword == "lookat") {
+            cam.lookat = vector();
+        } else if (keyword == "vup") {
+            cam.vup = vector();
+        } else if (keyword == "defocus_angle") {
+            cam.defocus_angle = number();
+        } else if (keyword == "focus_dist") {
+            cam.focus_dist = number();
+        } else if (keyword == "render") {
+            auto name = word();
+            if      (name == "image")          mode = render_mode::image;
+            else if (name == "image+outlines") mode = render_mode::image_outlines;
+            else if (name == "normals")        mode = render_mode::normals;
+            else if (name == "outlines")       mode = render_mode::outlines;
+            else fail("unknown render mode '" + std::string(name) + "'");
+        } else {
+            fail("unknown statement '" + std::string(keyword) + "'");
+        }
+    }
+
+    void define_texture() {
+        auto name = std::string(word());
+        auto type = word();
+
+        std::shared_ptr<texture> tex;
+        if (type == "solid") {
+            tex = std::make_shared<solid_color>(vector());
+        } else if (type == "checker") {
+            auto scale = number();
+            auto even = color_or_texture();
+            auto odd = color_or_texture();
+            tex = std::make_shared<checker_texture>(scale, even, odd);
+        } else if (type == "image") {
+            tex = std::make_shared<image_texture>(std::string(word()).c_str());
+        } else {
+            fail("unknown texture type '" + std::string(type) + "'");
+        }
+        textures[name] = tex;
+    }
+
+    void define_material() {
+        auto name = std::string(word());
+        auto type = word();
+
+        std::shared_ptr<material> mat;
+        if (type == "lambertian") {
+            mat = std::make_shared<lambertian>(color_or_texture());
+        } else if (type == "metal") {
+            auto albedo = vector();
+            mat = std::make_shared<metal>(albedo, number());
+        } else if (type == "dielectric") {
+            mat = std::make_shared<dielectric>(number());
+        } else if (type == "diffuse_light") {
+            mat = std::make_shared<diffuse_light>(color_or_texture());
+        } else if (type == "mix") {
+            auto a = named(materials, "material");
+            auto b = named(materials, "material");
+            mat = std::make_shared<mix>(a, b, number());
+        } else if (type == "textureMix") {
+            auto a = named(materials, "material");
+            auto b = named(materials, "material");
+            auto image = std::dynamic_pointer_cast<image_texture>(named(textures, "texture"));
+            if (ok && !image)
+                fail("textureMix needs an image texture");
+            mat = std::make_shared<textureMix>(a, b, image);
+        } else if (type == "unlit") {
+            mat = std::make_shared<unlit>(vector());
+        } else if (type == "transparent") {
+            mat = std::make_shared<transparent>();
+        } else if (type == "normalMat") {
+            mat = std::make_shared<normalMat>();
+        } else if (type == "depthMat") {
+            mat = std::make_shared<depthMat>();
+        } else if (type == "fakeShadows") {
+            auto albedo = vector();
+            mat = std::make_shared<fakeShadows>(albedo, vector());
+        } else if (type == "tracedShadows") {
+            auto albedo = vector();
+            mat = std::make_shared<tracedShadows>(albedo, vector());
+        } else {
+            fail("unknown material type '" + std::string(type) + "'");
+        }
+        materials[name] = mat;
+    }
+
+    void end_block() {
+        if (blocks.size() == 1) {
+            fail("'end' without a block");
+            return;
+        }
+        auto b = std::move(blocks.back());
+        blocks.pop_back();
+        if (b.contents.objects.empty()) {
+            fail("empty block");
+            return;
+        }
+
+        if (b.kind == bvh_block) {
+            auto start = std::chrono::steady_clock::now();
+            trace_span span("bvh build", "scene", "objects", int64_t(b.contents.objects.size()));
+            add(std::make_shared<bvh_node>(std::move(b.contents)));
+            build_seconds += seconds_since(start);
+            return;
+        }
+
+        std::shared_ptr<hittable> contents = b.contents.objects.size() == 1
+            ? b.contents.objects.front() : std::make_shared<hittable_list>(std::move(b.contents));
+
+        if (b.kind == object_block) {
+            objects[b.name] = contents;
+        } else {
+            auto bounds = contents->bounding_box();
+            auto node = std::make_shared<transform>(contents, place(b.ops, b.values, bounds));
+            if (!b.keys.empty()) {
+                auto ops = b.ops;
+                cam.anim.animate(b.keys, [node, ops, bounds](const parameters& values) {
+                    node->set_transform(place(ops, values, bounds));
+                });
+            }
+            add(node);
+        }
+    }
+
+    void key() {
+        auto time = number();
+        auto target = peek();
+
+        if (target == "lookfrom" || target == "lookat") {
+            word();
+            auto value = vector();
+            (target == "lookfrom" ? cam.anim.lookfrom : cam.anim.lookat).add(time, value);
+        } else if (key_sphere) {
+            auto center = vector();
+            if (sphere_tracks.empty() || sphere_tracks.back().first != key_sphere)
+                sphere_tracks.emplace_back(key_sphere, keyframes<point3>());
+            sphere_tracks.back().second.add(time, center);
+        } else if (key_transform) {
+            auto& b = blocks.back();
+            std::vector<operation> ops;
+            parameters values;
+            operations(ops, values);
+            if (ok && ops != b.ops)
+                fail("a key must have the same operations as its transform");
+            b.keys.add(time, values);
+        } else {
+            fail("'key' needs to follow a sphere or transform, or animate lookfrom or lookat");
+        }
+    }
+
+    void operations(std::vector<operation>& ops, parameters& values) {
+        // Reads the operations up to the end of the line, and their numbers.
+        while (ok && !at_end()) {
+            auto op = word();
+            int count = 0;
+            if      (op == "translate") { ops.push_back(translate_op); count = 3; }
+            else if (op == "rotate")    { ops.push_back(rotate_op);    count = 4; }
+            else if (op == "rotate_y")  { ops.push_back(rotate_y_op);  count = 1; }
+            else if (op == "fit")       { ops.push_back(fit_op);       count = 4; }
+            else if (op == "scale") {
+                // a single factor scales uniformly
+                ops.push_back(scale_op);
+                auto s = number();
+                values.values.push_back(s);
+                values.values.push_back(next_is_number() ? number() : s);
+                values.values.push_back(next_is_number() ? number() : s);
+            } else {
+                fail("unknown operation '" + std::string(op) + "'");
+            }
+            for (int i = 0; i < count; i++)
+                values.values.push_back(number());
+        }
+    }
+
+    static affine place(const std::vector<operation>& ops, const parameters& values, const aabb& bounds) {
+        // The map from an object with the given bounds to the world that the operations
+        // describe.
+        affine result;
+        const double* v = values.values.data();
+        for (auto op : ops) {
+            switch (op) {
+                case translate_op:
+                    result = result * affine::translation(vec3(v[0], v[1], v[2]));
+                    v += 3;
+                    break;
+                case rotate_op:
+                    result = result * affine::rotation(vec3(v[0], v[1], v[2]), v[3]);
+                    v += 4;
+                    break;
+                case rotate_y_op:
+                    result = result * affine::rotation(vec3(0, 1, 0), v[0]);
+                    v += 1;
+                    break;
+                case scale_op:
+                    result = result * affine::scaling(vec3(v[0], v[1], v[2]));
+                    v += 3;
+                    break;
+                case fit_op: {
+                    auto s = v[3] / std::fmax(bounds.y.size(), 1e-9);
+                    auto base = point3((bounds.x.min + bounds.x.max) / 2, bounds.y.min,
+                                       (bounds.z.min + bounds.z.max) / 2);
+                    result = result * affine::translation(vec3(v[0], v[1], v[2]))
+                           * affine::scaling(vec3(s, s, s)) * affine::translation(-base);
+                    v += 4;
+                    break;
+                }
+            }
+        }
+        return result;
+    }
+
+    void add(std::shared_ptr<hittable> object) {
+        blocks.back().contents.add(object);
+        object_count++;
+    }
+
+    template <typename T>
+    std::shared_ptr<T> named(const std::unordered_map<std::string, std::shared_ptr<T>>& names,
+                             const char* what) {
+        auto name = word();
+        auto found = names.find(std::string(name));
+        if (found != names.end())
+            return found->second;
+        if (ok)
+            fail(std::string("unknown ") + what + " '" + std::string(name) + "'");
+        return nullptr;
+    }
+
+    std::shared_ptr<material> optional_material() {
+        if (peek() != "-")
+            return named(materials, "material");
+        word();
+        return nullptr;
+    }
+
+    std::shared_ptr<texture> color_or_texture() {
+        if (next_is_number())
+            return std::make_shared<solid_color>(vector());
+        return named(textures, "texture");
+    }
+
+    // tokens
+
+    void skip_space() {
+        while (cursor < line_end && (*cursor == ' ' || *cursor == '\t' || *cursor == '\r'))
+            cursor++;
+        if (cursor < line_end && *cursor == '#')
+            cursor = line_end;
+    }
+
+    bool at_end() {
+        skip_space();
+        return cursor == line_end;
+    }
+
+    bool is_separator(char c) const {
+        return c == ' ' || c == '\t' || c == '\r' || c == '#';
+    }
+
+    std::string_view word() {
+        // The next word, or the text between the next pair of double quotes.
+        skip_space();
+        if (cursor < line_end && *cursor == '"') {
+            auto begin = ++cursor;
+            while (cursor < line_end && *cursor != '"')
+                cursor++;
+            std::string_view quoted(begin, size_t(cursor - begin));
+            if (cursor < line_end)
+                cursor++;
+            else
+                fail("missing '\"'");
+            return quoted;
+        }
+
+        auto begin = cursor;
+        while (cursor < line_end && !is_separator(*cursor))
+            cursor++;
+        return std::string_view(begin, size_t(cursor - begin));
+    }
+
+    std::string_view peek() {
+        auto at = cursor;
+        auto next = word();
+        cursor = at;
+        return next;
+    }
+
+    bool next_is_number() {
+        skip_space();
+        return next_digit_or_sign();
+    }
+
+    bool next_digit_or_sign() const {
+        if (cursor == line_end)
+            return false;
+        char c = *cursor;
+        return (c >= '0' && c <= '9') || c == '-' || c == '+' || c == '.';
+    }
+
+    double number() {
+        if (!next_is_number()) {
+            if (ok)
+                fail(at_end() ? "missing number" : "expected a number at '" + std::string(peek()) + "'");
+            return 0;
+        }
+
+        // strtod stops at the space or line break after the number, so it never reads past
+        // the line
+        char* end;
+        double value = std::strtod(cursor, &end);
+        cursor = end;
+        if (cursor < line_end && *cursor == '/') {
+            // the divisor follows right after the slash, on the same line
+            cursor++;
+            if (!next_digit_or_sign()) {
+                fail("expected a number after '/'");
+                return 0;
+            }
+            double divisor = std::strtod(cursor, &end);
+            if (end == cursor) {
+                fail("expected a number after '/'");
+                return 0;
+            }
+            if (divisor == 0) {
+                fail("division by zero");
+                return 0;
+            }
+            value /= divisor;
+            cursor = end;
+        }
+        if (cursor < line_end && !is_separator(*cursor))
+            fail("expected a number at '" + std::string(word()) + "'");
+        return value;
+    }
+
+    int integer() {
+        auto value = number();
+        if (ok && value != int(value))
+            fail("expected a whole number");
+        return int(value);
+    }
+
+    vec3 vector() {
+        auto x = number();
+        auto y = number();
+        auto z = number();
+        return vec3(x, y, z);
+    }
+
+    void fail(const std::string& message) {
+        std::cerr << "ERROR: " << filename << " line " << line << ": " << message << ".\n";
+        ok = false;
+        cursor = line_end;
+    }
+
+    static double seconds_since(std::chrono::steady_clock::time_point start) {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+};
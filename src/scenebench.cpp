@@ -0,0 +1,316 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "rtweekend.h"
+
+#include "benchmark.h"
+#include "image_compare.h"
+#include "mesh_loader.h"
+
+// End-to-end benchmark: renders every scene with the renderer executable at a fixed width,
+// sample count and seed, and reports wall time, Mrays/s, samples/s and peak memory from the
+// renderer's --stats file. Runs can be saved as a baseline, and later runs fail (exit code 1)
+// if a scene's samples/s dropped by more than the threshold. With --nee it instead measures
+// what direct light sampling buys at equal render time. Scenes whose mesh files aren't there
+// are skipped. Build with scenebench.bat.
+
+struct scene_result {
+    std::string name;
+    double wall_seconds = 0;        // Whole process: startup, scene load, render, encoding
+    double render_seconds = 0;      // Render and outline passes
+    double mrays_per_second = 0;
+    double samples_per_second = 0;  // Pixel samples actually rendered per second of render_seconds
+    double peak_rss_bytes = 0;
+};
+
+class scene_bench {
+  public:
+    std::string renderer;            // The renderer executable
+    std::string work_dir = "bench_output";
+    int    width = 200;
+    int    spp = 8;
+    int    runs = 3;                 // Renders per scene; the fastest counts
+    int    threads = 0;
+    uint64_t seed = 0x5eed;
+    std::string render_mode;         // Overrides the scenes' render mode when set
+
+    bool render(const std::string& scene, const std::string& options, const std::string& stem,
+                double& wall_seconds, std::string& stats) const {
+        // Runs the renderer on a scene with the fixed settings plus `options`, writing
+        // stem.png and stem.json. Returns the stats file's text.
+        std::filesystem::create_directories(work_dir);
+        auto output = (std::filesystem::path(work_dir) / stem).string();
+        std::ostringstream command;
+        command << quoted(renderer) << " --scene " << quoted(scene) << " --width " << width
+                << " --seed " << seed << " --threads " << threads
+                << (render_mode.empty() ? "" : " --render " + render_mode)
+                << " --output " << quoted(output + ".png") << " --stats " << quoted(output + ".json")
+                << " " << options << " > " << quoted(output + ".log") << " 2>&1";
+
+        auto start = std::chrono::steady_clock::now();
+        int status = run_command(command.str());
+        wall_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        if (status != 0) {
+            std::cerr << "ERROR: Rendering '" << scene << "' failed, see " << output << ".log\n";
+            return false;
+        }
+
+        std::ifstream in(output + ".json");
+        std::stringstream text;
+        text << in.rdbuf();
+        stats = text.str();
+        return !stats.empty();
+    }
+
+    bool measure(const std::string& scene, scene_result& result) const {
+        result = scene_result();
+        result.name = scene;
+        for (int run = 0; run < runs; run++) {
+            double wall;
+            std::string stats;
+            if (!render(scene, "--spp " + std::to_string(spp), scene, wall, stats))
+                return false;
+            if (run > 0 && wall >= result.wall_seconds)
+                continue;
+
+            result.wall_seconds = wall;
+            result.render_seconds = json_number(stats, "render") + json_number(stats, "outline");
+            result.mrays_per_second = json_number(stats, "mrays_per_second");
+            result.samples_per_second = json_number(stats, "samples_per_second");
+            result.peak_rss_bytes = json_number(stats, "peak_rss_bytes");
+        }
+        return true;
+    }
+
+    static std::string missing_mesh(const std::string& scene) {
+        // The first mesh file the scene loads that can't be found, or "" if there is none. The
+        // renderer fails on those, so such scenes are skipped rather than counted as failures.
+        auto path = std::filesystem::exists(scene) ? scene : "scenes/" + scene + ".scene";
+        std::ifstream in(path);
+        std::string line;
+        while (std::getline(in, line)) {
+            std::istringstream words(line);
+            std::string keyword, file;
+            if (!(words >> keyword) || keyword != "mesh")
+                continue;
+            words >> std::ws;
+            if (words.peek() == '"') {
+                words.get();
+                std::getline(words, file, '"');
+            } else {
+                words >> file;
+            }
+            if (find_mesh_file(file).empty())
+                return file;
+        }
+        return "";
+    }
+
+    void write_json(std::ostream& out, const std::vector<scene_result>& results) const {
+        // One scene per line, which compare() relies on.
+        out << "{\n  \"width\": " << width << ",\n  \"spp\": " << spp << ",\n  \"seed\": " << seed
+            << ",\n  \"render\": " << json_string(render_mode) << ",\n  \"scenes\": [";
+        for (size_t i = 0; i < results.size(); i++) {
+            const auto& r = results[i];
+            out << (i ? ",\n" : "\n") << "    { \"name\": " << json_string(r.name)
+                << ", \"wall_seconds\": " << r.wall_seconds
+                << ", \"render_seconds\": " << r.render_seconds
+                << ", \"mrays_per_second\": " << r.mrays_per_second
+                << ", \"samples_per_second\": " << r.samples_per_second
+                << ", \"peak_rss_bytes\": " << uint64_t(r.peak_rss_bytes) << " }";
+        }
+        out << "\n  ]\n}\n";
+    }
+
+    bool compare(const std::string& baseline, const std::vector<scene_result>& results,
+                 double threshold) const {
+        // Returns false if any scene's samples/s is more than `threshold` (a fraction) below
+        // the baseline's. Peak memory growth beyond the threshold is reported but not fatal.
+        if (json_number(baseline, "width") != width || json_number(baseline, "spp") != spp
+            || json_number(baseline, "seed") != double(seed)) {
+            std::cerr << "ERROR: The baseline was made with other settings (--width, --spp, --seed)\n";
+            return false;
+        }
+
+        bool ok = true;
+        std::printf("\n%-28s %14s %14s %9s\n", "scene", "baseline S/s", "now S/s", "change");
+        for (const auto& r : results) {
+            auto line = baseline_line(baseline, r.name);
+            if (line.empty()) {
+                std::printf("%-28s %14s\n", r.name.c_str(), "(new)");
+                continue;
+            }
+            double before = json_number(line, "samples_per_second");
+            double change = before > 0 ? r.samples_per_second / before - 1 : 0;
+            bool regressed = change < -threshold;
+            std::printf("%-28s %14.0f %14.0f %+8.1f%%%s\n", r.name.c_str(), before,
+                        r.samples_per_second, 100 * change, regressed ? "  REGRESSION" : "");
+            ok = ok && !regressed;
+
+            double rss_before = json_number(line, "peak_rss_bytes");
+            if (rss_before > 0 && r.peak_rss_bytes > (1 + threshold) * rss_before)
+                std::printf("%-28s peak memory grew from %.1f to %.1f MB\n", "",
+                            rss_before / 1048576, r.peak_rss_bytes / 1048576);
+        }
+        return ok;
+    }
+
+    bool compare_light_sampling(const std::string& scene, double seconds, int reference_spp) const {
+        // Renders a reference at reference_spp with light sampling, then the scene with and
+        // without light sampling for `seconds` each, and prints the samples per pixel each
+        // reached and their RMSE against the reference. Always renders the image, without
+        // outlines.
+        double wall;
+        std::string stats;
+        std::clog << "Rendering the reference at " << reference_spp << " spp\n";
+        if (!render(scene, "--render image --spp " + std::to_string(reference_spp), "nee_reference", wall, stats))
+            return false;
+        rgb_image reference;
+        reference.load((std::filesystem::path(work_dir) / "nee_reference.png").string());
+
+        std::printf("%-16s %10s %10s\n", "light sampling", "spp", "rmse");
+        for (auto setting : { "off", "on" }) {
+            auto stem = std::string("nee_") + setting;
+            auto options = "--render image --spp 1000000 --pass 4 --flush 0 --time-budget " + std::to_string(seconds)
+                         + " --light-sampling " + setting;
+            if (!render(scene, options, stem, wall, stats))
+                return false;
+
+            rgb_image image;
+            image.load((std::filesystem::path(work_dir) / (stem + ".png")).string());
+            if (!image.same_size(reference)) {
+                std::cerr << "ERROR: Could not compare '" << stem << ".png' with the reference\n";
+                return false;
+            }
+            double pixels = json_number(stats, "width") * json_number(stats, "height");
+            std::printf("%-16s %10.0f %10.2f\n", setting, json_number(stats, "pixel_samples") / pixels,
+                        rmse(image, reference));
+        }
+        return true;
+    }
+
+  private:
+    static std::string quoted(const std::string& text) { return "\"" + text + "\""; }
+
+    static std::string baseline_line(const std::string& baseline, const std::string& scene) {
+        auto at = baseline.find("\"name\": " + json_string(scene));
+        if (at == std::string::npos)
+            return "";
+        auto end = baseline.find('\n', at);
+        return baseline.substr(at, end == std::string::npos ? std::string::npos : end - at);
+    }
+};
+
+int main(int argc, char* argv[]) {
+    scene_bench bench;
+#ifdef _WIN32
+    bench.renderer = "a.exe";
+#else
+    bench.renderer = "./a.out";
+#endif
+    std::vector<std::string> scenes;
+    std::string baseline_file;
+    std::string json_file;
+    bool update_baseline = false;
+    double threshold = 0.1;
+    std::string nee_scene = "cornell_box";
+    double nee_seconds = 0;
+    int nee_reference_spp = 1000;
+
+    for (int a = 1; a < argc; a++) {
+        std::string arg = argv[a];
+        if (arg == "--update-baseline") {
+            update_baseline = true;
+            continue;
+        }
+        if (a + 1 >= argc) {
+            std::cerr << "Missing value for option '" << arg << "'\n";
+            return 1;
+        }
+        std::string value = argv[++a];
+
+        if      (arg == "--renderer")      bench.renderer      = value;
+        else if (arg == "--scene")         scenes.push_back(value);
+        else if (arg == "--width")         bench.width         = std::stoi(value);
+        else if (arg == "--spp")           bench.spp           = std::stoi(value);
+        else if (arg == "--seed")          bench.seed          = std::stoull(value);
+        else if (arg == "--runs")          bench.runs          = std::stoi(value);
+        else if (arg == "--threads")       bench.threads       = std::stoi(value);
+        else if (arg == "--render")        bench.render_mode   = value;
+        else if (arg == "--work-dir")      bench.work_dir      = value;
+        else if (arg == "--baseline")      baseline_file       = value;
+        else if (arg == "--threshold")     threshold           = std::stod(value);
+        else if (arg == "--json")          json_file           = value;
+        else if (arg == "--nee")           nee_seconds         = std::stod(value);
+        else if (arg == "--nee-scene")     nee_scene           = value;
+        else if (arg == "--nee-reference") nee_reference_spp   = std::stoi(value);
+        else {
+            std::cerr << "Unknown option '" << arg << "'\n";
+            return 1;
+        }
+    }
+
+    //--nee SECONDS: direct light sampling against plain path tracing at equal time
+    if (nee_seconds > 0)
+        return bench.compare_light_sampling(nee_scene, nee_seconds, nee_reference_spp) ? 0 : 1;
+
+    //by default every scene in scenes/
+    if (scenes.empty()) {
+        for (const auto& entry : std::filesystem::directory_iterator("scenes"))
+            if (entry.path().extension() == ".scene")
+                scenes.push_back(entry.path().stem().string());
+        std::sort(scenes.begin(), scenes.end());
+    }
+
+    std::printf("%-28s %10s %10s %10s %12s %10s\n", "scene", "wall s", "render s", "Mrays/s",
+                "Msamples/s", "peak MB");
+    std::vector<scene_result> results;
+    bool all_rendered = true;
+    for (const auto& scene : scenes) {
+        auto missing = scene_bench::missing_mesh(scene);
+        if (!missing.empty()) {
+            std::printf("%-28s skipped: no mesh file '%s'\n", scene.c_str(), missing.c_str());
+            continue;
+        }
+
+        scene_result r;
+        if (!bench.measure(scene, r)) {
+            all_rendered = false;
+            continue;
+        }
+        std::printf("%-28s %10.3f %10.3f %10.3f %12.3f %10.1f\n", r.name.c_str(), r.wall_seconds,
+                    r.render_seconds, r.mrays_per_second, r.samples_per_second * 1e-6,
+                    r.peak_rss_bytes / 1048576);
+        std::fflush(stdout);
+        results.push_back(r);
+    }
+
+    if (!json_file.empty()) {
+        std::ofstream out(json_file);
+        bench.write_json(out, results);
+    }
+
+    if (baseline_file.empty())
+        return all_rendered ? 0 : 1;
+
+    std::ifstream in(baseline_file);
+    if (!in || update_baseline) {
+        in.close();
+        std::ofstream out(baseline_file);
+        bench.write_json(out, results);
+        std::clog << "Baseline written to '" << baseline_file << "'\n";
+        return all_rendered ? 0 : 1;
+    }
+
+    std::stringstream baseline;
+    baseline << in.rdbuf();
+    bool ok = bench.compare(baseline.str(), results, threshold);
+    return ok && all_rendered ? 0 : 1;
+}
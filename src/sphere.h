@@ -1,6 +1,7 @@
 #pragma once
 
 #include "hittable.h"
+#include "onb.h"
 
 class sphere : public hittable {
   public:
@@ -9,8 +10,7 @@ class sphere : public hittable {
     sphere(const point3& static_center, double radius, std::shared_ptr<material> mat)
       : center(static_center, vec3(0,0,0)), radius(std::fmax(0,radius)), mat(mat)
     {
-        auto rvec = vec3(radius, radius, radius);
-        bbox = aabb(static_center - rvec, static_center + rvec);
+        set_bounding_box();
     }
 
     // Moving Sphere
@@ -18,13 +18,62 @@ class sphere : public hittable {
            std::shared_ptr<material> mat)
       : center(center1, center2 - center1), radius(std::fmax(0,radius)), mat(mat)
       {
-        auto rvec = vec3(radius, radius, radius);
-        aabb box1(center.at(0) - rvec, center.at(0) + rvec);
-        aabb box2(center.at(1) - rvec, center.at(1) + rvec);
-        bbox = aabb(box1, box2);
+        set_bounding_box();
       }
 
+    void set_center(const point3& new_center) {
+        // Moves the sphere. Bounding volumes above it need a refit() afterwards.
+        set_center(new_center, new_center);
+    }
+
+    void set_center(const point3& center1, const point3& center2) {
+        center = ray(center1, center2 - center1);
+        set_bounding_box();
+    }
+
     bool hit(const ray& r, interval ray_t, hit_record& rec, const vec3& camPos) const override {
+        RTW_COUNT(counter::sphere_tests);
+        point3 current_center = center.at(r.time());
+        vec3 oc = current_center - r.origin();
+        auto a = r.direction().length_squared();
+        auto h = dot(r.direction(), oc);
+        auto c = oc.length_squared() - radius*radius;
+
+        auto discriminant = h*h - a*c;
+        if (discriminant < 0)
+            return false;
+
+        auto sqrtd = std::sqrt(discriminant);
+
+        // Find the nearest root that lies in the acceptable range and isn't alpha-masked. A
+        // masked near root falls through to the far one, so cutouts show the sphere's inside.
+        double roots[2] = { (h - sqrtd) / a, (h + sqrtd) / a };
+        for (auto root : roots) {
+            if (!ray_t.surrounds(root))
+                continue;
+
+            point3 p = r.at(root);
+            vec3 outward_normal = (p - current_center) / radius;
+            double u, v;
+            get_sphere_uv(outward_normal, u, v);
+            if (mat->alpha_cutout(u, v, p))
+                continue;
+
+            rec.t = root;
+            rec.p = p;
+            rec.set_face_normal(r, outward_normal);
+            rec.set_face_depth(r, camPos);
+            rec.u = u;
+            rec.v = v;
+            rec.mat = mat;
+            return true;
+        }
+
+        return false;
+    }
+
+    bool occluded(const ray& r, interval ray_t) const override {
+        RTW_COUNT(counter::sphere_tests);
         point3 current_center = center.at(r.time());
         vec3 oc = current_center - r.origin();
         auto a = r.direction().length_squared();
@@ -37,28 +86,70 @@ class sphere : public hittable {
 
         auto sqrtd = std::sqrt(discriminant);
 
-        // Find the nearest root that lies in the acceptable range.
-        auto root = (h - sqrtd) / a;
-        if (!ray_t.surrounds(root)) {
-            root = (h + sqrtd) / a;
+        // Either root in range blocks the ray, unless it lands on an alpha-masked texel.
+        double roots[2] = { (h - sqrtd) / a, (h + sqrtd) / a };
+        for (auto root : roots) {
             if (!ray_t.surrounds(root))
-                return false;
+                continue;
+            if (!mat->has_alpha_cutout())
+                return true;
+
+            point3 p = r.at(root);
+            double u, v;
+            get_sphere_uv((p - current_center) / radius, u, v);
+            if (!mat->alpha_cutout(u, v, p))
+                return true;
         }
 
-        rec.t = root;
-        rec.p = r.at(rec.t);
-        vec3 outward_normal = (rec.p - current_center) / radius;
-        rec.set_face_normal(r, outward_normal);
-        rec.set_face_depth(r, camPos);
-        get_sphere_uv(outward_normal, rec.u, rec.v);
-        rec.mat = mat;
-        return true;
+        return false;
     }
 
     aabb bounding_box() const override { return bbox; }
 
+    bool is_emissive() const override { return mat->is_emissive(); }
+
+    double pdf_value(const point3& origin, const vec3& direction) const override {
+        // Samples the cone of directions subtended by the sphere. This method only works for
+        // stationary spheres.
+        hit_record rec;
+        if (!this->hit(ray(origin, direction), interval(0.001, infinity), rec, origin))
+            return 0;
+
+        auto distance_squared = (center.at(0) - origin).length_squared();
+        if (distance_squared <= radius*radius)
+            return 1 / (4*pi);
+
+        auto cos_theta_max = std::sqrt(1 - radius*radius/distance_squared);
+        auto solid_angle = 2*pi*(1-cos_theta_max);
+
+        return 1 / solid_angle;
+    }
+
+    vec3 random(const point3& origin) const override {
+        vec3 direction = center.at(0) - origin;
+        auto distance_squared = direction.length_squared();
+        if (distance_squared <= radius*radius) {
+            auto s = sample_2d();
+            return random_unit_vector(s.x(), s.y());
+        }
+
+        onb uvw(direction);
+        return uvw.transform(random_to_sphere(radius, distance_squared));
+    }
+
+    point3 get_center(double time) const { return center.at(time); }
+    double get_radius() const { return radius; }
+    std::shared_ptr<material> get_material() const { return mat; }
+
   private:
 
+    void set_bounding_box() {
+        auto rvec = vec3(radius, radius, radius);
+        aabb box1(center.at(0) - rvec, center.at(0) + rvec);
+        aabb box2(center.at(1) - rvec, center.at(1) + rvec);
+        bbox = aabb(box1, box2);
+    }
+
     static void get_sphere_uv(const point3& p, double& u, double& v) {
         // p: a given point on the sphere of radius one, centered at the origin.
         // u: returned value [0,1] of angle around the Y axis from X=-1.
@@ -74,6 +165,21 @@ class sphere : public hittable {
         v = theta / pi;
     }
 
+    static vec3 random_to_sphere(double radius, double distance_squared) {
+        // Returns a random direction, around +z, inside the cone that a sphere of the given
+        // radius and squared distance subtends.
+        auto s = sample_2d();
+        auto r1 = s.x();
+        auto r2 = s.y();
+        auto z = 1 + r2*(std::sqrt(1-radius*radius/distance_squared) - 1);
+
+        auto phi = 2*pi*r1;
+        auto x = std::cos(phi) * std::sqrt(1-z*z);
+        auto y = std::sin(phi) * std::sqrt(1-z*z);
+
+        return vec3(x, y, z);
+    }
+
     ray center;
     double radius;
     std::shared_ptr<material> mat;
@@ -19,6 +19,8 @@ class solid_color : public texture {
         return albedo;
     }
 
+    color get_albedo() const { return albedo; }
+
   private:
     color albedo;
 };
@@ -26,7 +28,7 @@ class solid_color : public texture {
 class checker_texture : public texture {
   public:
     checker_texture(double scale, std::shared_ptr<texture> even, std::shared_ptr<texture> odd)
-      : inv_scale(1.0 / scale), even(even), odd(odd) {}
+      : scale(scale), inv_scale(1.0 / scale), even(even), odd(odd) {}
 
     checker_texture(double scale, const color& c1, const color& c2)
       : checker_texture(scale, std::make_shared<solid_color>(c1), std::make_shared<solid_color>(c2)) {}
@@ -41,7 +43,12 @@ class checker_texture : public texture {
         return isEven ? even->value(u, v, p) : odd->value(u, v, p);
     }
 
+    double get_scale() const { return scale; }
+    std::shared_ptr<texture> get_even() const { return even; }
+    std::shared_ptr<texture> get_odd() const { return odd; }
+
   private:
+    double scale;
     double inv_scale;
     std::shared_ptr<texture> even;
     std::shared_ptr<texture> odd;
@@ -49,19 +56,19 @@ class checker_texture : public texture {
 
 class image_texture : public texture {
   public:
-    image_texture(const char* filename) : image(filename) {}
+    image_texture(const char* filename) : filename(filename), image(rtw_image::cached(filename)) {}
 
     color value(double u, double v, const point3& p) const override {
         // If we have no texture data, then return solid cyan as a debugging aid.
-        if (image.height() <= 0) return color(0,1,1);
+        if (image->height() <= 0) return color(0,1,1);
 
         // Clamp input texture coordinates to [0,1] x [1,0]
         u = interval(0,1).clamp(u);
         v = 1.0 - interval(0,1).clamp(v);  // Flip V to image coordinates
 
-        auto i = int(u * image.width());
-        auto j = int(v * image.height());
-        auto pixel = image.pixel_data(i,j);
+        auto i = int(u * image->width());
+        auto j = int(v * image->height());
+        auto pixel = image->pixel_data(i,j);
 
         auto color_scale = 1.0 / 255.0;
         return color(color_scale*pixel[0], color_scale*pixel[1], color_scale*pixel[2]);
@@ -69,20 +76,23 @@ class image_texture : public texture {
 
     double alpha(double u, double v, const point3& p) {
       // If we have no texture data, then return solid cyan as a debugging aid.
-        if (image.height() <= 0) return 1.0;
+        if (image->height() <= 0) return 1.0;
 
         // Clamp input texture coordinates to [0,1] x [1,0]
         u = interval(0,1).clamp(u);
         v = 1.0 - interval(0,1).clamp(v);  // Flip V to image coordinates
 
-        auto i = int(u * image.width());
-        auto j = int(v * image.height());
-        auto pixel = image.pixel_data(i,j);
+        auto i = int(u * image->width());
+        auto j = int(v * image->height());
+        auto pixel = image->pixel_data(i,j);
 
         auto color_scale = 1.0 / 255.0;
         return color_scale*pixel[3];
     }
 
+    const std::string& get_filename() const { return filename; }
+
   private:
-    rtw_image image;
+    std::string filename;
+    std::shared_ptr<const rtw_image> image;
 };
\ No newline at end of file
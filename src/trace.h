@@ -0,0 +1,141 @@
+#pragma once
+
+#include "render_stats.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// A timeline of what every thread did during a run, written in the Chrome trace event format
+// that chrome://tracing and ui.perfetto.dev load. Spans are recorded by trace_span objects into
+// a buffer per lane; a lane is a named thread (render threads are named by their index, so the
+// threads of successive passes share lanes). Appending to a lane takes no lock. Until
+// tracer().start() is called, a trace_span only loads one flag.
+
+struct trace_event {
+    const char* name;
+    const char* category;
+    double  start;      // Microseconds since tracer().start()
+    double  duration;   // Microseconds
+    const char* arg_name;
+    int64_t arg;
+};
+
+class trace_writer {
+  public:
+    bool enabled() const { return recording.load(std::memory_order_relaxed); }
+
+    void start() {
+        origin = std::chrono::steady_clock::now();
+        recording = true;
+    }
+
+    double now() const {
+        return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - origin).count();
+    }
+
+    void name_thread(const std::string& name) {
+        // Makes the calling thread record into the lane called `name`, creating it if needed;
+        // an empty name makes a new lane "thread N". Two threads must not share a lane at the
+        // same time.
+        if (!enabled())
+            return;
+        std::lock_guard<std::mutex> lock(mutex);
+        for (auto& l : lanes)
+            if (!name.empty() && l.name == name) {
+                current_lane() = &l;
+                return;
+            }
+        int id = int(lanes.size()) + 1;
+        lanes.push_back({ name.empty() ? "thread " + std::to_string(id) : name, id, {} });
+        current_lane() = &lanes.back();
+    }
+
+    void record(const char* name, const char* category, double start, double end,
+                const char* arg_name = nullptr, int64_t arg = 0) {
+        if (!current_lane())
+            name_thread("");
+        current_lane()->events.push_back({ name, category, start, end - start, arg_name, arg });
+    }
+
+    bool write(const std::string& filename) {
+        // Writes every lane's spans. Call it once the traced threads are done.
+        std::lock_guard<std::mutex> lock(mutex);
+        std::ofstream out(filename);
+        out << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+        bool first = true;
+        for (const auto& l : lanes) {
+            out << (first ? "" : ",\n")
+                << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << l.id
+                << ", \"args\": {\"name\": " << json_string(l.name) << "}}";
+            first = false;
+            for (const auto& e : l.events) {
+                out << ",\n{\"name\": \"" << e.name << "\", \"cat\": \"" << e.category
+                    << "\", \"ph\": \"X\", \"ts\": " << e.start << ", \"dur\": " << e.duration
+                    << ", \"pid\": 1, \"tid\": " << l.id;
+                if (e.arg_name)
+                    out << ", \"args\": {\"" << e.arg_name << "\": " << e.arg << "}";
+                out << "}";
+            }
+        }
+        out << "\n]}\n";
+
+        if (!out) {
+            std::cerr << "ERROR: Could not write trace '" << filename << "'.\n";
+            return false;
+        }
+        return true;
+    }
+
+  private:
+    struct lane {
+        std::string name;
+        int id;
+        std::vector<trace_event> events;
+    };
+
+    std::atomic<bool> recording{false};
+    std::chrono::steady_clock::time_point origin;
+    std::mutex mutex;
+    std::deque<lane> lanes;  // A deque, so lanes don't move as more are added
+
+    static lane*& current_lane() {
+        static thread_local lane* l = nullptr;
+        return l;
+    }
+};
+
+inline trace_writer& tracer() {
+    static trace_writer writer;
+    return writer;
+}
+
+class trace_span {
+  public:
+    // Records the time from its construction to its destruction as a span on the current
+    // thread's lane. Names and categories are string literals; they are not copied.
+    trace_span(const char* name, const char* category, const char* arg_name = nullptr, int64_t arg = 0)
+      : name(name), category(category), arg_name(arg_name), arg(arg), active(tracer().enabled())
+    {
+        if (active)
+            start = tracer().now();
+    }
+
+    ~trace_span() {
+        if (active)
+            tracer().record(name, category, start, tracer().now(), arg_name, arg);
+    }
+
+  private:
+    const char* name;
+    const char* category;
+    const char* arg_name;
+    int64_t arg;
+    bool   active;
+    double start = 0;
+};
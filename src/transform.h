@@ -0,0 +1,101 @@
+#pragma once
+
+#include "affine.h"
+#include "hittable.h"
+
+#include <typeinfo>
+
+class transform : public hittable {
+  public:
+    // An object moved by an affine map: any mix of translation, rotation around any axis and
+    // scaling, applied with one matrix per ray. translate and rotate_y wrappers directly below
+    // it are folded into the matrix when it is built, so translate(rotate_y(box)) costs one
+    // ray transform and one record fixup instead of two of each. The wrappers are read once:
+    // after that the object is moved with set_transform(), which replaces the whole map from
+    // the innermost object to the world.
+
+    transform(std::shared_ptr<hittable> object, const affine& to_world = affine())
+      : object(object)
+    {
+        auto map = to_world;
+        collapse(this->object, map);
+        set_transform(map);
+    }
+
+    void set_transform(const affine& to_world) {
+        // Moves the object. Bounding volumes above it need a refit() afterwards.
+        world_from_object = to_world;
+        object_from_world = to_world.inverse();
+        rigid = to_world.is_rigid();
+        bbox = world_from_object.bounds(object->bounding_box());
+    }
+
+    const affine& get_transform() const { return world_from_object; }
+    std::shared_ptr<hittable> inner() const { return object; }
+
+    bool hit(const ray& r, interval ray_t, hit_record& rec, const vec3& camPos) const override {
+        // The ray is moved into object space without normalizing its direction, so distances
+        // along it, and with them ray_t and rec.t, are the same in both spaces. So is the sign
+        // of dot(direction, normal), and with it front_face. A rigid map also keeps the
+        // distance to the camera, so the object measures it from the camera's object space
+        // position and the record only needs its point and normal moved back.
+        auto object_cam = rigid ? object_from_world.point(camPos) : camPos;
+        if (!object->hit(to_object_space(r), ray_t, rec, object_cam))
+            return false;
+
+        rec.p = world_from_object.point(rec.p);
+        if (rigid) {
+            // a rotation is its own inverse transpose and keeps the normal at unit length
+            rec.normal = world_from_object.vector(rec.normal);
+        } else {
+            rec.normal = unit_vector(object_from_world.transposed_vector(rec.normal));
+            rec.set_face_depth(r, camPos);
+        }
+
+        return true;
+    }
+
+    bool occluded(const ray& r, interval ray_t) const override {
+        return object->occluded(to_object_space(r), ray_t);
+    }
+
+    aabb bounding_box() const override { return bbox; }
+
+    void refit() override {
+        object->refit();
+        bbox = world_from_object.bounds(object->bounding_box());
+    }
+
+  protected:
+    std::shared_ptr<hittable> object;
+    affine world_from_object;
+    affine object_from_world;
+    bool rigid;
+    aabb bbox;
+
+    ray to_object_space(const ray& r) const {
+        return ray(object_from_world.point(r.origin()), object_from_world.vector(r.direction()),
+                   r.time());
+    }
+
+  private:
+    static void collapse(std::shared_ptr<hittable>& object, affine& to_world) {
+        // Unwraps translate, rotate_y and plain transform nodes below `object`, multiplying
+        // their maps into to_world. Derived nodes (instance) carry more than a map and stay.
+        for (;;) {
+            if (auto t = dynamic_cast<const translate*>(object.get())) {
+                to_world = to_world * affine::translation(t->get_offset());
+                object = t->inner();
+            } else if (auto r = dynamic_cast<const rotate_y*>(object.get())) {
+                to_world = to_world * affine::rotation(vec3(0,1,0), r->get_angle());
+                object = r->inner();
+            } else if (object && typeid(*object) == typeid(transform)) {
+                auto x = static_cast<const transform*>(object.get());
+                to_world = to_world * x->world_from_object;
+                object = x->object;
+            } else {
+                return;
+            }
+        }
+    }
+};
@@ -107,13 +107,22 @@ inline vec3 unit_vector(const vec3& v) {
     return v / v.length();
 }
 
+inline vec3 random_unit_vector(double r1, double r2) {
+    // Maps a point of the unit square to the unit sphere, preserving area: z is uniform in
+    // [-1,1] and the angle around z is uniform, so uniformly distributed points give uniformly
+    // distributed directions. No branches or rejection, so it always takes exactly two random
+    // numbers and stratified inputs stay stratified.
+    auto z   = 1 - 2*r1;
+    auto r   = std::sqrt(std::fmax(0.0, 1 - z*z));
+    auto phi = 2*pi*r2;
+
+    return vec3(r * std::cos(phi), r * std::sin(phi), z);
+}
+
 inline vec3 random_unit_vector() {
-    while (true) {
-        auto p = vec3::random(-1,1);
-        auto lensq = p.length_squared();
-        if (1e-160 < lensq && lensq <= 1)
-            return p / sqrt(lensq);
-    }
+    auto r1 = random_double();
+    auto r2 = random_double();
+    return random_unit_vector(r1, r2);
 }
 
 inline vec3 random_on_hemisphere(const vec3& normal) {
@@ -124,6 +133,24 @@ inline vec3 random_on_hemisphere(const vec3& normal) {
         return -on_unit_sphere;
 }
 
+inline vec3 random_cosine_direction(double r1, double r2) {
+    // Maps a point of the unit square to a direction around +z, so that uniformly distributed
+    // points give directions distributed with density cos(theta) / pi.
+    auto phi = 2*pi*r1;
+    auto x = std::cos(phi) * std::sqrt(r2);
+    auto y = std::sin(phi) * std::sqrt(r2);
+    auto z = std::sqrt(1-r2);
+
+    return vec3(x, y, z);
+}
+
+inline vec3 random_cosine_direction() {
+    // Returns a direction around +z, distributed with density cos(theta) / pi.
+    auto r1 = random_double();
+    auto r2 = random_double();
+    return random_cosine_direction(r1, r2);
+}
+
 inline vec3 reflect(const vec3& v, const vec3& n) {
     return v - 2*dot(v,n)*n;
 }
@@ -135,10 +162,24 @@ inline vec3 refract(const vec3& uv, const vec3& n, double etai_over_etat) {
     return r_out_perp + r_out_parallel;
 }
 
+inline vec3 random_in_unit_disk(double r1, double r2) {
+    // Maps a point of the unit square to the unit disk with Shirley and Chiu's concentric
+    // mapping, which takes squares around the center to rings and so keeps the area (and
+    // stratification) of its input much better than polar coordinates do. The choice of wedge
+    // is written as selects rather than branches so the compiler can vectorize it.
+    auto a = 2*r1 - 1;
+    auto b = 2*r2 - 1;
+
+    bool horizontal = std::fabs(a) > std::fabs(b);
+    auto r     = horizontal ? a : b;
+    auto theta = horizontal ? (pi/4) * (b / a) : (pi/2) - (pi/4) * (a / b);
+    theta = (a == 0 && b == 0) ? 0 : theta;
+
+    return vec3(r * std::cos(theta), r * std::sin(theta), 0);
+}
+
 inline vec3 random_in_unit_disk() {
-    while (true) {
-        auto p = vec3(random_double(-1,1), random_double(-1,1), 0);
-        if (p.length_squared() < 1)
-            return p;
-    }
+    auto r1 = random_double();
+    auto r2 = random_double();
+    return random_in_unit_disk(r1, r2);
 }
\ No newline at end of file